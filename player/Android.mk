@@ -6,7 +6,9 @@ LOCAL_TOP_PATH := $(LOCAL_PATH)/../..
 
 LOCAL_SRC_FILES:= \
     GstPlayer.cpp \
-    GstPlayerPipeline.cpp 
+    GstPlayerPipeline.cpp \
+    GstPlayerIndex.cpp \
+    GstPlayerPcmCache.cpp
  
 LOCAL_SHARED_LIBRARIES := \
     libgstapp-0.10		\
@@ -51,6 +53,8 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES:= \
     GstPlayer.cpp \
     GstPlayerPipeline.cpp \
+    GstPlayerIndex.cpp \
+    GstPlayerPcmCache.cpp \
     pipeline_test.cpp
 	
 LOCAL_SHARED_LIBRARIES := \
@@ -231,6 +231,86 @@ status_t GstPlayer::seekTo(int msec)
     return OK;
 }
 
+status_t GstPlayer::seekTo(int msec, int mode)
+{
+    GST_PLAYER_DEBUG ("seekTo(%d, %d)\n", msec, mode);
+    if(mGstPlayerPipeline == NULL)
+        return android::UNKNOWN_ERROR;    
+    if (mode < SEEK_MODE_KEY_UNIT || mode >= SEEK_MODE_COUNT)
+        return android::BAD_VALUE;
+
+    // can't always seek to end of streams - so we fudge a little
+    if ((msec == mDuration) && (mDuration > 0)) {
+        msec--;
+        GST_PLAYER_DEBUG ("Seek adjusted 1 msec from end\n");
+    }
+    if (!mGstPlayerPipeline->seekTo(msec, (GstPlayerSeekMode)mode))
+    {
+        GST_PLAYER_ERROR ("Failed to seekTo() in Gstplayer Pipeline.\n");
+        return android::UNKNOWN_ERROR;
+    }      
+    return OK;
+}
+
+status_t GstPlayer::setSeekMode(int mode)
+{
+    if(mGstPlayerPipeline == NULL)
+        return android::UNKNOWN_ERROR;    
+    if (mode < SEEK_MODE_KEY_UNIT || mode >= SEEK_MODE_COUNT)
+        return android::BAD_VALUE;
+
+    return mGstPlayerPipeline->setSeekMode((GstPlayerSeekMode)mode) ?  
+        OK : android::UNKNOWN_ERROR;
+}
+
+status_t GstPlayer::setPlaybackRate(int rate)
+{
+    GST_PLAYER_DEBUG ("setPlaybackRate(%d)\n", rate);
+    if(mGstPlayerPipeline == NULL)
+        return android::UNKNOWN_ERROR;    
+    if (!GstPlayerPipeline::isValidPlaybackRate(rate))
+        return android::BAD_VALUE;
+
+    return mGstPlayerPipeline->setPlaybackRate(rate) ?  
+        OK : android::UNKNOWN_ERROR;
+}
+
+status_t GstPlayer::setPlaybackSpeed(float speed)
+{
+    GST_PLAYER_DEBUG ("setPlaybackSpeed(%f)\n", speed);
+    if(mGstPlayerPipeline == NULL)
+        return android::UNKNOWN_ERROR;    
+    if (!GstPlayerPipeline::isValidPlaybackSpeed(speed))
+        return android::BAD_VALUE;
+
+    return mGstPlayerPipeline->setPlaybackSpeed(speed) ?  
+        OK : android::UNKNOWN_ERROR;
+}
+
+status_t GstPlayer::setAudioStreamType(int streamType)
+{
+    GST_PLAYER_DEBUG ("setAudioStreamType(%d)\n", streamType);
+    if(mGstPlayerPipeline == NULL)
+        return android::UNKNOWN_ERROR;    
+
+    return mGstPlayerPipeline->setAudioStreamType(streamType) ?  
+        OK : android::BAD_VALUE;
+}
+
+status_t GstPlayer::getAudioUnderruns(int* count)
+{
+    if(mGstPlayerPipeline == NULL)
+        return android::UNKNOWN_ERROR;    
+
+    return mGstPlayerPipeline->getAudioUnderruns(count) ?  
+        OK : android::BAD_VALUE;
+}
+
+status_t GstPlayer::reloadTunables()
+{
+    return GstPlayerPipeline::reloadTunables() ? OK : android::BAD_VALUE;
+}
+
 status_t GstPlayer::reset()
 {
     if(mGstPlayerPipeline == NULL)
@@ -247,5 +327,25 @@ status_t GstPlayer::setLooping(int loop)
     return mGstPlayerPipeline->setLooping(loop) ?  OK : android::UNKNOWN_ERROR;
 }
 
+status_t GstPlayer::setNextDataSource(const char *url)
+{
+    if (mGstPlayerPipeline == NULL || url == NULL)
+        return android::UNKNOWN_ERROR;
+
+    return mGstPlayerPipeline->setNextDataSource(url) ?  
+        OK : android::UNKNOWN_ERROR;
+}
+
+status_t GstPlayer::setNextDataSource(int fd, int64_t offset, int64_t length)
+{
+    GST_PLAYER_DEBUG("fd: %i, offset: %ld, len: %ld\n", fd, (long)offset, (long)length);
+
+    if (mGstPlayerPipeline == NULL)
+        return android::UNKNOWN_ERROR;
+
+    return mGstPlayerPipeline->setNextDataSource(fd, offset, length) ?  
+        OK : android::UNKNOWN_ERROR;
+}
+
 }; // namespace android
 
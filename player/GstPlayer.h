@@ -61,6 +61,26 @@ public:
     virtual status_t    setLooping(int loop);
     virtual player_type playerType() { return GST_PLAYER; }
 
+    // gapless playback, the next source starts right after current one
+    status_t            setNextDataSource(const char *url);
+    status_t            setNextDataSource(int fd, int64_t offset, int64_t length);
+
+    // default seek precision of seekTo(), see GstPlayerSeekMode
+    status_t            setSeekMode(int mode);
+    status_t            seekTo(int msec, int mode);
+
+    // trick play: 1 (normal), 2, 4, 8, -2, -4
+    status_t            setPlaybackRate(int rate);
+    // speed of normal playback, 0.5 to 3, audio keeps its pitch
+    status_t            setPlaybackSpeed(float speed);
+
+    // AudioSystem stream type, it selects low latency or deep buffering
+    status_t            setAudioStreamType(int streamType);
+    status_t            getAudioUnderruns(int* count);
+
+    // reload [Performance] of gst.conf, players created afterwards use it
+    static status_t     reloadTunables();
+
     // make available to GstPlayerPipeline
     void sendEvent(int msg, int ext1=0, int ext2=0) { MediaPlayerBase::sendEvent(msg, ext1, ext2); }
 
@@ -0,0 +1,604 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "GstLog.h"
+#include <utils/Log.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "GstPlayerIndex.h"
+
+#define LOCK(pMutex)        pthread_mutex_lock(pMutex)
+#define UNLOCK(pMutex)      pthread_mutex_unlock(pMutex)
+
+// writer string of demuxers which write file offsets, and of demuxers which
+// also look up the index when seeking
+#define INDEX_WRITER_PREFIX     "demux:"
+#define INDEX_SEEKER_PREFIX     "demux:seek:"
+
+// number of files whose index is kept in memory
+#define INDEX_CACHE_FILES       16
+
+// sidecar file: magic, entry count, then entries
+#define INDEX_SIDECAR_MAGIC     0x31584449  /* "IDX1" */
+#define INDEX_SIDECAR_SUFFIX    ".idx"
+#define INDEX_SIDECAR_MAX       (1 << 20)
+
+// in memory index cache, shared by all players. Oldest file is evicted first.
+static GHashTable* index_cache = NULL;
+static GQueue index_cache_keys = G_QUEUE_INIT;
+static gchar* index_sidecar_dir = NULL;
+static pthread_mutex_t index_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// demuxers whose seek looks up the key frame before the target in the
+// element index, and reads from its offset
+static const gchar* index_seekers[] =
+{
+    "flvdemux",
+    NULL
+};
+
+static void free_entries(gpointer data)
+{
+    g_array_free((GArray*)data, TRUE);
+}
+
+GstPlayerIndex::GstPlayerIndex()
+{
+    pthread_mutex_init(&mMutex, NULL);
+    mIndex = NULL;
+    mKey = NULL;
+    mEntries = g_array_new(FALSE, FALSE, sizeof(GstPlayerIndexEntry));
+    mSorted = true;
+    mDirty = false;
+    mPreloaded = false;
+    mWriters = g_array_new(FALSE, FALSE, sizeof(gint));
+    mSeekers = g_array_new(FALSE, FALSE, sizeof(gint));
+}
+
+GstPlayerIndex::~GstPlayerIndex()
+{
+    detach();
+    clearFile();
+    g_array_free(mEntries, TRUE);
+    g_array_free(mWriters, TRUE);
+    g_array_free(mSeekers, TRUE);
+    pthread_mutex_destroy(&mMutex);
+}
+
+// setFile()
+// Identify file by device, inode, size and modification time, so a modified
+// file never uses a stale index
+//
+bool GstPlayerIndex::setFile(int fd)
+{
+    struct stat stat_buf;
+
+    if (fd <= 0 || fstat(fd, &stat_buf) != 0)
+    {
+        clearFile();
+        return false;
+    }
+    set_key(&stat_buf);
+    return true;
+}
+
+bool GstPlayerIndex::setFile(const char *path)
+{
+    struct stat stat_buf;
+
+    if (g_str_has_prefix(path, "file://"))
+        path += strlen("file://");
+    if (path[0] != '/' || stat(path, &stat_buf) != 0)
+    {
+        clearFile();
+        return false;
+    }
+    set_key(&stat_buf);
+    return true;
+}
+
+void GstPlayerIndex::clearFile()
+{
+    LOCK(&mMutex);
+    g_free(mKey);
+    mKey = NULL;
+    reset();
+    UNLOCK(&mMutex);
+}
+
+void GstPlayerIndex::set_key(struct stat* stat_buf)
+{
+    gchar* key = g_strdup_printf("%llx-%llx-%llx-%lx",
+            (unsigned long long)stat_buf->st_dev,
+            (unsigned long long)stat_buf->st_ino,
+            (unsigned long long)stat_buf->st_size,
+            (unsigned long)stat_buf->st_mtime);
+    GArray* cached = cache_lookup(key);
+
+    LOCK(&mMutex);
+    g_free(mKey);
+    mKey = key;
+    reset();
+    if (cached)
+    {
+        g_array_append_vals(mEntries, cached->data, cached->len);
+        g_array_free(cached, TRUE);
+    }
+    GST_PLAYER_DEBUG("Index of %s: %d key frames cached\n", mKey,
+            mEntries->len);
+    UNLOCK(&mMutex);
+}
+
+// reset()
+// Drop entries of previous file, mMutex shall be held
+//
+void GstPlayerIndex::reset()
+{
+    g_array_set_size(mEntries, 0);
+    g_array_set_size(mWriters, 0);
+    g_array_set_size(mSeekers, 0);
+    mSorted = true;
+    mDirty = false;
+    mPreloaded = false;
+}
+
+// attach()
+// Set a memory index to pipeline and to every element added into it later.
+// Bins only pass their index to existing children.
+//
+void GstPlayerIndex::attach(GstElement* pipeline)
+{
+    if (mIndex)
+        return;
+
+    mIndex = gst_index_factory_make("memindex");
+    if (mIndex == NULL)
+    {
+        GST_PLAYER_WARNING("memindex is not available, key frame index "
+                "is disabled\n");
+        return;
+    }
+    gst_index_set_resolver(mIndex, resolver, this);
+    g_signal_connect(mIndex, "entry-added", (GCallback)entry_added, this);
+
+    gst_element_set_index(pipeline, mIndex);
+    if (GST_IS_BIN(pipeline))
+        g_signal_connect(pipeline, "element-added",
+                (GCallback)element_added, this);
+}
+
+void GstPlayerIndex::detach()
+{
+    if (mIndex == NULL)
+        return;
+    g_signal_handlers_disconnect_by_func(mIndex, (gpointer)entry_added, this);
+    gst_object_unref(mIndex);
+    mIndex = NULL;
+}
+
+void GstPlayerIndex::element_added(GstBin* bin, GstElement* element,
+        gpointer user_data)
+{
+    GstPlayerIndex* index = (GstPlayerIndex*)user_data;
+
+    if (index->mIndex == NULL)
+        return;
+    gst_element_set_index(element, index->mIndex);
+    if (GST_IS_BIN(element))
+        g_signal_connect(element, "element-added",
+                (GCallback)element_added, index);
+}
+
+// resolver()
+// Name writers. Only byte offsets of demuxers are offsets in file, other
+// elements (parsers, tag demuxers) index their own input.
+//
+gboolean GstPlayerIndex::resolver(GstIndex* index, GstObject* writer,
+        gchar** writer_string, gpointer user_data)
+{
+    const gchar* klass = "";
+    const gchar* name = "";
+
+    if (GST_IS_ELEMENT(writer))
+    {
+        GstElementFactory* factory = gst_element_get_factory(
+                GST_ELEMENT(writer));
+        if (factory)
+        {
+            klass = gst_element_factory_get_klass(factory);
+            name = GST_PLUGIN_FEATURE_NAME(factory);
+        }
+    }
+
+    if (strstr(klass, "Demux") && !strstr(klass, "Tag") &&
+            !strstr(klass, "Metadata"))
+    {
+        bool seeker = false;
+
+        for (gint i = 0; index_seekers[i]; i++)
+        {
+            if (strcmp(name, index_seekers[i]) == 0)
+                seeker = true;
+        }
+        *writer_string = g_strconcat(seeker ? INDEX_SEEKER_PREFIX :
+                INDEX_WRITER_PREFIX, GST_OBJECT_NAME(writer), NULL);
+    }
+    else
+    {
+        *writer_string = gst_object_get_path_string(writer);
+    }
+    return TRUE;
+}
+
+// entry_added()
+// Called in streaming thread when an element writes the index
+//
+void GstPlayerIndex::entry_added(GstIndex* index, GstIndexEntry* entry,
+        gpointer user_data)
+{
+    GstPlayerIndex* player_index = (GstPlayerIndex*)user_data;
+    GstPlayerIndexEntry key_entry;
+    gboolean has_time = FALSE, has_offset = FALSE;
+    gboolean preload = FALSE;
+
+    if (entry->type == GST_INDEX_ENTRY_ID)
+    {
+        const gchar* desc = GST_INDEX_ID_DESCRIPTION(entry);
+        if (desc && g_str_has_prefix(desc, INDEX_WRITER_PREFIX))
+        {
+            GST_PLAYER_DEBUG("Collect key frames of %s, id %d\n", desc,
+                    entry->id);
+            LOCK(&player_index->mMutex);
+            g_array_append_val(player_index->mWriters, entry->id);
+            if (g_str_has_prefix(desc, INDEX_SEEKER_PREFIX))
+                g_array_append_val(player_index->mSeekers, entry->id);
+            UNLOCK(&player_index->mMutex);
+        }
+        return;
+    }
+
+    if (entry->type != GST_INDEX_ENTRY_ASSOCIATION ||
+            !(GST_INDEX_ASSOC_FLAGS(entry) & GST_ASSOCIATION_FLAG_KEY_UNIT))
+        return;
+
+    for (gint i = 0; i < GST_INDEX_NASSOCS(entry); i++)
+    {
+        if (GST_INDEX_ASSOC_FORMAT(entry, i) == GST_FORMAT_TIME)
+        {
+            key_entry.time = (guint64)GST_INDEX_ASSOC_VALUE(entry, i);
+            has_time = TRUE;
+        }
+        else if (GST_INDEX_ASSOC_FORMAT(entry, i) == GST_FORMAT_BYTES)
+        {
+            key_entry.offset = GST_INDEX_ASSOC_VALUE(entry, i);
+            has_offset = TRUE;
+        }
+    }
+    if (!has_time || !has_offset)
+        return;
+
+    LOCK(&player_index->mMutex);
+    if (player_index->mKey && has_id(player_index->mWriters, entry->id))
+    {
+        // first key frame of a demuxer which seeks through the index, give
+        // it the cached key frames too. Others don't read them.
+        if (!player_index->mPreloaded && 
+                has_id(player_index->mSeekers, entry->id))
+        {
+            player_index->mPreloaded = true;
+            preload = player_index->mEntries->len > 0;
+        }
+        g_array_append_val(player_index->mEntries, key_entry);
+        player_index->mSorted = false;
+        player_index->mDirty = true;
+    }
+    UNLOCK(&player_index->mMutex);
+
+    if (preload)
+        player_index->preload(entry->id);
+}
+
+bool GstPlayerIndex::has_id(GArray* ids, gint id)
+{
+    for (guint i = 0; i < ids->len; i++)
+    {
+        if (g_array_index(ids, gint, i) == id)
+            return true;
+    }
+    return false;
+}
+
+// preload()
+// Add cached key frames to the element index of a demuxer which looks up the
+// index when seeking, so it finds key frames it hasn't reached yet in this
+// playback at once, instead of scanning the file up to them
+//
+void GstPlayerIndex::preload(gint id)
+{
+    GArray* entries;
+
+    LOCK(&mMutex);
+    entries = g_array_sized_new(FALSE, FALSE, sizeof(GstPlayerIndexEntry),
+            mEntries->len);
+    g_array_append_vals(entries, mEntries->data, mEntries->len);
+    UNLOCK(&mMutex);
+
+    GST_PLAYER_DEBUG("Preload %d key frames to writer %d\n", entries->len, id);
+    // entry_added() collects them again, they are merged in commit()
+    for (guint i = 0; i < entries->len; i++)
+    {
+        GstPlayerIndexEntry* e = &g_array_index(entries, GstPlayerIndexEntry, i);
+        gst_index_add_association(mIndex, id, GST_ASSOCIATION_FLAG_KEY_UNIT,
+                GST_FORMAT_TIME, (gint64)e->time,
+                GST_FORMAT_BYTES, e->offset, NULL);
+    }
+    g_array_free(entries, TRUE);
+}
+
+gint GstPlayerIndex::compare_entry(gconstpointer a, gconstpointer b)
+{
+    const GstPlayerIndexEntry* ea = (const GstPlayerIndexEntry*)a;
+    const GstPlayerIndexEntry* eb = (const GstPlayerIndexEntry*)b;
+
+    if (ea->time != eb->time)
+        return (ea->time < eb->time) ? -1 : 1;
+    if (ea->offset != eb->offset)
+        return (ea->offset < eb->offset) ? -1 : 1;
+    return 0;
+}
+
+bool GstPlayerIndex::lookup(guint64 time, guint64* keytime, gint64* offset)
+{
+    bool ret = false;
+
+    LOCK(&mMutex);
+    if (mKey && mEntries->len > 0)
+    {
+        if (!mSorted)
+        {
+            g_array_sort(mEntries, compare_entry);
+            mSorted = true;
+        }
+
+        // binary search the last key frame not after time
+        guint low = 0, high = mEntries->len;
+        while (low < high)
+        {
+            guint mid = (low + high) / 2;
+            if (g_array_index(mEntries, GstPlayerIndexEntry, mid).time <= time)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        if (low > 0)
+        {
+            GstPlayerIndexEntry* e =
+                &g_array_index(mEntries, GstPlayerIndexEntry, low - 1);
+            *keytime = e->time;
+            *offset = e->offset;
+            ret = true;
+        }
+    }
+    UNLOCK(&mMutex);
+    return ret;
+}
+
+// commit()
+// Remove duplicated entries, then store index of current file into cache
+//
+void GstPlayerIndex::commit()
+{
+    GArray* entries = NULL;
+    gchar* key = NULL;
+
+    LOCK(&mMutex);
+    if (mKey && mDirty)
+    {
+        g_array_sort(mEntries, compare_entry);
+        guint n = 0;
+        for (guint i = 0; i < mEntries->len; i++)
+        {
+            GstPlayerIndexEntry* e =
+                &g_array_index(mEntries, GstPlayerIndexEntry, i);
+            if (n > 0 && compare_entry(e,
+                    &g_array_index(mEntries, GstPlayerIndexEntry, n - 1)) == 0)
+                continue;
+            g_array_index(mEntries, GstPlayerIndexEntry, n++) = *e;
+        }
+        g_array_set_size(mEntries, n);
+        mSorted = true;
+        mDirty = false;
+
+        entries = g_array_sized_new(FALSE, FALSE,
+                sizeof(GstPlayerIndexEntry), n);
+        g_array_append_vals(entries, mEntries->data, n);
+        key = g_strdup(mKey);
+    }
+    UNLOCK(&mMutex);
+
+    if (entries)
+    {
+        GST_PLAYER_DEBUG("Cache %d key frames of %s\n", entries->len, key);
+        sidecar_save(key, entries);
+        cache_store(key, entries);
+        g_free(key);
+    }
+}
+
+void GstPlayerIndex::setSidecarDir(const char *dir)
+{
+    LOCK(&index_cache_mutex);
+    g_free(index_sidecar_dir);
+    index_sidecar_dir = (dir && dir[0]) ? g_strdup(dir) : NULL;
+    UNLOCK(&index_cache_mutex);
+}
+
+// cache_lookup()
+// Return a copy of cached entries of key, from memory or from sidecar file
+//
+GArray* GstPlayerIndex::cache_lookup(const gchar* key)
+{
+    GArray* entries = NULL;
+
+    LOCK(&index_cache_mutex);
+    if (index_cache)
+    {
+        GArray* cached = (GArray*)g_hash_table_lookup(index_cache, key);
+        if (cached)
+        {
+            entries = g_array_sized_new(FALSE, FALSE,
+                    sizeof(GstPlayerIndexEntry), cached->len);
+            g_array_append_vals(entries, cached->data, cached->len);
+        }
+    }
+    UNLOCK(&index_cache_mutex);
+
+    if (entries == NULL)
+    {
+        GArray* loaded = sidecar_load(key);
+        if (loaded)
+        {
+            entries = g_array_sized_new(FALSE, FALSE,
+                    sizeof(GstPlayerIndexEntry), loaded->len);
+            g_array_append_vals(entries, loaded->data, loaded->len);
+            cache_store(key, loaded);
+        }
+    }
+    return entries;
+}
+
+// cache_store()
+// Take ownership of entries
+//
+void GstPlayerIndex::cache_store(const gchar* key, GArray* entries)
+{
+    LOCK(&index_cache_mutex);
+    if (index_cache == NULL)
+    {
+        index_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                free_entries);
+    }
+
+    if (g_hash_table_lookup(index_cache, key) == NULL)
+    {
+        g_queue_push_tail(&index_cache_keys, g_strdup(key));
+        while (g_queue_get_length(&index_cache_keys) > INDEX_CACHE_FILES)
+        {
+            gchar* oldest = (gchar*)g_queue_pop_head(&index_cache_keys);
+            g_hash_table_remove(index_cache, oldest);
+            g_free(oldest);
+        }
+    }
+    g_hash_table_replace(index_cache, g_strdup(key), entries);
+    UNLOCK(&index_cache_mutex);
+}
+
+GArray* GstPlayerIndex::sidecar_load(const gchar* key)
+{
+    gchar* path = NULL;
+    FILE* file = NULL;
+    GArray* entries = NULL;
+    guint32 header[2];
+
+    LOCK(&index_cache_mutex);
+    if (index_sidecar_dir)
+    {
+        path = g_strconcat(index_sidecar_dir, G_DIR_SEPARATOR_S, key,
+                INDEX_SIDECAR_SUFFIX, NULL);
+    }
+    UNLOCK(&index_cache_mutex);
+    if (path == NULL)
+        return NULL;
+
+    file = fopen(path, "rb");
+    if (file == NULL)
+        goto EXIT;
+
+    if (fread(header, sizeof(header), 1, file) != 1 ||
+            header[0] != INDEX_SIDECAR_MAGIC || header[1] == 0 ||
+            header[1] > INDEX_SIDECAR_MAX)
+    {
+        GST_PLAYER_WARNING("Invalid index file %s\n", path);
+        goto EXIT;
+    }
+
+    entries = g_array_sized_new(FALSE, FALSE, sizeof(GstPlayerIndexEntry),
+            header[1]);
+    g_array_set_size(entries, header[1]);
+    if (fread(entries->data, sizeof(GstPlayerIndexEntry), header[1], file)
+            != header[1])
+    {
+        GST_PLAYER_WARNING("Truncated index file %s\n", path);
+        g_array_free(entries, TRUE);
+        entries = NULL;
+        goto EXIT;
+    }
+    GST_PLAYER_DEBUG("Load %d key frames from %s\n", entries->len, path);
+
+EXIT:
+    if (file)
+        fclose(file);
+    g_free(path);
+    return entries;
+}
+
+void GstPlayerIndex::sidecar_save(const gchar* key, GArray* entries)
+{
+    gchar* path = NULL;
+    gchar* tmp_path = NULL;
+    FILE* file = NULL;
+    guint32 header[2] = { INDEX_SIDECAR_MAGIC, entries->len };
+
+    LOCK(&index_cache_mutex);
+    if (index_sidecar_dir)
+    {
+        path = g_strconcat(index_sidecar_dir, G_DIR_SEPARATOR_S, key,
+                INDEX_SIDECAR_SUFFIX, NULL);
+    }
+    UNLOCK(&index_cache_mutex);
+    if (path == NULL || entries->len == 0 || entries->len > INDEX_SIDECAR_MAX)
+        goto EXIT;
+
+    // write a temporary file then rename, so readers never see a partial one
+    tmp_path = g_strconcat(path, ".tmp", NULL);
+    file = fopen(tmp_path, "wb");
+    if (file == NULL)
+    {
+        GST_PLAYER_WARNING("Cannot create index file %s\n", tmp_path);
+        goto EXIT;
+    }
+    if (fwrite(header, sizeof(header), 1, file) != 1 ||
+            fwrite(entries->data, sizeof(GstPlayerIndexEntry), entries->len,
+                file) != entries->len)
+    {
+        GST_PLAYER_WARNING("Cannot write index file %s\n", tmp_path);
+        fclose(file);
+        unlink(tmp_path);
+        goto EXIT;
+    }
+    fclose(file);
+    if (rename(tmp_path, path) != 0)
+        unlink(tmp_path);
+
+EXIT:
+    g_free(tmp_path);
+    g_free(path);
+}
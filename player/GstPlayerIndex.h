@@ -0,0 +1,100 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _GST_PLAYER_INDEX_H_
+#define _GST_PLAYER_INDEX_H_
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <gst/gst.h>
+
+// one key frame: its timestamp and the byte offset in file
+typedef struct
+{
+    guint64 time;
+    gint64  offset;
+} GstPlayerIndexEntry;
+
+// GstPlayerIndex
+// Build a time -> byte offset key frame index, from the associations which
+// demuxers write into a GstIndex while data streams through. The index is
+// cached per file identity in memory, and optionally in a sidecar file, so
+// that the next playback of the same file starts with a complete index.
+// Cached key frames are given back only to demuxers which look up the
+// element index when seeking (flvdemux); others, and parsers like mp3parse
+// and aacparse which don't use GstIndex at all, seek as before.
+//
+class GstPlayerIndex
+{
+public:
+    GstPlayerIndex();
+    ~GstPlayerIndex();
+
+    // set the file being played, load its index from cache if there is one
+    bool setFile(int fd);
+    bool setFile(const char *path);
+    void clearFile();
+
+    // collect index entries written by elements of pipeline
+    void attach(GstElement* pipeline);
+    void detach();
+
+    // find the key frame at or before time, return false if it's unknown
+    bool lookup(guint64 time, guint64* keytime, gint64* offset);
+
+    // store collected entries into cache
+    void commit();
+
+    // directory of sidecar files, empty to disable them
+    static void setSidecarDir(const char *dir);
+
+private:
+    static gboolean resolver(GstIndex* index, GstObject* writer,
+            gchar** writer_string, gpointer user_data);
+    static void entry_added(GstIndex* index, GstIndexEntry* entry,
+            gpointer user_data);
+    static void element_added(GstBin* bin, GstElement* element,
+            gpointer user_data);
+
+    void set_key(struct stat* stat_buf);
+    void reset();
+    void preload(gint id);
+    static bool has_id(GArray* ids, gint id);
+    static gint compare_entry(gconstpointer a, gconstpointer b);
+    static GArray* cache_lookup(const gchar* key);
+    static void cache_store(const gchar* key, GArray* entries);
+    static GArray* sidecar_load(const gchar* key);
+    static void sidecar_save(const gchar* key, GArray* entries);
+
+    GstIndex*   mIndex;
+    // identity of current file, NULL if the file isn't indexed
+    gchar*      mKey;
+    // key frames loaded from cache and collected in this playback
+    GArray*     mEntries;
+    bool        mSorted;
+    bool        mDirty;
+    bool        mPreloaded;
+    // ids of demuxers whose byte offsets are file offsets, and of those
+    // among them which seek through the index
+    GArray*     mWriters;
+    GArray*     mSeekers;
+    pthread_mutex_t mMutex;
+};
+
+#endif   /*_GST_PLAYER_INDEX_H_*/
@@ -0,0 +1,430 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include "GstLog.h"
+#include <utils/Log.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "GstPlayerPcmCache.h"
+
+#define LOCK(pMutex)        pthread_mutex_lock(pMutex)
+#define UNLOCK(pMutex)      pthread_mutex_unlock(pMutex)
+
+// PCM cache, shared by all players. Keys are kept from the least recently
+// played clip to the most recently played one, which is evicted last.
+static GHashTable* pcm_cache = NULL;
+static GQueue pcm_cache_keys = G_QUEUE_INIT;
+static guint64 pcm_cache_bytes = 0;
+static int pcm_cache_max_duration = 0;
+static guint64 pcm_cache_max_bytes = 0;
+static pthread_mutex_t pcm_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_pcm(gpointer data)
+{
+    gst_buffer_unref((GstBuffer*)data);
+}
+
+GstPlayerPcmCache::GstPlayerPcmCache()
+{
+    pthread_mutex_init(&mMutex, NULL);
+    mKey = NULL;
+    mCapturing = false;
+    mData = NULL;
+    mCaps = NULL;
+    mMaxBytes = 0;
+}
+
+GstPlayerPcmCache::~GstPlayerPcmCache()
+{
+    clearFile();
+    pthread_mutex_destroy(&mMutex);
+}
+
+// setFile()
+// Identify file by device, inode, size and modification time, like
+// GstPlayerIndex, so a modified file never plays stale PCM
+//
+bool GstPlayerPcmCache::setFile(int fd)
+{
+    struct stat stat_buf;
+
+    if (fd <= 0 || fstat(fd, &stat_buf) != 0)
+    {
+        clearFile();
+        return false;
+    }
+    set_key(&stat_buf);
+    return true;
+}
+
+bool GstPlayerPcmCache::setFile(const char *path)
+{
+    struct stat stat_buf;
+
+    if (g_str_has_prefix(path, "file://"))
+        path += strlen("file://");
+    if (path[0] != '/' || stat(path, &stat_buf) != 0)
+    {
+        clearFile();
+        return false;
+    }
+    set_key(&stat_buf);
+    return true;
+}
+
+void GstPlayerPcmCache::clearFile()
+{
+    LOCK(&mMutex);
+    g_free(mKey);
+    mKey = NULL;
+    reset();
+    UNLOCK(&mMutex);
+}
+
+void GstPlayerPcmCache::set_key(struct stat* stat_buf)
+{
+    gchar* key = g_strdup_printf("%llx-%llx-%llx-%lx",
+            (unsigned long long)stat_buf->st_dev,
+            (unsigned long long)stat_buf->st_ino,
+            (unsigned long long)stat_buf->st_size,
+            (unsigned long)stat_buf->st_mtime);
+    GstBuffer* cached = cache_lookup(key);
+    bool enabled;
+
+    LOCK(&pcm_cache_mutex);
+    enabled = pcm_cache_max_duration > 0 && pcm_cache_max_bytes > 0;
+    UNLOCK(&pcm_cache_mutex);
+
+    LOCK(&mMutex);
+    g_free(mKey);
+    mKey = key;
+    reset();
+    // a cached clip is played from cache, there's nothing to capture
+    mCapturing = enabled && cached == NULL;
+    UNLOCK(&mMutex);
+
+    if (cached)
+        gst_buffer_unref(cached);
+}
+
+// reset()
+// Drop PCM captured from previous file, mMutex shall be held
+//
+void GstPlayerPcmCache::reset()
+{
+    if (mData)
+    {
+        g_byte_array_free(mData, TRUE);
+        mData = NULL;
+    }
+    if (mCaps)
+    {
+        gst_caps_unref(mCaps);
+        mCaps = NULL;
+    }
+    mMaxBytes = 0;
+    mCapturing = false;
+}
+
+GstBuffer* GstPlayerPcmCache::lookup()
+{
+    gchar* key = NULL;
+    GstBuffer* pcm = NULL;
+
+    LOCK(&mMutex);
+    key = g_strdup(mKey);
+    UNLOCK(&mMutex);
+
+    if (key)
+    {
+        pcm = cache_lookup(key);
+        if (pcm)
+            GST_PLAYER_DEBUG("PCM of %s is cached, %d bytes\n", key,
+                    GST_BUFFER_SIZE(pcm));
+        g_free(key);
+    }
+    return pcm;
+}
+
+void GstPlayerPcmCache::abort()
+{
+    LOCK(&mMutex);
+    if (mCapturing)
+        GST_PLAYER_DEBUG("Stop capturing PCM of %s\n", mKey);
+    reset();
+    UNLOCK(&mMutex);
+}
+
+bool GstPlayerPcmCache::parseCaps(GstCaps* caps, int* rate, int* frameSize)
+{
+    GstStructure* structure;
+    gint channels = 0, width = 0;
+
+    if (caps == NULL || gst_caps_get_size(caps) != 1)
+        return false;
+    structure = gst_caps_get_structure(caps, 0);
+    if (!gst_structure_has_name(structure, "audio/x-raw-int") &&
+            !gst_structure_has_name(structure, "audio/x-raw-float"))
+        return false;
+    if (!gst_structure_get_int(structure, "rate", rate) ||
+            !gst_structure_get_int(structure, "channels", &channels) ||
+            !gst_structure_get_int(structure, "width", &width) ||
+            *rate <= 0 || channels <= 0 || width <= 0 || width % 8 != 0)
+        return false;
+    *frameSize = channels * width / 8;
+    return true;
+}
+
+// start_capture()
+// The first buffer tells the format, hence the bytes of the longest clip
+// which is cached. mMutex shall be held.
+//
+void GstPlayerPcmCache::start_capture(GstCaps* caps)
+{
+    int rate, frame_size;
+    guint64 max_bytes;
+
+    if (!parseCaps(caps, &rate, &frame_size))
+    {
+        GST_PLAYER_DEBUG("PCM of %s isn't cached, caps aren't raw audio\n",
+                mKey);
+        reset();
+        return;
+    }
+
+    LOCK(&pcm_cache_mutex);
+    max_bytes = (guint64)pcm_cache_max_duration * rate / 1000 * frame_size;
+    if (max_bytes > pcm_cache_max_bytes)
+        max_bytes = pcm_cache_max_bytes;
+    UNLOCK(&pcm_cache_mutex);
+
+    mCaps = gst_caps_ref(caps);
+    mMaxBytes = (guint)MIN(max_bytes, (guint64)G_MAXUINT);
+    mData = g_byte_array_new();
+}
+
+// capture()
+// Only a playback from the beginning to EOS at normal rate is captured, a
+// seek, a new segment or a format change stops it
+//
+void GstPlayerPcmCache::capture(GstMiniObject* data)
+{
+    GByteArray* pcm_data = NULL;
+    GstCaps* caps = NULL;
+    gchar* key = NULL;
+
+    LOCK(&mMutex);
+    if (!mCapturing || mKey == NULL)
+        goto EXIT;
+
+    if (GST_IS_EVENT(data))
+    {
+        GstEvent* event = GST_EVENT(data);
+
+        switch (GST_EVENT_TYPE(event))
+        {
+        case GST_EVENT_FLUSH_START:
+        case GST_EVENT_FLUSH_STOP:
+            GST_PLAYER_DEBUG("PCM of %s isn't cached, it's seeked\n", mKey);
+            reset();
+            break;
+        case GST_EVENT_NEWSEGMENT:
+        {
+            gboolean update;
+            gdouble rate, applied_rate;
+            GstFormat format;
+            gint64 start, stop, position;
+
+            // a time stretched segment is at rate 1 with its rate applied
+            gst_event_parse_new_segment_full(event, &update, &rate, 
+                    &applied_rate, &format, &start, &stop, &position);
+            if (rate != 1.0 || applied_rate != 1.0 || 
+                    (format == GST_FORMAT_TIME && start != 0) ||
+                    (mData && mData->len > 0))
+            {
+                GST_PLAYER_DEBUG("PCM of %s isn't cached, it doesn't play "
+                        "from the beginning\n", mKey);
+                reset();
+            }
+            break;
+        }
+        case GST_EVENT_EOS:
+            if (mData && mData->len > 0)
+            {
+                pcm_data = mData;
+                caps = mCaps;
+                key = g_strdup(mKey);
+                mData = NULL;
+                mCaps = NULL;
+            }
+            reset();
+            break;
+        default:
+            break;
+        }
+    }
+    else if (GST_IS_BUFFER(data))
+    {
+        GstBuffer* buffer = GST_BUFFER(data);
+        GstCaps* buffer_caps = GST_BUFFER_CAPS(buffer);
+
+        if (mCaps == NULL)
+        {
+            start_capture(buffer_caps);
+            if (!mCapturing)
+                goto EXIT;
+        }
+        else if (buffer_caps && !gst_caps_is_equal(buffer_caps, mCaps))
+        {
+            GST_PLAYER_DEBUG("PCM of %s isn't cached, its format changes\n",
+                    mKey);
+            reset();
+            goto EXIT;
+        }
+
+        if (mData->len + GST_BUFFER_SIZE(buffer) > mMaxBytes)
+        {
+            GST_PLAYER_DEBUG("PCM of %s isn't cached, it's longer than %u "
+                    "bytes\n", mKey, mMaxBytes);
+            reset();
+            goto EXIT;
+        }
+        g_byte_array_append(mData, GST_BUFFER_DATA(buffer),
+                GST_BUFFER_SIZE(buffer));
+    }
+
+EXIT:
+    UNLOCK(&mMutex);
+
+    if (pcm_data)
+    {
+        GstBuffer* pcm = gst_buffer_new();
+
+        GST_BUFFER_SIZE(pcm) = pcm_data->len;
+        GST_BUFFER_DATA(pcm) = GST_BUFFER_MALLOCDATA(pcm) =
+            (guint8*)g_byte_array_free(pcm_data, FALSE);
+        gst_buffer_set_caps(pcm, caps);
+        gst_caps_unref(caps);
+        cache_store(key, pcm);
+        g_free(key);
+    }
+}
+
+void GstPlayerPcmCache::setLimits(int maxDuration, int maxBytes)
+{
+    LOCK(&pcm_cache_mutex);
+    pcm_cache_max_duration = (maxDuration > 0) ? maxDuration : 0;
+    pcm_cache_max_bytes = (maxDuration > 0 && maxBytes > 0) ? maxBytes : 0;
+    cache_evict(pcm_cache_max_bytes);
+    UNLOCK(&pcm_cache_mutex);
+}
+
+// cache_lookup()
+// Return a reference to cached PCM of key, and mark it the most recently
+// played
+//
+GstBuffer* GstPlayerPcmCache::cache_lookup(const gchar* key)
+{
+    GstBuffer* pcm = NULL;
+
+    LOCK(&pcm_cache_mutex);
+    if (pcm_cache)
+    {
+        pcm = (GstBuffer*)g_hash_table_lookup(pcm_cache, key);
+        if (pcm)
+        {
+            GList* link = g_queue_find_custom(&pcm_cache_keys, key,
+                    (GCompareFunc)strcmp);
+            if (link)
+            {
+                g_queue_unlink(&pcm_cache_keys, link);
+                g_queue_push_tail_link(&pcm_cache_keys, link);
+            }
+            gst_buffer_ref(pcm);
+        }
+    }
+    UNLOCK(&pcm_cache_mutex);
+    return pcm;
+}
+
+// cache_store()
+// Take ownership of pcm. Players which still play an evicted clip keep
+// their own reference to it.
+//
+void GstPlayerPcmCache::cache_store(const gchar* key, GstBuffer* pcm)
+{
+    LOCK(&pcm_cache_mutex);
+    if (GST_BUFFER_SIZE(pcm) > pcm_cache_max_bytes)
+    {
+        UNLOCK(&pcm_cache_mutex);
+        gst_buffer_unref(pcm);
+        return;
+    }
+    if (pcm_cache == NULL)
+    {
+        pcm_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                free_pcm);
+    }
+
+    GstBuffer* old = (GstBuffer*)g_hash_table_lookup(pcm_cache, key);
+    if (old)
+    {
+        GList* link = g_queue_find_custom(&pcm_cache_keys, key,
+                (GCompareFunc)strcmp);
+        if (link)
+        {
+            g_free(link->data);
+            g_queue_delete_link(&pcm_cache_keys, link);
+        }
+        pcm_cache_bytes -= GST_BUFFER_SIZE(old);
+    }
+    g_queue_push_tail(&pcm_cache_keys, g_strdup(key));
+    g_hash_table_replace(pcm_cache, g_strdup(key), pcm);
+    pcm_cache_bytes += GST_BUFFER_SIZE(pcm);
+    cache_evict(pcm_cache_max_bytes);
+
+    GST_PLAYER_DEBUG("Cache PCM of %s, %d bytes, %d clips in %llu bytes\n",
+            key, GST_BUFFER_SIZE(pcm), g_queue_get_length(&pcm_cache_keys),
+            (unsigned long long)pcm_cache_bytes);
+    UNLOCK(&pcm_cache_mutex);
+}
+
+// cache_evict()
+// Evict the least recently played clips until the cache takes at most
+// maxBytes, pcm_cache_mutex shall be held
+//
+void GstPlayerPcmCache::cache_evict(guint64 maxBytes)
+{
+    while (pcm_cache_bytes > maxBytes &&
+            !g_queue_is_empty(&pcm_cache_keys))
+    {
+        gchar* oldest = (gchar*)g_queue_pop_head(&pcm_cache_keys);
+        GstBuffer* pcm = (GstBuffer*)g_hash_table_lookup(pcm_cache, oldest);
+
+        if (pcm)
+        {
+            GST_PLAYER_DEBUG("Evict PCM of %s, %d bytes\n", oldest,
+                    GST_BUFFER_SIZE(pcm));
+            pcm_cache_bytes -= GST_BUFFER_SIZE(pcm);
+            g_hash_table_remove(pcm_cache, oldest);
+        }
+        g_free(oldest);
+    }
+}
@@ -0,0 +1,83 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _GST_PLAYER_PCM_CACHE_H_
+#define _GST_PLAYER_PCM_CACHE_H_
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <gst/gst.h>
+
+// GstPlayerPcmCache
+// Keep decoded PCM of short clips, like notification and UI sounds, per file
+// identity. The first playback of a file captures what reaches the audio
+// sink, from its beginning to EOS. Later playbacks feed the cached PCM to the
+// sink, without demuxing and decoding it again. The cache is shared by all
+// players, bounded in bytes, and the least recently played clip is evicted
+// first.
+//
+class GstPlayerPcmCache
+{
+public:
+    GstPlayerPcmCache();
+    ~GstPlayerPcmCache();
+
+    // set the file being played, and start capturing its PCM if it isn't
+    // cached yet
+    bool setFile(int fd);
+    bool setFile(const char *path);
+    void clearFile();
+
+    // cached PCM of current file, with its caps set, NULL if it isn't
+    // cached. The returned buffer shall be released with gst_buffer_unref().
+    GstBuffer* lookup();
+
+    // called with buffers and events reaching the audio sink, in streaming
+    // thread. Captured PCM is stored into cache at EOS.
+    void capture(GstMiniObject* data);
+
+    // stop capturing current file, e.g. when another one follows it
+    void abort();
+
+    // rate and bytes of a frame of raw audio caps
+    static bool parseCaps(GstCaps* caps, int* rate, int* frameSize);
+
+    // clips longer than maxDuration ms aren't cached, and cached clips take
+    // at most maxBytes. Either one 0 disables the cache.
+    static void setLimits(int maxDuration, int maxBytes);
+
+private:
+    void set_key(struct stat* stat_buf);
+    void reset();
+    void start_capture(GstCaps* caps);
+    static GstBuffer* cache_lookup(const gchar* key);
+    static void cache_store(const gchar* key, GstBuffer* pcm);
+    static void cache_evict(guint64 maxBytes);
+
+    // identity of current file, NULL if it isn't cached
+    gchar*      mKey;
+    bool        mCapturing;
+    // captured PCM, its caps and the most bytes a short clip takes
+    GByteArray* mData;
+    GstCaps*    mCaps;
+    guint       mMaxBytes;
+    pthread_mutex_t mMutex;
+};
+
+#endif   /*_GST_PLAYER_PCM_CACHE_H_*/
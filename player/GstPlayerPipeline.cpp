@@ -21,7 +21,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include "GstPlayerPipeline.h"
+#include "sink/surfaceflingersink/surfaceflinger_wrap.h"
 
 
 
@@ -38,10 +40,91 @@ using namespace android;
 #define UNLOCK(pMutex)      pthread_mutex_unlock(pMutex)
 #define DELETE_LOCK(pMutex) pthread_mutex_destroy(pMutex)
 
+// playbin2 flag to render video only
+#define PLAY_FLAG_VIDEO     0x00000001
+
+// RGB565 caps of frame grab
+#define FRAME_GRAB_CAPS     \
+    "video/x-raw-rgb, bpp=(int)16, depth=(int)16, " \
+    "endianness=(int)1234, red_mask=(int)63488, " \
+    "green_mask=(int)2016, blue_mask=(int)31"
+
 #ifndef PAGESIZE
 #define PAGESIZE            4096
 #endif
 
+// bytes to read ahead at the key frame found in index when seeking
+#define SEEK_PREFETCH_SIZE  (256 * 1024)
+
+// seek flags of each GstPlayerSeekMode. Snap flags are only available since
+// gstreamer 0.10.29, older demuxers snap to the previous key frame anyway.
+static GstSeekFlags seek_mode_flags(GstPlayerSeekMode mode)
+{
+    switch (mode)
+    {
+    case SEEK_MODE_SNAP_BEFORE:
+#if GST_CHECK_VERSION(0,10,29)
+        return (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT |
+                GST_SEEK_FLAG_SNAP_BEFORE);
+#else
+        return (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT);
+#endif
+    case SEEK_MODE_SNAP_AFTER:
+#if GST_CHECK_VERSION(0,10,29)
+        return (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT |
+                GST_SEEK_FLAG_SNAP_AFTER);
+#else
+        return (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT);
+#endif
+    case SEEK_MODE_ACCURATE:
+        return (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE);
+    case SEEK_MODE_KEY_UNIT:
+    default:
+        return (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT);
+    }
+}
+
+static const char* seek_mode_names[SEEK_MODE_COUNT] = 
+{
+    "key-unit",
+    "snap-before",
+    "snap-after",
+    "accurate",
+};
+
+// upper bounds of seek render latency buckets, in ms
+static const int seek_render_buckets[SEEK_RENDER_BUCKETS] = 
+{
+    50, 100, 200, 400, 800, 1600, 3200, G_MAXINT
+};
+
+#define SEEK_RENDER_UNKNOWN_FORMAT  "unknown"
+
+// interval to check whether the first audio sample after seek is heard
+#define SEEK_RENDER_POLL_MSEC       5
+
+// playback rates of trick play, 1 is normal playback
+static const int trick_play_rates[] = { 1, 2, 4, 8, -2, -4 };
+
+// range of playback speed, audio is time stretched by audioflingertempo
+#define MIN_PLAYBACK_SPEED  0.5
+#define MAX_PLAYBACK_SPEED  3.0
+
+// buffering profile of each AudioSystem stream type: voice call, system,
+// ring, music, alarm, notification. Short sounds start quickly with low
+// latency, music plays with few wakeups.
+static const GstPlayerAudioProfile audio_stream_profiles[] = 
+{
+    AUDIO_PROFILE_LOW_LATENCY,
+    AUDIO_PROFILE_LOW_LATENCY,
+    AUDIO_PROFILE_DEFAULT,
+    AUDIO_PROFILE_DEEP_BUFFER,
+    AUDIO_PROFILE_DEFAULT,
+    AUDIO_PROFILE_LOW_LATENCY,
+};
+
+#define DEFAULT_AUDIO_STREAM_TYPE   3   // AudioSystem::MUSIC
+
 // make sure gst can be initialized only once
 static gboolean gst_inited = FALSE;
 
@@ -135,6 +218,182 @@ EXIT:
     return (res == TRUE) ? 0 : -1;
 }
 
+// ----------------------------------------------------------------------------
+// performance tunables
+// ----------------------------------------------------------------------------
+#define GST_CONFIG_PERFORMANCE_GROUP  "Performance"
+
+// range of surfaceflingersink's buffer-count
+#define MIN_VIDEO_BUFFER_COUNT  2
+#define MAX_VIDEO_BUFFER_COUNT  VIDEO_FLINGER_MAX_FRAME_BUFFERS
+
+// default tunables, the same values as hardcoded in sinks before
+static const GstPlayerTunables default_tunables = 
+{
+    500,        // audioBufferTime
+    50,         // audioLatencyTime
+    2,          // videoBufferCount
+    -1,         // bufferSize
+    -1,         // bufferDuration
+    4096,       // appsrcBlockSize
+    200000,     // appsrcMaxBytes
+    15,         // trickPlayRenderRate
+    3000,       // pcmCacheDuration
+    2097152,    // pcmCacheSize
+    20,         // stretchCpuBudget
+    "",         // indexCacheDir
+};
+
+static GstPlayerTunables gst_tunables;
+static gboolean gst_tunables_loaded = FALSE;
+static pthread_mutex_t gst_tunables_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// get_tunable_int()
+// Read an integer key from [Performance], keep the default value if the key
+// doesn't exist or isn't an integer.
+//
+static void get_tunable_int(GKeyFile* conf_file, const gchar* key, int* value)
+{
+    GError* error = NULL;
+    gint val = g_key_file_get_integer(
+        conf_file,
+        GST_CONFIG_PERFORMANCE_GROUP,
+        key,
+        &error);
+    if (error)
+    {
+        g_error_free(error);
+        return;
+    }
+    *value = val;
+    GST_PLAYER_DEBUG("tunable:  %s=%d\n", key, val);
+}
+
+// get_tunable_string()
+// Read a string key from [Performance], keep the default value if the key
+// doesn't exist.
+//
+static void get_tunable_string(GKeyFile* conf_file, const gchar* key, 
+        char* value, gsize size)
+{
+    GError* error = NULL;
+    gchar* val = g_key_file_get_string(
+        conf_file,
+        GST_CONFIG_PERFORMANCE_GROUP,
+        key,
+        &error);
+    if (error)
+    {
+        g_error_free(error);
+        return;
+    }
+    g_strlcpy(value, g_strstrip(val), size);
+    g_free(val);
+    GST_PLAYER_DEBUG("tunable:  %s=%s\n", key, value);
+}
+
+// get_gst_tunables_from_conf()
+// Read performance tunables from /sdcard/gst.conf.
+//
+static int get_gst_tunables_from_conf(GstPlayerTunables* tunables)
+{
+    gboolean res = FALSE;
+    GKeyFile* conf_file = NULL;
+    GError* error = NULL;
+
+    *tunables = default_tunables;
+
+    conf_file = g_key_file_new ();
+    if(conf_file == NULL)
+        return -1;
+
+    res = g_key_file_load_from_file(
+        conf_file,
+        GST_CONFIG_FILE,
+        G_KEY_FILE_NONE,
+        &error);
+    if(res != TRUE)
+    {
+        if(error)
+        {
+            GST_PLAYER_ERROR ("Load config file error: %d (%s)\n", 
+                error->code, error->message);
+            g_error_free(error);
+        }
+        goto EXIT;
+    }
+
+    if (!g_key_file_has_group(conf_file, GST_CONFIG_PERFORMANCE_GROUP))
+    {
+        GST_PLAYER_DEBUG ("No performance tunables, use default\n");
+        goto EXIT;
+    }
+
+    get_tunable_int(conf_file, "AudioBufferTime", &tunables->audioBufferTime);
+    get_tunable_int(conf_file, "AudioLatencyTime", &tunables->audioLatencyTime);
+    get_tunable_int(conf_file, "VideoBufferCount", &tunables->videoBufferCount);
+    get_tunable_int(conf_file, "BufferSize", &tunables->bufferSize);
+    get_tunable_int(conf_file, "BufferDuration", &tunables->bufferDuration);
+    get_tunable_int(conf_file, "AppSrcBlockSize", &tunables->appsrcBlockSize);
+    get_tunable_int(conf_file, "AppSrcMaxBytes", &tunables->appsrcMaxBytes);
+    get_tunable_int(conf_file, "TrickPlayRenderRate", 
+            &tunables->trickPlayRenderRate);
+    get_tunable_int(conf_file, "PcmCacheDuration", 
+            &tunables->pcmCacheDuration);
+    get_tunable_int(conf_file, "PcmCacheSize", &tunables->pcmCacheSize);
+    get_tunable_int(conf_file, "StretchCpuBudget", 
+            &tunables->stretchCpuBudget);
+    get_tunable_string(conf_file, "IndexCacheDir", tunables->indexCacheDir, 
+            sizeof(tunables->indexCacheDir));
+
+    // latency time shall be smaller than buffer time
+    if (tunables->audioLatencyTime <= 0 || 
+            tunables->audioBufferTime < tunables->audioLatencyTime)
+    {
+        GST_PLAYER_WARNING ("Invalid audio buffer/latency time %d/%d, "
+            "use default\n", tunables->audioBufferTime, 
+            tunables->audioLatencyTime);
+        tunables->audioBufferTime = default_tunables.audioBufferTime;
+        tunables->audioLatencyTime = default_tunables.audioLatencyTime;
+    }
+    if (tunables->videoBufferCount < MIN_VIDEO_BUFFER_COUNT ||
+            tunables->videoBufferCount > MAX_VIDEO_BUFFER_COUNT)
+    {
+        GST_PLAYER_WARNING ("Invalid video buffer count %d, clamp it to "
+            "%d..%d\n", tunables->videoBufferCount, MIN_VIDEO_BUFFER_COUNT,
+            MAX_VIDEO_BUFFER_COUNT);
+        tunables->videoBufferCount = CLAMP (tunables->videoBufferCount, 
+            MIN_VIDEO_BUFFER_COUNT, MAX_VIDEO_BUFFER_COUNT);
+    }
+    if (tunables->appsrcBlockSize <= 0)
+        tunables->appsrcBlockSize = default_tunables.appsrcBlockSize;
+    if (tunables->trickPlayRenderRate < 0)
+        tunables->trickPlayRenderRate = default_tunables.trickPlayRenderRate;
+    if (tunables->stretchCpuBudget < 1 || tunables->stretchCpuBudget > 100)
+        tunables->stretchCpuBudget = default_tunables.stretchCpuBudget;
+
+EXIT:
+    if(conf_file)
+        g_key_file_free(conf_file);
+
+    return (res == TRUE) ? 0 : -1;
+}
+
+// get_gst_tunables()
+// Get a copy of cached tunables, load them at the first time
+//
+static void get_gst_tunables(GstPlayerTunables* tunables)
+{
+    LOCK(&gst_tunables_mutex);
+    if (!gst_tunables_loaded)
+    {
+        get_gst_tunables_from_conf(&gst_tunables);
+        gst_tunables_loaded = TRUE;
+    }
+    *tunables = gst_tunables;
+    UNLOCK(&gst_tunables_mutex);
+}
+
 // android_gst_debug_log()
 // Hook function to redirect gst log from stdout to android log system
 //
@@ -285,6 +544,12 @@ gboolean GstPlayerPipeline::bus_callback (GstBus *bus, GstMessage *msg,
     case GST_MESSAGE_DURATION:
         pGstPlayerPipeline->handleDuration(msg);
         break;
+    case GST_MESSAGE_NEW_CLOCK:
+        pGstPlayerPipeline->handleNewClock(msg);
+        break;
+    case GST_MESSAGE_CLOCK_LOST:
+        pGstPlayerPipeline->handleClockLost(msg);
+        break;
     default:
         break;
     }
@@ -302,12 +567,21 @@ void GstPlayerPipeline::appsrc_need_data(GstAppSrc *src, guint length,
     bool ret = false;
     off_t offset = 0;
 
+    LOCK (&player_pipeline->mSourceMutex);
+    if (player_pipeline->mPcmClip)
+    {
+        player_pipeline->push_cached_pcm(src, length);
+        UNLOCK (&player_pipeline->mSourceMutex);
+        return;
+    }
+
     // GST_PLAYER_DEBUG ("player_pipeline=%p, Request length=%d, offset=%lu,
     // fd=%d", player_pipeline, length, (long unsigned
     // int)(player_pipeline->mOffset), player_pipeline->mFd);
 
     // check current offset is inside range
-    if (player_pipeline->mOffset > player_pipeline->mLength)
+    if (player_pipeline->mMapping == NULL ||
+            player_pipeline->mOffset > player_pipeline->mLength)
     {
         GST_PLAYER_WARNING("Offset %lu is outside file %lu. Send EOS\n", 
                 (unsigned long)(player_pipeline->mOffset), 
@@ -327,7 +601,13 @@ void GstPlayerPipeline::appsrc_need_data(GstAppSrc *src, guint length,
         goto EXIT;
     }
 
-    GST_BUFFER_DATA (buffer) = player_pipeline->mMemBase + player_pipeline->mOffset;
+    // the buffer keeps the file mapped, decoders may hold it after the
+    // player has switched to the next file
+    g_atomic_int_inc (&player_pipeline->mMapping->refcount);
+    GST_BUFFER_MALLOCDATA (buffer) = (guint8*)player_pipeline->mMapping;
+    GST_BUFFER_FREE_FUNC (buffer) = unref_mapping;
+    GST_BUFFER_DATA (buffer) = player_pipeline->mMapping->base + 
+        player_pipeline->mOffset;
     GST_BUFFER_SIZE (buffer) = length;
     GST_BUFFER_OFFSET (buffer) = player_pipeline->mOffset;
     GST_BUFFER_OFFSET_END (buffer) =player_pipeline->mOffset + length;
@@ -346,15 +626,20 @@ void GstPlayerPipeline::appsrc_need_data(GstAppSrc *src, guint length,
         *(GST_BUFFER_DATA (buffer) + 7));
     */
 
-    // send buffer to appsrc
-    flow_ret = gst_app_src_push_buffer(player_pipeline->mAppSource, buffer);
-    if(GST_FLOW_IS_FATAL(flow_ret)) 
-        GST_PLAYER_DEBUG("Push error %d\n", flow_ret);
-
     player_pipeline->mOffset += length;
     ret = true;
 
 EXIT:
+    UNLOCK (&player_pipeline->mSourceMutex);
+
+    // send buffer to appsrc
+    if (buffer)
+    {
+        flow_ret = gst_app_src_push_buffer(src, buffer);
+        if(GST_FLOW_IS_FATAL(flow_ret)) 
+            GST_PLAYER_DEBUG("Push error %d\n", flow_ret);
+    }
+
     // gst_app_src_push_buffer() will steal the GstBuffer's reference, we need
     // not release it here.  
     // if (buffer) gst_buffer_unref (buffer);
@@ -376,7 +661,17 @@ gboolean GstPlayerPipeline::appsrc_seek_data(GstAppSrc *src,
         (GstPlayerPipeline*)user_data;
 
     // GST_PLAYER_DEBUG ("Enter, offset=%lu\n", (long unsigned int)offset);
+    LOCK (&player_pipeline->mSourceMutex);
+    if (player_pipeline->mPcmClip)
+    {
+        // cached PCM is fed in time format
+        offset = gst_util_uint64_scale_int(offset, player_pipeline->mPcmRate,
+                GST_SECOND) * player_pipeline->mPcmFrameSize;
+        if (offset > player_pipeline->mLength)
+            offset = player_pipeline->mLength;
+    }
     player_pipeline->mOffset = offset;
+    UNLOCK (&player_pipeline->mSourceMutex);
     return TRUE;
 }
 
@@ -388,8 +683,40 @@ void GstPlayerPipeline::playbin2_found_source(GObject * object, GObject * orig,
 {
     GstPlayerPipeline* player_pipeline = 
         (GstPlayerPipeline*)user_data;
+    GstElement* source = NULL;
 
+    // the source may be a filesrc if a url is played, ignore it
+    g_object_get (orig, pspec->name, &source, NULL);
+    if (source == NULL)
+        return;
+    if (!G_TYPE_CHECK_INSTANCE_TYPE (source, GST_TYPE_APP_SRC))
+    {
+        GST_PLAYER_DEBUG ("source %s is not appsrc\n", GST_ELEMENT_NAME(source));
+        gst_object_unref (source);
+        return;
+    }
 
+    // playbin2 creates a new appsrc for the next fd, switch the mapped file
+    // to it. The previous appsrc has finished reading at this point, but
+    // its buffers may still be queued or decoded, they keep the previous
+    // file mapped until they're freed.
+    LOCK (&player_pipeline->mSourceMutex);
+    if (player_pipeline->mSwitchAppSource)
+    {
+        GST_PLAYER_DEBUG ("Switch to next fd: %d\n", player_pipeline->mNextFd);
+        player_pipeline->release_cached_pcm();
+        if (player_pipeline->mMapping)
+            unref_mapping(player_pipeline->mMapping);
+        player_pipeline->mFd = player_pipeline->mNextFd;
+        player_pipeline->mMapping = player_pipeline->mNextMapping;
+        player_pipeline->mLength = player_pipeline->mMapping ? 
+            player_pipeline->mMapping->length : 0;
+        player_pipeline->mOffset = 0;
+        player_pipeline->mNextFd = 0;
+        player_pipeline->mNextMapping = NULL;
+        player_pipeline->mSwitchAppSource = false;
+    }
+    UNLOCK (&player_pipeline->mSourceMutex);
 
     // get a handle to the appsrc
     if (player_pipeline->mAppSource)
@@ -397,17 +724,46 @@ void GstPlayerPipeline::playbin2_found_source(GObject * object, GObject * orig,
         g_object_unref(player_pipeline->mAppSource);
         player_pipeline->mAppSource = NULL;
     }
-    g_object_get (orig, pspec->name, &(player_pipeline->mAppSource), NULL);
+    player_pipeline->mAppSource = GST_APP_SRC (source);
     GST_PLAYER_DEBUG ("appsrc: %p", player_pipeline->mAppSource);
 
-    // we can set the length in appsrc. This allows some elements to estimate
-    // the total duration of the stream. It's a good idea to set the property
-    // when you can but it's not required.  
-    gst_app_src_set_size(player_pipeline->mAppSource, player_pipeline->mLength);
+    if (player_pipeline->mPcmClip)
+    {
+        GstBuffer* pcm = player_pipeline->mPcmClip;
+
+        // uridecodebin links a source of raw caps to playsink directly,
+        // without typefinding, demuxing or decoding it. Time format makes
+        // it seekable, and gives the duration.
+        gst_app_src_set_caps(player_pipeline->mAppSource, 
+                GST_BUFFER_CAPS(pcm));
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(source), 
+                "format"))
+            g_object_set (source, "format", GST_FORMAT_TIME, NULL);
+        gst_app_src_set_size(player_pipeline->mAppSource, 
+                gst_util_uint64_scale_int(GST_BUFFER_SIZE(pcm) / 
+                    player_pipeline->mPcmFrameSize, GST_SECOND, 
+                    player_pipeline->mPcmRate));
+        gst_app_src_set_stream_type(player_pipeline->mAppSource, 
+                GST_APP_STREAM_TYPE_SEEKABLE);
+    }
+    else
+    {
+        // we can set the length in appsrc. This allows some elements to 
+        // estimate the total duration of the stream. It's a good idea to 
+        // set the property when you can but it's not required.  
+        gst_app_src_set_size(player_pipeline->mAppSource, 
+                player_pipeline->mLength);
+
+        // configure the appsrc to work in pull (random access) mode 
+        gst_app_src_set_stream_type(player_pipeline->mAppSource, 
+                GST_APP_STREAM_TYPE_RANDOM_ACCESS);
+    }
 
-    // configure the appsrc to work in pull (random access) mode 
-    gst_app_src_set_stream_type(player_pipeline->mAppSource, 
-            GST_APP_STREAM_TYPE_RANDOM_ACCESS);
+    // apply feed tunables
+    gst_app_src_set_max_bytes(player_pipeline->mAppSource, 
+            (guint64)player_pipeline->mTunables.appsrcMaxBytes);
+    g_object_set (player_pipeline->mAppSource, "blocksize", 
+            (gulong)player_pipeline->mTunables.appsrcBlockSize, NULL);
     
 
     // set appsrc callback 
@@ -419,6 +775,47 @@ void GstPlayerPipeline::playbin2_found_source(GObject * object, GObject * orig,
             player_pipeline, NULL);
 }
 
+// this callback is called by playbin2 in streaming thread when the current
+// uri has been read completely. Setting a new uri here makes playbin2 play it
+// right after the current one, and the audio sink keeps running.
+void GstPlayerPipeline::playbin2_about_to_finish(GstElement* playbin, 
+        gpointer user_data)
+{
+    GstPlayerPipeline* player_pipeline = 
+        (GstPlayerPipeline*)user_data;
+
+    // mActionMutex may be held by a thread waiting for state change, which
+    // needs streaming thread, so use a dedicated lock here
+    LOCK (&player_pipeline->mSourceMutex);
+    if (player_pipeline->mNextUri)
+    {
+        GST_PLAYER_DEBUG ("About to finish, play next uri: %s\n", 
+                player_pipeline->mNextUri);
+        // keep index of current file, then collect the next one. PCM of
+        // gapless sources isn't cached, they share one EOS.
+        player_pipeline->mKeyIndex.commit();
+        player_pipeline->mPcmCache.abort();
+        player_pipeline->set_seek_render_format(NULL);
+        if (g_str_has_prefix(player_pipeline->mNextUri, "appsrc://"))
+        {
+            player_pipeline->mSwitchAppSource = true;
+            player_pipeline->mKeyIndex.setFile(player_pipeline->mNextFd);
+        }
+        else
+        {
+            player_pipeline->mKeyIndex.setFile(player_pipeline->mNextUri);
+        }
+        g_object_set (playbin, "uri", player_pipeline->mNextUri, NULL);
+        g_free (player_pipeline->mNextUri);
+        player_pipeline->mNextUri = NULL;
+    }
+    else
+    {
+        GST_PLAYER_DEBUG ("About to finish, no next uri\n");
+    }
+    UNLOCK (&player_pipeline->mSourceMutex);
+}
+
 void GstPlayerPipeline::taglist_foreach(const GstTagList *list, 
             const gchar *tag, gpointer user_data)
 {
@@ -455,10 +852,12 @@ void GstPlayerPipeline::taglist_foreach(const GstTagList *list,
     }
 }
 
-GstPlayerPipeline::GstPlayerPipeline(GstPlayer* gstPlayer)
+GstPlayerPipeline::GstPlayerPipeline(GstPlayer* gstPlayer, bool frameGrab)
 {
     GST_PLAYER_DEBUG ("Enter\n");
     INIT_LOCK(&mActionMutex);
+    INIT_LOCK(&mSourceMutex);
+    INIT_LOCK(&mSeekRenderMutex);
 
     // initilize members
     LOCK(&mActionMutex);
@@ -467,14 +866,26 @@ GstPlayerPipeline::GstPlayerPipeline(GstPlayer* gstPlayer)
     // GstElement
     mPlayBin = NULL;
     mAudioSink = NULL;
+    mAudioTempo = NULL;
     mVideoSink = NULL;
     mAppSource = NULL;
+    mFrameGrabSink = NULL;
 
     // app source
     mFd = 0;
     mLength = 0;
     mOffset = 0;
-    mMemBase = NULL;
+    mMapping = NULL;
+    mSourceNotifyConnected = false;
+    mPcmClip = NULL;
+    mPcmRate = 0;
+    mPcmFrameSize = 0;
+
+    // next source
+    mNextUri = NULL;
+    mNextFd = 0;
+    mNextMapping = NULL;
+    mSwitchAppSource = false;
     
     // mainloop
     mMainLoop = NULL;
@@ -486,13 +897,47 @@ GstPlayerPipeline::GstPlayerPipeline(GstPlayer* gstPlayer)
     // seek
     mSeeking = false;
     mSeekState = GST_STATE_VOID_PENDING;
+    mPendingSeekMsec = -1;
+    mPendingSeekMode = SEEK_MODE_KEY_UNIT;
+    mPendingSeekTime = GST_CLOCK_TIME_NONE;
+    mSupersededSeeks = 0;
+    mSeekMode = SEEK_MODE_KEY_UNIT;
+    mCurrentSeekMode = SEEK_MODE_KEY_UNIT;
+    mSeekStartTime = GST_CLOCK_TIME_NONE;
+    memset(mSeekStats, 0, sizeof(mSeekStats));
+    mSeekRenderStart = GST_CLOCK_TIME_NONE;
+    mAwaitAudioFlush = false;
+    mAwaitVideoFlush = false;
+    mAwaitAudio = false;
+    mAwaitVideo = false;
+    gst_segment_init (&mAudioSegment, GST_FORMAT_TIME);
+    mAudioRenderTarget = GST_CLOCK_TIME_NONE;
+    mAudioRenderPoll = 0;
+    mSeekRenderFormat = g_strdup(SEEK_RENDER_UNKNOWN_FORMAT);
+    mSeekRenderStats = g_hash_table_new_full(g_str_hash, g_str_equal, 
+            g_free, g_free);
+
+    // trick play
+    mRate = 1;
+    mSpeed = 1.0;
+
+    // audio profile, applied when audio sink is created
+    mAudioStreamType = DEFAULT_AUDIO_STREAM_TYPE;
+    mAudioProfile = audio_stream_profiles[DEFAULT_AUDIO_STREAM_TYPE];
 
     // others
     mIsLooping = false;
+    mFrameGrabMode = frameGrab;
     
     // initialize gst framework
     init_gst();
 
+    // tunables are applied to elements in create_pipeline()
+    get_gst_tunables(&mTunables);
+    GstPlayerIndex::setSidecarDir(mTunables.indexCacheDir);
+    GstPlayerPcmCache::setLimits(mTunables.pcmCacheDuration, 
+            mTunables.pcmCacheSize);
+
     // create pipeline 
     create_pipeline();
 
@@ -513,6 +958,10 @@ GstPlayerPipeline::~GstPlayerPipeline()
     mGstPlayer = NULL;
     UNLOCK (&mActionMutex);
     DELETE_LOCK(&mActionMutex);
+    DELETE_LOCK(&mSourceMutex);
+    g_free (mSeekRenderFormat);
+    g_hash_table_destroy (mSeekRenderStats);
+    DELETE_LOCK(&mSeekRenderMutex);
     GST_PLAYER_DEBUG ("Leave\n");
 }
 
@@ -531,6 +980,14 @@ bool GstPlayerPipeline::create_pipeline ()
         goto ERROR;
     }
 
+    // get notified when current source is about to finish, for gapless
+    // playback of next source
+    g_signal_connect (mPlayBin, "about-to-finish", 
+            (GCallback)playbin2_about_to_finish, this);
+
+    // collect key frames written by demuxers
+    mKeyIndex.attach(mPlayBin);
+
     // add watch message
     mMainLoop = g_main_loop_new (NULL, FALSE);
     if (mMainLoop == NULL) 
@@ -551,6 +1008,15 @@ bool GstPlayerPipeline::create_pipeline ()
         goto ERROR;
     }
 
+    // thumbnails only need the frame grab sink, audio isn't decoded
+    if (mFrameGrabMode)
+    {
+        if (!create_frame_grab_sink())
+            goto ERROR;
+        GST_PLAYER_DEBUG ("Pipeline is created in frame grab mode\n");
+        return true;
+    }
+
     // FIXME: after using fakesink, there is no unref() warning message, so
     // gstaudioflinger sink shall has some bugs
     //
@@ -563,7 +1029,43 @@ bool GstPlayerPipeline::create_pipeline ()
         GST_PLAYER_ERROR ("Failed to create audioflingersink\n");
         goto ERROR;
     }
-    g_object_set (mPlayBin, "audio-sink", mAudioSink, NULL);
+    g_object_set (mAudioSink, 
+            "buffer-time", (gint64)mTunables.audioBufferTime * 1000,
+            "latency-time", (gint64)mTunables.audioLatencyTime * 1000,
+            "stream-type", mAudioStreamType,
+            "profile", mAudioProfile,
+            NULL);
+
+    // play at other speeds by time stretching in front of the sink. It
+    // passes data through at normal rate, in trick play, and in formats
+    // other than signed 16 bit, so the sink still gets all its formats.
+    mAudioTempo = gst_element_factory_make("audioflingertempo", NULL);
+    if (mAudioTempo)
+    {
+        GstElement* bin = gst_bin_new ("audiosinkbin");
+        GstPad* pad;
+
+        g_object_set (mAudioTempo, 
+                "min-rate", MIN_PLAYBACK_SPEED,
+                "max-rate", MAX_PLAYBACK_SPEED,
+                "cpu-budget", (guint)mTunables.stretchCpuBudget,
+                NULL);
+        // the bin owns them, keep our references
+        gst_object_ref (mAudioTempo);
+        gst_object_ref (mAudioSink);
+        gst_bin_add_many (GST_BIN (bin), mAudioTempo, mAudioSink, NULL);
+        gst_element_link (mAudioTempo, mAudioSink);
+        pad = gst_element_get_static_pad (mAudioTempo, "sink");
+        gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+        gst_object_unref (pad);
+        g_object_set (mPlayBin, "audio-sink", bin, NULL);
+    }
+    else
+    {
+        GST_PLAYER_WARNING ("No audioflingertempo, speed can't be set\n");
+        g_object_set (mPlayBin, "audio-sink", mAudioSink, NULL);
+    }
+    add_sink_probe (mAudioSink, (GCallback)audio_sink_data_probe);
 
     mVideoSink = gst_element_factory_make("surfaceflingersink", NULL);
     if (mVideoSink == NULL)
@@ -571,7 +1073,21 @@ bool GstPlayerPipeline::create_pipeline ()
         GST_PLAYER_ERROR ("Failed to create surfaceflingersink\n");
         goto ERROR;
     }
+    g_object_set (mVideoSink, "buffer-count", mTunables.videoBufferCount, NULL);
     g_object_set (mPlayBin, "video-sink", mVideoSink, NULL);
+    add_sink_probe (mVideoSink, (GCallback)video_sink_data_probe);
+    g_object_set (mVideoSink, "signal-posts", TRUE, NULL);
+    g_signal_connect (mVideoSink, "frame-posted", 
+            (GCallback)video_frame_posted, this);
+
+    // buffering properties are not available in all playbin2 versions
+    if (mTunables.bufferSize >= 0 && g_object_class_find_property(
+            G_OBJECT_GET_CLASS(mPlayBin), "buffer-size"))
+        g_object_set (mPlayBin, "buffer-size", mTunables.bufferSize, NULL);
+    if (mTunables.bufferDuration >= 0 && g_object_class_find_property(
+            G_OBJECT_GET_CLASS(mPlayBin), "buffer-duration"))
+        g_object_set (mPlayBin, "buffer-duration", 
+            (gint64)mTunables.bufferDuration * GST_MSECOND, NULL);
 
     GST_PLAYER_DEBUG ("Pipeline is created successfully\n");
 
@@ -583,8 +1099,55 @@ ERROR:
     return false;
 }
 
+// create_frame_grab_sink()
+// Video sink of frame grab mode, decoded frames are converted to RGB565 and
+// kept in appsink. appsink doesn't sync to clock, so we get the frame as soon
+// as it's decoded.
+//
+bool GstPlayerPipeline::create_frame_grab_sink()
+{
+    GstElement* appsink = NULL;
+    GstCaps* caps = NULL;
+    GError* error = NULL;
+
+    mVideoSink = gst_parse_bin_from_description (
+            "ffmpegcolorspace ! appsink name=framegrabsink sync=false", 
+            TRUE, &error);
+    if (mVideoSink == NULL)
+    {
+        GST_PLAYER_ERROR ("Failed to create frame grab sink: %s\n", 
+                error ? error->message : "unknown");
+        if (error)
+            g_error_free (error);
+        return false;
+    }
+    appsink = gst_bin_get_by_name (GST_BIN (mVideoSink), "framegrabsink");
+    caps = gst_caps_from_string (FRAME_GRAB_CAPS);
+    gst_app_sink_set_caps (GST_APP_SINK (appsink), caps);
+    gst_caps_unref (caps);
+    mFrameGrabSink = GST_APP_SINK (appsink);
+    g_object_set (mPlayBin, "video-sink", mVideoSink, NULL);
+
+    // don't decode audio at all
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(mPlayBin), "flags"))
+        g_object_set (mPlayBin, "flags", PLAY_FLAG_VIDEO, NULL);
+    else
+        g_object_set (mPlayBin, "audio-sink", 
+            gst_element_factory_make ("fakesink", NULL), NULL);
+    return true;
+}
+
 void  GstPlayerPipeline::delete_pipeline ()
 {
+    // audio render poll runs in main loop and reads mAudioSink, stop it
+    // before main loop quits
+    LOCK (&mSeekRenderMutex);
+    mAwaitAudio = false;
+    if (mAudioRenderPoll)
+        g_source_remove (mAudioRenderPoll);
+    mAudioRenderPoll = 0;
+    UNLOCK (&mSeekRenderMutex);
+
     // release pipeline & main loop
     if (mPlayBin) 
     {
@@ -624,12 +1187,23 @@ void  GstPlayerPipeline::delete_pipeline ()
         gst_object_unref (mAudioSink);
         mAudioSink = NULL;
     }
+    if (mAudioTempo)
+    {
+        gst_object_unref (mAudioTempo);
+        mAudioTempo = NULL;
+    }
     if (mVideoSink)
     {
         GST_PLAYER_DEBUG ("Release video sink\n");
         gst_object_unref (mVideoSink);
         mVideoSink = NULL;
     }
+    if (mFrameGrabSink)
+    {
+        GST_PLAYER_DEBUG ("Release frame grab sink\n");
+        gst_object_unref (mFrameGrabSink);
+        mFrameGrabSink = NULL;
+    }
     if (mAppSource)
     {
         GST_PLAYER_DEBUG ("Release app source\n");
@@ -642,26 +1216,47 @@ void  GstPlayerPipeline::delete_pipeline ()
         gst_object_unref (mPlayBin);
         mPlayBin = NULL;
     }
+    mKeyIndex.commit();
+    mKeyIndex.detach();
+    mKeyIndex.clearFile();
+    mPcmCache.clearFile();
     if (mMainLoop)
     {
         GST_PLAYER_DEBUG ("Delete mainloop\n");
         g_main_loop_unref (mMainLoop);
         mMainLoop = NULL;
     }
-    if (mMemBase)
+
+    // app source
+    LOCK (&mSourceMutex);
+    release_cached_pcm();
+    if (mMapping)
     {
         GST_PLAYER_DEBUG ("Unmap fd\n");
-        munmap((void*)mMemBase, (size_t)mLength);
+        unref_mapping(mMapping);
     }
-
-    // app source
     mFd = 0;
     mLength = 0;
     mOffset = 0;
-    mMemBase = NULL;
+    mMapping = NULL;
+    mSourceNotifyConnected = false;
+    // next source
+    if (mNextMapping)
+        unref_mapping(mNextMapping);
+    g_free (mNextUri);
+    mNextUri = NULL;
+    mNextFd = 0;
+    mNextMapping = NULL;
+    mSwitchAppSource = false;
+    UNLOCK (&mSourceMutex);
     // seek
     mSeeking = false;
     mSeekState = GST_STATE_VOID_PENDING;
+    mPendingSeekMsec = -1;
+    mSupersededSeeks = 0;
+    // trick play
+    mRate = 1;
+    mSpeed = 1.0;
     // prepare
     mAsynchPreparePending = false;
     
@@ -681,124 +1276,372 @@ bool GstPlayerPipeline::setDataSource(const char *url)
     }
     
     // set uri to playbin2 
-    gchar* full_url = NULL;
-    if(url[0] == '/')
-    {
-        // url is an absolute path, add prefix "file://"
-        int len = strlen(url) + 10;
-        full_url = (gchar*)malloc(len);
-        if(full_url == NULL)
-            return false;
-        g_strlcpy(full_url, "file://", len);
-        g_strlcat(full_url, url, len);
-    }
-    else if (g_str_has_prefix(url, "file:///"))
+    gchar* full_url = build_uri(url);
+    if(full_url == NULL)
     {
-        full_url = g_strdup(url);
-        if(full_url == NULL)
-            return false;        
+        UNLOCK (&mActionMutex);
+        return false;
     }
-    else
+    LOCK (&mSourceMutex);
+    release_cached_pcm();
+    UNLOCK (&mSourceMutex);
+    mPcmCache.setFile(full_url);
+    if (play_cached_pcm())
     {
-        GST_PLAYER_ERROR("Invalide url.");
-        return false;
+        g_free (full_url);
+        UNLOCK (&mActionMutex);
+        return true;
     }
     GST_PLAYER_DEBUG("playbin2 uri: %s", full_url);
     g_object_set (mPlayBin, "uri", full_url, NULL);
-    
-    if(full_url)
-        free (full_url);
+    mKeyIndex.setFile(full_url);
+    set_seek_render_format(NULL);
+    g_free (full_url);
 
     UNLOCK (&mActionMutex);
     return true;
 }
 
-bool GstPlayerPipeline::setDataSource(int fd, int64_t offset, int64_t length)
+// build_uri()
+// Convert url to a uri playbin2 accepts. The returned string shall be freed
+// with g_free().
+//
+gchar* GstPlayerPipeline::build_uri(const char *url)
 {
-    // URI: appsrc://...  
-    //
-    // Example:
-    // external/gst-plugins-base/tests/examples/app/appsrc-stream2.c
-    // gst-plugins-base/tests/examples/app/appsrc-ra.c
-    if (mPlayBin == NULL)
+    if(url[0] == '/')
     {
-        GST_PLAYER_ERROR ("Pipeline not initialized\n");
-        return false;
-    }  
-    // TODO: reset player here
+        // url is an absolute path, add prefix "file://"
+        return g_strconcat("file://", url, NULL);
+    }
+    else if (g_str_has_prefix(url, "file:///"))
+    {
+        return g_strdup(url);
+    }
+
+    GST_PLAYER_ERROR("Invalide url.");
+    return NULL;
+}
+
+// map_fd()
+// Map the whole file of fd into memory, which is read by appsrc. The mapping
+// is returned with one reference, NULL if it fails.
+//
+GstPlayerMapping* GstPlayerPipeline::map_fd(int fd)
+{
+    struct stat stat_buf;
+    GstPlayerMapping* mapping;
+    void* addr;
+
     if (fd == 0)
     {
         GST_PLAYER_ERROR ("Invalid fd: %d\n", fd);
-        return false;
+        return NULL;
     }
-    struct stat stat_buf;
     if( fstat(fd, &stat_buf) != 0)
     {
         GST_PLAYER_ERROR ("Cannot get file size\n");
-        return false;
+        return NULL;
     }
-    mFd = fd;
-    mLength = stat_buf.st_size; 
-    mOffset = 0;
-
-    // map the file into memory
-    mMemBase = (guint8*)mmap(0, (size_t)mLength, PROT_READ, MAP_PRIVATE, fd, 0);
-    GST_PLAYER_DEBUG("playbin2 uri: appsrc://, fd: %d, length: %lu, mMemBase: %p", 
-            mFd, (unsigned long int)mLength, mMemBase);
 
-    // use appsrc in playbin2
-    g_object_set (mPlayBin, "uri", "appsrc://", NULL);
+    addr = mmap(0, (size_t)stat_buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        GST_PLAYER_ERROR ("Cannot map fd: %d\n", fd);
+        return NULL;
+    }
+    mapping = g_new (GstPlayerMapping, 1);
+    mapping->refcount = 1;
+    mapping->base = (guint8*)addr;
+    mapping->length = stat_buf.st_size;
+    return mapping;
+}
 
-    // get notification when the source is created so that we get a handle to
-    // it and can configure it
-    g_signal_connect (mPlayBin, "deep-notify::source", (GCallback)
-            playbin2_found_source, this);
+// unref_mapping()
+// Release a reference of a mapping, the last one unmaps the file. It's the
+// free function of buffers pushed from the mapping, and may be called in any
+// thread.
+//
+void GstPlayerPipeline::unref_mapping(gpointer data)
+{
+    GstPlayerMapping* mapping = (GstPlayerMapping*)data;
 
-    return true;
+    if (!g_atomic_int_dec_and_test (&mapping->refcount))
+        return;
+    munmap((void*)mapping->base, (size_t)mapping->length);
+    g_free (mapping);
 }
 
-bool GstPlayerPipeline::setAudioSink(sp<MediaPlayerInterface::AudioSink> audiosink)
+// play_cached_pcm()
+// Play decoded PCM of the file set to mPcmCache from cache, if it's there.
+// It's fed to playbin2 by appsrc, like a mapped file.
+//
+bool GstPlayerPipeline::play_cached_pcm()
 {
-    LOCK (&mActionMutex);    
-    if(audiosink == 0)
-    {
-        GST_PLAYER_ERROR("Error audio sink %p", audiosink.get());
-        return false;
-    }
+    GstBuffer* pcm = mPcmCache.lookup();
 
-    if (!mPlayBin) 
+    if (pcm == NULL)
+        return false;
+    if (!GstPlayerPcmCache::parseCaps(GST_BUFFER_CAPS(pcm), &mPcmRate, 
+            &mPcmFrameSize))
     {
-        GST_PLAYER_ERROR ("Pipeline not initialized\n");
+        gst_buffer_unref (pcm);
         return false;
     }
-
-    if(mAudioOut != 0)
+    LOCK (&mSourceMutex);
+    if (mMapping)
     {
-        mAudioOut.clear();
-        mAudioOut = 0;
+        unref_mapping(mMapping);
+        mMapping = NULL;
     }
-    mAudioOut = audiosink;
+    mPcmClip = pcm;
+    mLength = GST_BUFFER_SIZE(pcm);
+    mOffset = 0;
+    UNLOCK (&mSourceMutex);
+    mKeyIndex.clearFile();
+    set_seek_render_format(NULL);
+    GST_PLAYER_DEBUG("playbin2 uri: appsrc://, cached PCM: %lu bytes", 
+            (unsigned long int)mLength);
 
-    // set AudioSink
-    GST_PLAYER_DEBUG("MediaPlayerInterface::AudioSink: %p\n", mAudioOut.get());
-    g_object_set (mAudioSink, "audiosink", mAudioOut.get(), NULL);
+    g_object_set (mPlayBin, "uri", "appsrc://", NULL);
+    connect_source_notify();
+    return true;
+}
 
-    UNLOCK (&mActionMutex);
-    return true; 
+// release_cached_pcm()
+// Stop feeding cached PCM, mSourceMutex shall be held.
+//
+void GstPlayerPipeline::release_cached_pcm()
+{
+    if (mPcmClip == NULL)
+        return;
+    gst_buffer_unref (mPcmClip);
+    mPcmClip = NULL;
+    mLength = 0;
+    mOffset = 0;
 }
 
-bool GstPlayerPipeline::setVideoSurface(const sp<ISurface>& surface)
+// push_cached_pcm()
+// Push length bytes of cached PCM at mOffset to appsrc, in whole frames, or
+// EOS at the end of it. Buffers are sub-buffers of the cached one, nothing is
+// copied. mSourceMutex shall be held.
+//
+void GstPlayerPipeline::push_cached_pcm(GstAppSrc *src, guint length)
 {
-    LOCK (&mActionMutex);
-    if(surface == 0)
+    guint64 frame, frames;
+    GstBuffer* buffer;
+    GstFlowReturn flow_ret;
+
+    if (mOffset >= mLength)
     {
-        GST_PLAYER_ERROR("Error ISurface %p", surface.get());
-        return false;
+        gst_app_src_end_of_stream (src);
+        return;
     }
 
-    if (!mPlayBin) 
+    length -= length % mPcmFrameSize;
+    if (length == 0)
+        length = mPcmFrameSize;
+    if (mOffset + length > mLength)
+        length = mLength - mOffset;
+
+    buffer = gst_buffer_create_sub (mPcmClip, (guint)mOffset, length);
+    if (buffer == NULL)
     {
-        GST_PLAYER_ERROR ("Pipeline not initialized\n");
+        GST_PLAYER_ERROR("Cannot create buffer! Send EOS\n");
+        gst_app_src_end_of_stream (src);
+        return;
+    }
+    gst_buffer_set_caps (buffer, GST_BUFFER_CAPS(mPcmClip));
+
+    frame = mOffset / mPcmFrameSize;
+    frames = length / mPcmFrameSize;
+    GST_BUFFER_TIMESTAMP (buffer) = 
+        gst_util_uint64_scale_int (frame, GST_SECOND, mPcmRate);
+    GST_BUFFER_DURATION (buffer) = 
+        gst_util_uint64_scale_int (frame + frames, GST_SECOND, mPcmRate) - 
+        GST_BUFFER_TIMESTAMP (buffer);
+    GST_BUFFER_OFFSET (buffer) = frame;
+    GST_BUFFER_OFFSET_END (buffer) = frame + frames;
+
+    flow_ret = gst_app_src_push_buffer(src, buffer);
+    if(GST_FLOW_IS_FATAL(flow_ret)) 
+        GST_PLAYER_DEBUG("Push error %d\n", flow_ret);
+
+    mOffset += length;
+}
+
+// connect_source_notify()
+// Get notification when the source is created so that we get a handle to it
+// and can configure it. 
+//
+void GstPlayerPipeline::connect_source_notify()
+{
+    if (mSourceNotifyConnected)
+        return;
+    g_signal_connect (mPlayBin, "deep-notify::source", (GCallback)
+            playbin2_found_source, this);
+    mSourceNotifyConnected = true;
+}
+
+bool GstPlayerPipeline::setDataSource(int fd, int64_t offset, int64_t length)
+{
+    // URI: appsrc://...  
+    //
+    // Example:
+    // external/gst-plugins-base/tests/examples/app/appsrc-stream2.c
+    // gst-plugins-base/tests/examples/app/appsrc-ra.c
+    if (mPlayBin == NULL)
+    {
+        GST_PLAYER_ERROR ("Pipeline not initialized\n");
+        return false;
+    }  
+    // TODO: reset player here
+    LOCK (&mSourceMutex);
+    release_cached_pcm();
+    UNLOCK (&mSourceMutex);
+    mPcmCache.setFile(fd);
+    if (play_cached_pcm())
+    {
+        mFd = fd;
+        return true;
+    }
+
+    // map the file into memory
+    GstPlayerMapping* mapping = map_fd(fd);
+    if (mapping == NULL)
+        return false;
+    LOCK (&mSourceMutex);
+    if (mMapping)
+        unref_mapping(mMapping);
+    mMapping = mapping;
+    mFd = fd;
+    mLength = mapping->length;
+    mOffset = 0;
+    UNLOCK (&mSourceMutex);
+    mKeyIndex.setFile(fd);
+    set_seek_render_format(NULL);
+    GST_PLAYER_DEBUG("playbin2 uri: appsrc://, fd: %d, length: %lu, base: %p", 
+            mFd, (unsigned long int)mLength, mapping->base);
+
+    // use appsrc in playbin2
+    g_object_set (mPlayBin, "uri", "appsrc://", NULL);
+
+    connect_source_notify();
+
+    return true;
+}
+
+bool GstPlayerPipeline::setNextDataSource(const char *url)
+{
+    GST_PLAYER_DEBUG("Enter, url=%s",url);
+
+    LOCK (&mActionMutex);
+    if (mPlayBin == NULL)
+    {
+        GST_PLAYER_ERROR ("Pipeline not initialized\n");
+        UNLOCK (&mActionMutex);
+        return false;
+    }
+
+    gchar* full_url = build_uri(url);
+    if(full_url == NULL)
+    {
+        UNLOCK (&mActionMutex);
+        return false;
+    }
+
+    LOCK (&mSourceMutex);
+    if (mNextMapping)
+        unref_mapping(mNextMapping);
+    mNextFd = 0;
+    mNextMapping = NULL;
+    g_free (mNextUri);
+    mNextUri = full_url;
+    UNLOCK (&mSourceMutex);
+
+    UNLOCK (&mActionMutex);
+    return true;
+}
+
+bool GstPlayerPipeline::setNextDataSource(int fd, int64_t offset, 
+        int64_t length)
+{
+    GstPlayerMapping* next_mapping;
+
+    GST_PLAYER_DEBUG("Enter, fd=%d", fd);
+
+    LOCK (&mActionMutex);
+    if (mPlayBin == NULL)
+    {
+        GST_PLAYER_ERROR ("Pipeline not initialized\n");
+        UNLOCK (&mActionMutex);
+        return false;
+    }
+
+    // map next file now, so that nothing blocks at track boundary
+    next_mapping = map_fd(fd);
+    if (next_mapping == NULL)
+    {
+        UNLOCK (&mActionMutex);
+        return false;
+    }
+
+    LOCK (&mSourceMutex);
+    if (mNextMapping)
+        unref_mapping(mNextMapping);
+    mNextFd = fd;
+    mNextMapping = next_mapping;
+    g_free (mNextUri);
+    mNextUri = g_strdup("appsrc://");
+    UNLOCK (&mSourceMutex);
+
+    connect_source_notify();
+
+    UNLOCK (&mActionMutex);
+    return true;
+}
+
+bool GstPlayerPipeline::setAudioSink(sp<MediaPlayerInterface::AudioSink> audiosink)
+{
+    LOCK (&mActionMutex);    
+    if(audiosink == 0)
+    {
+        GST_PLAYER_ERROR("Error audio sink %p", audiosink.get());
+        return false;
+    }
+
+    if (!mPlayBin) 
+    {
+        GST_PLAYER_ERROR ("Pipeline not initialized\n");
+        return false;
+    }
+
+    if(mAudioOut != 0)
+    {
+        mAudioOut.clear();
+        mAudioOut = 0;
+    }
+    mAudioOut = audiosink;
+
+    // set AudioSink
+    GST_PLAYER_DEBUG("MediaPlayerInterface::AudioSink: %p\n", mAudioOut.get());
+    g_object_set (mAudioSink, "audiosink", mAudioOut.get(), NULL);
+
+    UNLOCK (&mActionMutex);
+    return true; 
+}
+
+bool GstPlayerPipeline::setVideoSurface(const sp<ISurface>& surface)
+{
+    LOCK (&mActionMutex);
+    if(surface == 0)
+    {
+        GST_PLAYER_ERROR("Error ISurface %p", surface.get());
+        return false;
+    }
+
+    if (!mPlayBin) 
+    {
+        GST_PLAYER_ERROR ("Pipeline not initialized\n");
         return false;
     }  
     // set ISurface
@@ -810,6 +1653,82 @@ bool GstPlayerPipeline::setVideoSurface(const sp<ISurface>& surface)
     return false;
 }
 
+bool GstPlayerPipeline::captureFrame(int msec, guint8** data, int* size, 
+        int* width, int* height)
+{
+    bool ret = false;
+    GstStateChangeReturn state_return;
+    GstState state;
+    GstBuffer* buffer = NULL;
+    GstStructure* struc = NULL;
+    gint64 seek_pos = (gint64)msec * GST_MSECOND;
+
+    LOCK (&mActionMutex);
+    if (!mPlayBin || !mFrameGrabSink) 
+    {
+        GST_PLAYER_ERROR ("Pipeline not in frame grab mode\n");
+        goto EXIT;
+    }
+    GST_PLAYER_DEBUG ("Enter, capture frame at: %d\n", msec);
+
+    // preroll the pipeline
+    state_return = gst_element_set_state (mPlayBin, GST_STATE_PAUSED);
+    if (state_return == GST_STATE_CHANGE_FAILURE) 
+    {
+        GST_PLAYER_ERROR ("Fail to set pipeline to PAUSED\n");
+        goto EXIT;
+    }
+    state_return = gst_element_get_state (mPlayBin, &state, NULL, 
+            GST_CLOCK_TIME_NONE);
+    if (state_return == GST_STATE_CHANGE_FAILURE) 
+    {
+        GST_PLAYER_ERROR ("Fail to preroll pipeline\n");
+        goto EXIT;
+    }
+
+    // seek to the nearest key frame, then only one frame has to be decoded
+    // before prerolling again
+    if (gst_element_seek_simple(mPlayBin, GST_FORMAT_TIME, 
+        (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT), 
+        seek_pos) != TRUE)
+    {
+        GST_PLAYER_WARNING ("Fail to seek to %d, use the first frame\n", msec);
+    }
+    state_return = gst_element_get_state (mPlayBin, &state, NULL, 
+            GST_CLOCK_TIME_NONE);
+    if (state_return == GST_STATE_CHANGE_FAILURE) 
+    {
+        GST_PLAYER_ERROR ("Fail to preroll pipeline after seek\n");
+        goto EXIT;
+    }
+
+    buffer = gst_app_sink_pull_preroll (mFrameGrabSink);
+    if (buffer == NULL || GST_BUFFER_CAPS (buffer) == NULL)
+    {
+        GST_PLAYER_ERROR ("No frame is decoded\n");
+        goto EXIT;
+    }
+
+    struc = gst_caps_get_structure (GST_BUFFER_CAPS (buffer), 0);
+    if (!gst_structure_get_int (struc, "width", width) ||
+            !gst_structure_get_int (struc, "height", height))
+    {
+        GST_PLAYER_ERROR ("Cannot get frame size\n");
+        goto EXIT;
+    }
+    *size = GST_BUFFER_SIZE (buffer);
+    *data = (guint8*)g_memdup (GST_BUFFER_DATA (buffer), *size);
+    GST_PLAYER_DEBUG ("Captured frame: %dx%d, size: %d\n", 
+            *width, *height, *size);
+    ret = true;
+
+EXIT:
+    if (buffer)
+        gst_buffer_unref (buffer);
+    UNLOCK (&mActionMutex);
+    return ret;
+}
+
 bool GstPlayerPipeline::prepare()
 {
     bool ret = false;
@@ -982,11 +1901,20 @@ bool GstPlayerPipeline::stop()
     if(mSeeking)
     {
          GST_PLAYER_DEBUG("Stop playback while seeking. Send MEDIA_SEEK_COMPLETE immediately");
-         if(mGstPlayer)
-             mGstPlayer->sendEvent(MEDIA_SEEK_COMPLETE);
+         send_seek_complete(1 + ((mPendingSeekMsec >= 0) ? 1 : 0) + 
+                 mSupersededSeeks);
     }
     mSeeking = false;
     mSeekState = GST_STATE_VOID_PENDING;
+    mPendingSeekMsec = -1;
+    mSupersededSeeks = 0;
+
+    LOCK (&mSeekRenderMutex);
+    mAwaitAudio = mAwaitVideo = false;
+    UNLOCK (&mSeekRenderMutex);
+
+    // trick play, pipeline restarts at normal rate
+    reset_rate();
     
     // prepare
     if(mAsynchPreparePending)
@@ -1129,10 +2057,23 @@ EXIT:
 
 bool  GstPlayerPipeline::seekTo(int msec)
 {
-    GstState state, pending;
+    GstPlayerSeekMode mode;
+
+    LOCK (&mActionMutex);
+    mode = mSeekMode;
+    UNLOCK (&mActionMutex);
+    return seekTo(msec, mode);
+}
+
+bool  GstPlayerPipeline::seekTo(int msec, GstPlayerSeekMode mode)
+{
     bool ret = false;
 
-    gint64 seek_pos = (gint64)msec * GST_MSECOND;
+    if (mode < SEEK_MODE_KEY_UNIT || mode >= SEEK_MODE_COUNT)
+    {
+        GST_PLAYER_ERROR ("Invalid seek mode: %d\n", mode);
+        return false;
+    }
        
     LOCK (&mActionMutex);
     if (!mPlayBin) 
@@ -1141,30 +2082,648 @@ bool  GstPlayerPipeline::seekTo(int msec)
         goto EXIT;
     }
 
-    GST_PLAYER_DEBUG("Enter, seek to: %d\n", msec);
+    GST_PLAYER_DEBUG("Enter, seek to: %d, mode: %s\n", msec, 
+            seek_mode_names[mode]);
 
-    // get current stable state
-    gst_element_get_state (mPlayBin, &state, &pending, GST_CLOCK_TIME_NONE);
+    // a seek is in flight, don't flush pipeline again. Keep the latest
+    // request only, it's issued when current seek completes.
+    if (mSeeking)
+    {
+        if (mPendingSeekMsec >= 0)
+        {
+            GST_PLAYER_DEBUG("Seek to %d is superseded\n", mPendingSeekMsec);
+            mSupersededSeeks++;
+        }
+        GST_PLAYER_DEBUG("Seeking, queue seek to %d\n", msec);
+        mPendingSeekMsec = msec;
+        mPendingSeekMode = mode;
+        mPendingSeekTime = gst_util_get_timestamp ();
+        ret = true;
+        goto EXIT;
+    }
+
+    ret = do_seek(msec, mode, gst_util_get_timestamp ());
+
+EXIT:    
+    UNLOCK (&mActionMutex);       
+    return ret;
+}
+
+// do_seek()
+// Issue a flushing seek requested at start, mActionMutex shall be held
+//
+bool GstPlayerPipeline::do_seek(int msec, GstPlayerSeekMode mode, 
+        GstClockTime start)
+{
+    GstState state, pending;
+    gint64 seek_pos = (gint64)msec * GST_MSECOND;
+    GstSeekFlags flags;
+
+    // state to get back to after seek. It's called from the bus callback
+    // too, so don't wait for a state change, take its target instead
+    gst_element_get_state (mPlayBin, &state, &pending, 0);
     GST_PLAYER_DEBUG("state: %d, pending: %d", state, pending); 
+    if (pending != GST_STATE_VOID_PENDING)
+        state = pending;
 
-    if (gst_element_seek_simple(mPlayBin, GST_FORMAT_TIME, 
-        (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT), seek_pos) != TRUE)
+    prefetch_key_frame(seek_pos);
+
+    // sinks are flushed while seeking, start timing before that
+    LOCK (&mSeekRenderMutex);
+    mSeekRenderStart = start;
+    mAwaitAudioFlush = mAwaitVideoFlush = true;
+    mAwaitAudio = mAwaitVideo = true;
+    mAudioRenderTarget = GST_CLOCK_TIME_NONE;
+    UNLOCK (&mSeekRenderMutex);
+
+    flags = seek_mode_flags(mode);
+    if (mRate != 1)
+        flags = (GstSeekFlags)(flags | GST_SEEK_FLAG_SKIP);
+    if (!seek_with_rate(seek_pos, (mRate != 1) ? mRate : mSpeed, flags))
     {
         GST_PLAYER_ERROR ("Fail to seek to position %d\n", msec);
+        LOCK (&mSeekRenderMutex);
+        mAwaitAudio = mAwaitVideo = false;
+        UNLOCK (&mSeekRenderMutex);
+        return false;
+    }
+
+    GST_PLAYER_DEBUG ("Seek to %d\n", msec);
+    mSeeking = true;
+    mSeekState = state;
+    mCurrentSeekMode = mode;
+    mSeekStartTime = start;
+    return true;
+}
+
+// seek_with_rate()
+// Seek to position keeping playback rate. In trick play decoders only
+// decode key frames with GST_SEEK_FLAG_SKIP; backward playback runs from
+// position to start.
+//
+bool GstPlayerPipeline::seek_with_rate(gint64 position, gdouble rate, 
+        GstSeekFlags flags)
+{
+    gboolean res;
+
+    if (rate > 0)
+    {
+        res = gst_element_seek (mPlayBin, rate, GST_FORMAT_TIME, 
+                flags, GST_SEEK_TYPE_SET, position, 
+                GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
     }
     else
     {
-        GST_PLAYER_DEBUG ("Seek to %d\n", msec);
-        mSeeking = true;
-        mSeekState = state;
+        res = gst_element_seek (mPlayBin, rate, GST_FORMAT_TIME, 
+                flags, GST_SEEK_TYPE_SET, 0, 
+                GST_SEEK_TYPE_SET, position);
+    }
+    return (res == TRUE);
+}
+
+bool GstPlayerPipeline::isValidPlaybackRate(int rate)
+{
+    for (guint i = 0; i < G_N_ELEMENTS(trick_play_rates); i++)
+    {
+        if (trick_play_rates[i] == rate)
+            return true;
+    }
+    return false;
+}
+
+bool GstPlayerPipeline::setPlaybackRate(int rate)
+{
+    bool ret = false;
+    GstFormat format = GST_FORMAT_TIME;
+    gint64 position = 0;
+    GstSeekFlags flags;
+
+    if (!isValidPlaybackRate(rate))
+    {
+        GST_PLAYER_ERROR ("Invalid playback rate: %d\n", rate);
+        return false;
+    }
+
+    LOCK (&mActionMutex);
+    if (!mPlayBin) 
+    { 
+        GST_PLAYER_ERROR ("Pipeline not initialized\n");
+        goto EXIT;
+    }
+    if (rate == mRate)
+    {
         ret = true;
+        goto EXIT;
     }
 
-EXIT:    
-    UNLOCK (&mActionMutex);       
+    GST_PLAYER_DEBUG ("setPlaybackRate (%d)\n", rate);
+    if (!gst_element_query_position (mPlayBin, &format, &position) || 
+            position < 0)
+        position = 0;
+
+    // restart from current position at new rate, or at the speed of normal
+    // playback. Key unit seek lets decoders start at once, they skip other
+    // frames anyway.
+    flags = (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT);
+    if (rate != 1)
+        flags = (GstSeekFlags)(flags | GST_SEEK_FLAG_SKIP);
+    // every trick play rate is left to the sink, none is time stretched.
+    // The range applies at the segment of the seek.
+    set_time_stretch(rate == 1);
+    if (!seek_with_rate(position, (rate != 1) ? rate : mSpeed, flags))
+    {
+        GST_PLAYER_ERROR ("Fail to set playback rate %d\n", rate);
+        set_time_stretch(mRate == 1);
+        goto EXIT;
+    }
+    mRate = rate;
+
+    // frames come faster than real time in trick play, render only as many
+    // as the display can take. The frame grab sink isn't rendered.
+    if (mVideoSink && mFrameGrabSink == NULL)
+    {
+        g_object_set (mVideoSink, "max-render-rate", 
+            (rate == 1) ? 0 : mTunables.trickPlayRenderRate, NULL);
+    }
+    ret = true;
+
+EXIT:
+    UNLOCK (&mActionMutex);
     return ret;
 }
 
+bool GstPlayerPipeline::isValidPlaybackSpeed(float speed)
+{
+    return (speed >= MIN_PLAYBACK_SPEED && speed <= MAX_PLAYBACK_SPEED);
+}
+
+// setPlaybackSpeed()
+// Audio is time stretched by audioflingertempo, which plays the segment
+// rate without changing pitch, and passes the segment on with the rate
+// applied: position queries and video sync follow the speed.
+//
+bool GstPlayerPipeline::setPlaybackSpeed(float speed)
+{
+    bool ret = false;
+    GstFormat format = GST_FORMAT_TIME;
+    gint64 position = 0;
+
+    if (!isValidPlaybackSpeed(speed))
+    {
+        GST_PLAYER_ERROR ("Invalid playback speed: %f\n", speed);
+        return false;
+    }
+
+    LOCK (&mActionMutex);
+    if (!mPlayBin) 
+    { 
+        GST_PLAYER_ERROR ("Pipeline not initialized\n");
+        goto EXIT;
+    }
+    if (mAudioTempo == NULL && speed != 1.0f)
+    {
+        GST_PLAYER_ERROR ("Audio can't be time stretched\n");
+        goto EXIT;
+    }
+    if ((gdouble)speed == mSpeed)
+    {
+        ret = true;
+        goto EXIT;
+    }
+
+    GST_PLAYER_DEBUG ("setPlaybackSpeed (%f)\n", speed);
+    // trick play runs on, the speed applies when it ends
+    if (mRate != 1)
+    {
+        mSpeed = speed;
+        ret = true;
+        goto EXIT;
+    }
+
+    if (!gst_element_query_position (mPlayBin, &format, &position) || 
+            position < 0)
+        position = 0;
+
+    // accurate seek resumes audio where it is
+    if (!seek_with_rate(position, (gdouble)speed, (GstSeekFlags)
+            (GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE)))
+    {
+        GST_PLAYER_ERROR ("Fail to set playback speed %f\n", speed);
+        goto EXIT;
+    }
+    mSpeed = speed;
+    ret = true;
+
+EXIT:
+    UNLOCK (&mActionMutex);
+    return ret;
+}
+
+bool GstPlayerPipeline::setAudioStreamType(int streamType)
+{
+    bool ret = false;
+
+    if (streamType < 0 || 
+            streamType >= (int)G_N_ELEMENTS(audio_stream_profiles))
+    {
+        GST_PLAYER_ERROR ("Invalid audio stream type: %d\n", streamType);
+        return false;
+    }
+
+    LOCK (&mActionMutex);
+    mAudioStreamType = streamType;
+    mAudioProfile = audio_stream_profiles[streamType];
+    GST_PLAYER_DEBUG ("Audio stream type %d, profile %d\n", 
+            mAudioStreamType, mAudioProfile);
+
+    // profile takes effect at the next prepare
+    if (mAudioSink)
+    {
+        g_object_set (mAudioSink, 
+            "stream-type", mAudioStreamType,
+            "profile", mAudioProfile, 
+            NULL);
+    }
+    ret = true;
+
+    UNLOCK (&mActionMutex);
+    return ret;
+}
+
+bool GstPlayerPipeline::getAudioUnderruns(int* count)
+{
+    guint underruns = 0;
+
+    if (count == NULL)
+        return false;
+
+    LOCK (&mActionMutex);
+    if (mAudioSink)
+        g_object_get (mAudioSink, "underruns", &underruns, NULL);
+    UNLOCK (&mActionMutex);
+
+    *count = (int)underruns;
+    return true;
+}
+
+// reset_rate()
+// Back to normal rate and speed, the pipeline has been stopped,
+// mActionMutex shall be held
+//
+void GstPlayerPipeline::reset_rate()
+{
+    if (mRate != 1 && mVideoSink && mFrameGrabSink == NULL)
+        g_object_set (mVideoSink, "max-render-rate", 0, NULL);
+    if (mRate != 1)
+        set_time_stretch(true);
+    mRate = 1;
+    mSpeed = 1.0;
+}
+
+// set_time_stretch()
+// Let audioflingertempo stretch the playback speeds, or pass every rate
+// through by narrowing its range to 1. mActionMutex shall be held
+//
+void GstPlayerPipeline::set_time_stretch(bool enable)
+{
+    if (mAudioTempo == NULL)
+        return;
+    g_object_set (mAudioTempo, 
+            "min-rate", enable ? MIN_PLAYBACK_SPEED : 1.0,
+            "max-rate", enable ? MAX_PLAYBACK_SPEED : 1.0,
+            NULL);
+}
+
+bool GstPlayerPipeline::setSeekMode(GstPlayerSeekMode mode)
+{
+    if (mode < SEEK_MODE_KEY_UNIT || mode >= SEEK_MODE_COUNT)
+    {
+        GST_PLAYER_ERROR ("Invalid seek mode: %d\n", mode);
+        return false;
+    }
+    GST_PLAYER_DEBUG ("setSeekMode (%s)\n", seek_mode_names[mode]);
+    LOCK (&mActionMutex);
+    mSeekMode = mode;
+    UNLOCK (&mActionMutex);
+    return true;
+}
+
+bool GstPlayerPipeline::getSeekStats(GstPlayerSeekMode mode, int* count, 
+        int* avgMsec, int* maxMsec)
+{
+    if (mode < SEEK_MODE_KEY_UNIT || mode >= SEEK_MODE_COUNT)
+        return false;
+
+    LOCK (&mActionMutex);
+    GstPlayerSeekStats* stats = &mSeekStats[mode];
+    *count = stats->count;
+    *avgMsec = stats->count ? 
+        (int)(stats->total / stats->count / GST_MSECOND) : 0;
+    *maxMsec = (int)(stats->max / GST_MSECOND);
+    UNLOCK (&mActionMutex);
+    return true;
+}
+
+// seek_done()
+// Current seek completes, run the pending seek if there is one. Superseded
+// seeks get their MEDIA_SEEK_COMPLETE when the last seek completes.
+//
+void GstPlayerPipeline::seek_done()
+{
+    mSeeking = false;
+    mSeekState = GST_STATE_VOID_PENDING;
+
+    // update seek latency of current mode
+    if (GST_CLOCK_TIME_IS_VALID(mSeekStartTime))
+    {
+        GstClockTime latency = gst_util_get_timestamp () - mSeekStartTime;
+        GstPlayerSeekStats* stats = &mSeekStats[mCurrentSeekMode];
+
+        stats->total += latency;
+        if (stats->count == 0 || latency < stats->min)
+            stats->min = latency;
+        if (latency > stats->max)
+            stats->max = latency;
+        stats->count++;
+        GST_PLAYER_DEBUG ("%s seek latency: %d ms, avg: %d ms, min: %d ms, "
+            "max: %d ms, count: %d\n", seek_mode_names[mCurrentSeekMode],
+            (int)(latency / GST_MSECOND),
+            (int)(stats->total / stats->count / GST_MSECOND),
+            (int)(stats->min / GST_MSECOND), (int)(stats->max / GST_MSECOND),
+            stats->count);
+        mSeekStartTime = GST_CLOCK_TIME_NONE;
+    }
+
+    if (mPendingSeekMsec >= 0)
+    {
+        int msec = mPendingSeekMsec;
+        mPendingSeekMsec = -1;
+
+        send_seek_complete(1);
+        if (do_seek(msec, mPendingSeekMode, mPendingSeekTime))
+            return;
+
+        // pending seek fails, complete it anyway
+        send_seek_complete(1 + mSupersededSeeks);
+    }
+    else
+    {
+        send_seek_complete(1 + mSupersededSeeks);
+    }
+    mSupersededSeeks = 0;
+}
+
+// prefetch_key_frame()
+// Look up the key frame before position in index. If the file is mapped,
+// read ahead at its offset, so demuxer's positioned read there doesn't wait
+// for storage. Only demuxers which write the index have key frames in it:
+// seeks of mp3parse and aacparse (VBR MP3, ADTS AAC) aren't helped.
+//
+void GstPlayerPipeline::prefetch_key_frame(gint64 position)
+{
+    guint64 keytime;
+    gint64 offset;
+
+    if (!mKeyIndex.lookup((guint64)position, &keytime, &offset))
+        return;
+    GST_PLAYER_DEBUG ("Key frame of %lld ms: %lld ms at %lld\n", 
+            position / GST_MSECOND, keytime / GST_MSECOND, offset);
+
+    LOCK (&mSourceMutex);
+    if (mMapping != NULL && offset >= 0 && (guint64)offset < mLength)
+    {
+        guint64 start = (guint64)offset & ~((guint64)PAGESIZE - 1);
+        guint64 size = MIN(mLength - start, (guint64)SEEK_PREFETCH_SIZE);
+        madvise((void*)(mMapping->base + start), (size_t)size, 
+                MADV_WILLNEED);
+    }
+    UNLOCK (&mSourceMutex);
+}
+
+// add_sink_probe()
+// Watch buffers and events reaching sink, to time the first frame and the
+// first sample rendered after seek
+//
+void GstPlayerPipeline::add_sink_probe(GstElement* sink, GCallback probe)
+{
+    GstPad* pad = gst_element_get_static_pad (sink, "sink");
+    if (pad == NULL)
+        return;
+    gst_pad_add_data_probe (pad, probe, this);
+    gst_object_unref (pad);
+}
+
+gboolean GstPlayerPipeline::audio_sink_data_probe(GstPad* pad, 
+        GstMiniObject* data, gpointer user_data)
+{
+    GstPlayerPipeline* player_pipeline = (GstPlayerPipeline*)user_data;
+
+    // PCM reaching audio sink is what's played from cache next time
+    player_pipeline->mPcmCache.capture(data);
+    player_pipeline->sink_data_probe(data, false);
+    return TRUE;
+}
+
+gboolean GstPlayerPipeline::video_sink_data_probe(GstPad* pad, 
+        GstMiniObject* data, gpointer user_data)
+{
+    ((GstPlayerPipeline*)user_data)->sink_data_probe(data, true);
+    return TRUE;
+}
+
+// video_frame_posted()
+// Called by surfaceflingersink in streaming thread, right after it posts a
+// frame to surface flinger. The first frame posted after FLUSH_STOP ends the
+// video seek render latency.
+//
+void GstPlayerPipeline::video_frame_posted(GstElement* sink, 
+        gpointer user_data)
+{
+    GstPlayerPipeline* player_pipeline = (GstPlayerPipeline*)user_data;
+
+    LOCK (&player_pipeline->mSeekRenderMutex);
+    if (player_pipeline->mAwaitVideo && !player_pipeline->mAwaitVideoFlush)
+        player_pipeline->record_seek_render(true);
+    UNLOCK (&player_pipeline->mSeekRenderMutex);
+}
+
+// audio_render_poll()
+// Called in main loop while the first audio sample after seek is awaited.
+// audioflingersink's clock follows the playback head with the track latency
+// taken off, so the sample is heard when the clock reaches its running time.
+// Nothing is heard while paused, so a seek which doesn't go on playing isn't
+// timed.
+//
+gboolean GstPlayerPipeline::audio_render_poll(gpointer user_data)
+{
+    GstPlayerPipeline* player_pipeline = (GstPlayerPipeline*)user_data;
+    GstElement* sink = player_pipeline->mAudioSink;
+    GstClock* clock;
+    gboolean again = TRUE;
+
+    LOCK (&player_pipeline->mSeekRenderMutex);
+    if (!player_pipeline->mAwaitAudio)
+    {
+        again = FALSE;
+    }
+    else if (GST_STATE_TARGET (sink) != GST_STATE_PLAYING)
+    {
+        player_pipeline->mAwaitAudio = false;
+        again = FALSE;
+    }
+    else if (GST_STATE (sink) == GST_STATE_PLAYING &&
+            (clock = gst_element_get_clock (sink)) != NULL)
+    {
+        GstClockTime now = gst_clock_get_time (clock);
+        GstClockTime base_time = gst_element_get_base_time (sink);
+
+        gst_object_unref (clock);
+        if (now >= base_time && 
+                now - base_time >= player_pipeline->mAudioRenderTarget)
+        {
+            player_pipeline->record_seek_render(false);
+            again = FALSE;
+        }
+    }
+    if (!again)
+        player_pipeline->mAudioRenderPoll = 0;
+    UNLOCK (&player_pipeline->mSeekRenderMutex);
+    return again;
+}
+
+// sink_data_probe()
+// Called in streaming thread. Buffers before FLUSH_STOP belong to the
+// position before seek, so they're not timed. The first audio buffer after
+// it gives the running time at which audio is heard again.
+//
+void GstPlayerPipeline::sink_data_probe(GstMiniObject* data, bool video)
+{
+    bool* await_flush = video ? &mAwaitVideoFlush : &mAwaitAudioFlush;
+    bool* await = video ? &mAwaitVideo : &mAwaitAudio;
+
+    LOCK (&mSeekRenderMutex);
+    if (!*await)
+        goto EXIT;
+
+    if (GST_IS_EVENT (data))
+    {
+        GstEvent* event = GST_EVENT (data);
+
+        if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
+        {
+            *await_flush = false;
+            if (!video)
+                gst_segment_init (&mAudioSegment, GST_FORMAT_TIME);
+        }
+        else if (!video && GST_EVENT_TYPE (event) == GST_EVENT_NEWSEGMENT)
+        {
+            gboolean update;
+            gdouble rate, applied_rate;
+            GstFormat format;
+            gint64 start, stop, position;
+
+            gst_event_parse_new_segment_full (event, &update, &rate, 
+                    &applied_rate, &format, &start, &stop, &position);
+            if (format == GST_FORMAT_TIME)
+                gst_segment_set_newsegment_full (&mAudioSegment, update, 
+                        rate, applied_rate, format, start, stop, position);
+        }
+    }
+    else if (!video && GST_IS_BUFFER (data) && !*await_flush &&
+            !GST_CLOCK_TIME_IS_VALID (mAudioRenderTarget))
+    {
+        gint64 target = gst_segment_to_running_time (&mAudioSegment, 
+                GST_FORMAT_TIME, GST_BUFFER_TIMESTAMP (data));
+
+        mAudioRenderTarget = (target > 0) ? (GstClockTime)target : 0;
+        if (mAudioRenderPoll == 0)
+            mAudioRenderPoll = g_timeout_add (SEEK_RENDER_POLL_MSEC, 
+                    audio_render_poll, this);
+    }
+
+EXIT:
+    UNLOCK (&mSeekRenderMutex);
+}
+
+// record_seek_render()
+// Add the time since seek to the latency histogram of current format.
+// mSeekRenderMutex shall be held.
+//
+void GstPlayerPipeline::record_seek_render(bool video)
+{
+    GstClockTime latency = gst_util_get_timestamp () - mSeekRenderStart;
+    GstPlayerSeekRenderStats* stats = (GstPlayerSeekRenderStats*)
+        g_hash_table_lookup (mSeekRenderStats, mSeekRenderFormat);
+    if (stats == NULL)
+    {
+        stats = g_new0 (GstPlayerSeekRenderStats, 1);
+        g_hash_table_insert (mSeekRenderStats, 
+                g_strdup (mSeekRenderFormat), stats);
+    }
+
+    GstPlayerLatencyHistogram* histogram = 
+        video ? &stats->video : &stats->audio;
+    int msec = (int)(latency / GST_MSECOND);
+    int i = 0;
+    while (i < SEEK_RENDER_BUCKETS - 1 && msec >= seek_render_buckets[i])
+        i++;
+    histogram->buckets[i]++;
+    histogram->count++;
+    histogram->total += latency;
+    if (latency > histogram->max)
+        histogram->max = latency;
+    if (video)
+        mAwaitVideo = false;
+    else
+        mAwaitAudio = false;
+
+    GST_PLAYER_DEBUG ("%s: first %s %d ms after seek, avg: %d ms, "
+        "max: %d ms, count: %d\n", mSeekRenderFormat, 
+        video ? "frame shown" : "sample heard", msec, 
+        (int)(histogram->total / histogram->count / GST_MSECOND),
+        (int)(histogram->max / GST_MSECOND), histogram->count);
+}
+
+void GstPlayerPipeline::set_seek_render_format(const gchar* format)
+{
+    LOCK (&mSeekRenderMutex);
+    g_free (mSeekRenderFormat);
+    mSeekRenderFormat = g_strdup (format ? format : 
+            SEEK_RENDER_UNKNOWN_FORMAT);
+    UNLOCK (&mSeekRenderMutex);
+}
+
+bool GstPlayerPipeline::getSeekRenderStats(const char* format, 
+        GstPlayerSeekRenderStats* stats)
+{
+    bool ret = false;
+
+    LOCK (&mSeekRenderMutex);
+    GstPlayerSeekRenderStats* found = (GstPlayerSeekRenderStats*)
+        g_hash_table_lookup (mSeekRenderStats, format);
+    if (found)
+    {
+        *stats = *found;
+        ret = true;
+    }
+    UNLOCK (&mSeekRenderMutex);
+    return ret;
+}
+
+const int* GstPlayerPipeline::getSeekRenderBuckets()
+{
+    return seek_render_buckets;
+}
+
+void GstPlayerPipeline::send_seek_complete(int count)
+{
+    GST_PLAYER_DEBUG("send %d MEDIA_SEEK_COMPLETE event\n", count);
+    if (mGstPlayer == NULL)
+        return;
+    for (int i = 0; i < count; i++)
+        mGstPlayer->sendEvent(MEDIA_SEEK_COMPLETE);
+}
+
 bool GstPlayerPipeline::getCurrentPosition(int *msec)
 {
     GstFormat  fmt = GST_FORMAT_TIME;
@@ -1245,6 +2804,22 @@ bool GstPlayerPipeline::setLooping(int loop)
     return true;
 }
 
+bool GstPlayerPipeline::reloadTunables()
+{
+    GstPlayerTunables tunables;
+    int res;
+
+    GST_PLAYER_DEBUG ("Reload tunables from "GST_CONFIG_FILE"\n");
+    res = get_gst_tunables_from_conf(&tunables);
+
+    LOCK(&gst_tunables_mutex);
+    gst_tunables = tunables;
+    gst_tunables_loaded = TRUE;
+    UNLOCK(&gst_tunables_mutex);
+
+    return (res == 0);
+}
+
 void GstPlayerPipeline::handleEos(GstMessage* p_msg)
 {
     GST_PLAYER_DEBUG ("Recevied EOS.\n");
@@ -1286,6 +2861,14 @@ void GstPlayerPipeline::handleTag(GstMessage* p_msg)
     // enumerate each tag
     gst_tag_list_foreach(taglist, taglist_foreach, this);
 
+    // seek render latency is recorded per container format
+    gchar* format = NULL;
+    if (gst_tag_list_get_string(taglist, GST_TAG_CONTAINER_FORMAT, &format))
+    {
+        set_seek_render_format(format);
+        g_free(format);
+    }
+
     gst_tag_list_free(taglist);
 }
 
@@ -1331,22 +2914,23 @@ void GstPlayerPipeline::handleStateChanged(GstMessage* p_msg)
             mGstPlayer->sendEvent(MEDIA_PREPARED);
         }
     }   
-
-    // seekTo
-    if (mSeeking == true && msgsrc == mPlayBin && newstate == mSeekState &&
-            (pending == GST_STATE_VOID_PENDING))
-    {
-        GST_PLAYER_DEBUG("seekTo() done, send MEDIA_SEEK_COMPLETE event\n");
-        mSeeking = false;
-        mSeekState = GST_STATE_VOID_PENDING;
-        if (mGstPlayer)
-            mGstPlayer->sendEvent(MEDIA_SEEK_COMPLETE);
-    }
 }
 
+// handleAsyncDone()
+// A flushing seek makes sinks preroll again, and the pipeline posts
+// ASYNC_DONE when all of them have prerolled, whether or not the state
+// changes. It's where the seek completes.
+//
 void GstPlayerPipeline::handleAsyncDone(GstMessage* p_msg)
 {
+    GstElement *msgsrc = (GstElement *)GST_MESSAGE_SRC(p_msg);
+
     GST_PLAYER_DEBUG("Enter");
+    if (mSeeking == true && msgsrc == mPlayBin)
+    {
+        GST_PLAYER_DEBUG("seekTo() done\n");
+        seek_done();
+    }
 }
 
 void GstPlayerPipeline::handleSegmentDone(GstMessage* p_msg)
@@ -1365,6 +2949,38 @@ void GstPlayerPipeline::handleDuration(GstMessage* p_msg)
     GST_PLAYER_DEBUG ("Duration: %d\n", (int)(duration / GST_MSECOND));
 }
 
+// handleNewClock()
+// The pipeline picks the clock of audioflingersink when it's playing audio,
+// which follows the playback head of AudioTrack, and video is rendered
+// against it.
+//
+void GstPlayerPipeline::handleNewClock(GstMessage* p_msg)
+{
+    GstClock *clock = NULL;
+    gst_message_parse_new_clock(p_msg, &clock);
+    GST_PLAYER_DEBUG ("New clock: %s\n", 
+        clock ? GST_OBJECT_NAME(clock) : "none");
+}
+
+// handleClockLost()
+// The clock provider went away, e.g. audioflingersink released its track.
+// Going to PAUSED and back to PLAYING makes the pipeline select a clock
+// again.
+//
+void GstPlayerPipeline::handleClockLost(GstMessage* p_msg)
+{
+    GstState state, pending;
+
+    GST_PLAYER_DEBUG ("Enter");
+    gst_element_get_state (mPlayBin, &state, &pending, 0);
+    if (state == GST_STATE_PLAYING && pending == GST_STATE_VOID_PENDING)
+    {
+        GST_PLAYER_DEBUG ("Select a new clock\n");
+        gst_element_set_state (mPlayBin, GST_STATE_PAUSED);
+        gst_element_set_state (mPlayBin, GST_STATE_PLAYING);
+    }
+}
+
 void GstPlayerPipeline::handleElement(GstMessage* p_msg)
 {
     const GstStructure* pStru = gst_message_get_structure(p_msg);
@@ -1392,6 +3008,17 @@ void GstPlayerPipeline::handleElement(GstMessage* p_msg)
     {
         // onDownloadCompleted();
     }
+    else if (strcmp(name, "audioflingersink-stats") == 0)
+    {
+        guint writes = 0, short_writes = 0, failures = 0;
+        gint underruns = 0;
+        gst_structure_get_uint(pStru, "writes", &writes);
+        gst_structure_get_uint(pStru, "short-writes", &short_writes);
+        gst_structure_get_uint(pStru, "failures", &failures);
+        gst_structure_get_int(pStru, "underruns", &underruns);
+        GST_PLAYER_DEBUG("audio writes: %u, short: %u, failed: %u, "
+            "underruns: %d\n", writes, short_writes, failures, underruns);
+    }
 }
 
 void GstPlayerPipeline::handleApplication(GstMessage* p_msg)
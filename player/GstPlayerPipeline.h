@@ -29,15 +29,96 @@
 #include <unistd.h>
 #include <gst/gst.h>
 #include <gstappsrc.h>
+#include <gstappsink.h>
+#include "GstPlayerIndex.h"
+#include "GstPlayerPcmCache.h"
 
 using namespace android;
 
+// Performance tunables, read from the [Performance] group of gst.conf. They
+// are loaded once and cached, and applied to elements when they are created.
+typedef struct
+{
+    int audioBufferTime;        // audioflingersink buffer-time, in ms
+    int audioLatencyTime;       // audioflingersink latency-time, in ms
+    int videoBufferCount;       // surfaceflingersink buffer-count
+    int bufferSize;             // playbin2 buffer-size, in bytes, -1 default
+    int bufferDuration;         // playbin2 buffer-duration, in ms, -1 default
+    int appsrcBlockSize;        // appsrc blocksize, in bytes
+    int appsrcMaxBytes;         // appsrc max-bytes, in bytes
+    int trickPlayRenderRate;    // surfaceflingersink fps limit in trick play
+    int pcmCacheDuration;       // longest clip whose PCM is cached, in ms
+    int pcmCacheSize;           // PCM cache size, in bytes, 0 disabled
+    int stretchCpuBudget;       // audioflingertempo cpu-budget, in percent
+    char indexCacheDir[256];    // key frame index sidecar dir, empty disabled
+} GstPlayerTunables;
+
+
+// Seek precision modes. Key unit seek is the fastest, accurate seek decodes
+// from the previous key frame up to the exact position.
+typedef enum
+{
+    SEEK_MODE_KEY_UNIT = 0,     // nearest key frame
+    SEEK_MODE_SNAP_BEFORE,      // key frame before the position
+    SEEK_MODE_SNAP_AFTER,       // key frame after the position
+    SEEK_MODE_ACCURATE,         // exact position
+    SEEK_MODE_COUNT
+} GstPlayerSeekMode;
+
+// seek latency measured per seek mode, from seekTo() to seek complete
+typedef struct
+{
+    int count;
+    GstClockTime total;
+    GstClockTime min;
+    GstClockTime max;
+} GstPlayerSeekStats;
+
+// A file mapped for appsrc. Each buffer pushed from it holds a reference, so
+// it stays mapped until decoders release the last one, after the player has
+// moved to another file.
+typedef struct
+{
+    gint     refcount;
+    guint8*  base;
+    guint64  length;
+} GstPlayerMapping;
+
+// histogram of latency from seekTo() to the first audio sample heard or
+// video frame posted to surface flinger. Bucket i counts latencies below
+// seek_render_buckets[i] ms, the last bucket counts the rest.
+#define SEEK_RENDER_BUCKETS 8
+typedef struct
+{
+    int count;
+    GstClockTime total;
+    GstClockTime max;
+    int buckets[SEEK_RENDER_BUCKETS];
+} GstPlayerLatencyHistogram;
+
+// seek render latency of one container format
+typedef struct
+{
+    GstPlayerLatencyHistogram audio;
+    GstPlayerLatencyHistogram video;
+} GstPlayerSeekRenderStats;
+
+// audioflingersink buffering profiles, the same values as its "profile"
+typedef enum
+{
+    AUDIO_PROFILE_DEFAULT = 0,  // buffer time and latency time of tunables
+    AUDIO_PROFILE_LOW_LATENCY,  // small segments, minimal track buffer
+    AUDIO_PROFILE_DEEP_BUFFER,  // large segments, few wakeups
+} GstPlayerAudioProfile;
 
 // The class to handle gst pipeline
 class GstPlayerPipeline
 {
 public:
-    GstPlayerPipeline(GstPlayer* gstPlayer);
+    // frameGrab builds a pipeline for thumbnails: no audio and no surface,
+    // captureFrame() decodes one RGB565 frame at msec. The frame shall be
+    // freed with g_free().
+    GstPlayerPipeline(GstPlayer* gstPlayer, bool frameGrab = false);
     ~GstPlayerPipeline();
 
     bool setDataSource(const char *url);
@@ -52,16 +133,48 @@ public:
     bool isPlaying();
     bool getVideoSize(int *w, int *h);
     bool seekTo(int msec);
+    bool seekTo(int msec, GstPlayerSeekMode mode);
+    bool setSeekMode(GstPlayerSeekMode mode);
+    bool getSeekStats(GstPlayerSeekMode mode, int* count, int* avgMsec, 
+            int* maxMsec);
+    // seek render latency of format, "unknown" if container isn't tagged
+    bool getSeekRenderStats(const char* format, 
+            GstPlayerSeekRenderStats* stats);
+    static const int* getSeekRenderBuckets();
+    // trick play, negative rate plays backward
+    bool setPlaybackRate(int rate);
+    static bool isValidPlaybackRate(int rate);
+    // speed of normal playback, audio keeps its pitch. It applies again
+    // when trick play ends, and it's back to 1 at the next prepare.
+    bool setPlaybackSpeed(float speed);
+    static bool isValidPlaybackSpeed(float speed);
+    // AudioSystem stream type of audio, it selects the buffering profile.
+    // Call it before prepare().
+    bool setAudioStreamType(int streamType);
+    // times audio ran out of data since the last prepare
+    bool getAudioUnderruns(int* count);
     bool getCurrentPosition(int *msec);
     bool getDuration(int *msec);
     bool reset();
     bool setLooping(int loop);
+    // gapless playback: the next source is played when the current one is
+    // about to finish, without tearing down the pipeline
+    bool setNextDataSource(const char *url);
+    bool setNextDataSource(int fd, int64_t offset, int64_t length);
+    bool captureFrame(int msec, guint8** data, int* size, 
+            int* width, int* height);
+
+    // reload tunables from gst.conf, it takes effect on elements created
+    // after this call
+    static bool reloadTunables();
 
 private:
     // static apis
     static gboolean bus_callback (GstBus *bus, GstMessage *msg, gpointer data);
     static void playbin2_found_source(GObject * object, GObject * orig, 
             GParamSpec * pspec, gpointer player_pipeline);
+    static void playbin2_about_to_finish(GstElement* playbin, 
+            gpointer user_data);
     static void appsrc_need_data(GstAppSrc *src, guint length, 
             gpointer user_data);
     static void appsrc_enough_data(GstAppSrc *src, gpointer user_data);
@@ -69,9 +182,34 @@ private:
             gpointer user_data);
     static void taglist_foreach(const GstTagList *list, const gchar *tag, 
             gpointer user_data);
+    static gboolean audio_sink_data_probe(GstPad* pad, GstMiniObject* data,
+            gpointer user_data);
+    static gboolean video_sink_data_probe(GstPad* pad, GstMiniObject* data,
+            gpointer user_data);
+    static void video_frame_posted(GstElement* sink, gpointer user_data);
+    static gboolean audio_render_poll(gpointer user_data);
 
     // private apis
+    static gchar* build_uri(const char *url);
+    static GstPlayerMapping* map_fd(int fd);
+    static void unref_mapping(gpointer mapping);
+    bool play_cached_pcm();
+    void release_cached_pcm();
+    void push_cached_pcm(GstAppSrc *src, guint length);
+    void connect_source_notify();
+    bool do_seek(int msec, GstPlayerSeekMode mode, GstClockTime start);
+    void add_sink_probe(GstElement* sink, GCallback probe);
+    void sink_data_probe(GstMiniObject* data, bool video);
+    void record_seek_render(bool video);
+    void set_seek_render_format(const gchar* format);
+    void prefetch_key_frame(gint64 position);
+    bool seek_with_rate(gint64 position, gdouble rate, GstSeekFlags flags);
+    void reset_rate();
+    void set_time_stretch(bool enable);
+    void seek_done();
+    void send_seek_complete(int count);
     bool create_pipeline();
+    bool create_frame_grab_sink();
     void delete_pipeline();  
 
     void handleEos(GstMessage* p_msg);
@@ -82,28 +220,86 @@ private:
     void handleAsyncDone(GstMessage* p_msg);
     void handleSegmentDone(GstMessage* p_msg);
     void handleDuration(GstMessage* p_msg);
+    void handleNewClock(GstMessage* p_msg);
+    void handleClockLost(GstMessage* p_msg);
     void handleElement(GstMessage* p_msg);
     void handleApplication(GstMessage* p_msg);
 
     GstPlayer*  mGstPlayer;
+    GstPlayerTunables mTunables;
 
     // gst elements
     GstElement* mPlayBin;
     GstElement* mAudioSink;
+    // time stretch in front of mAudioSink, NULL if it isn't available
+    GstElement* mAudioTempo;
     GstElement* mVideoSink;
     GstAppSrc* mAppSource;
-    // app source 
+    GstAppSink* mFrameGrabSink;
+    // app source, and the next source for gapless playback. appsrc reads
+    // them in its streaming thread, so they're protected by mSourceMutex
     int mFd;
     guint64  mLength;
     guint64  mOffset;
-    guint8*  mMemBase;
+    GstPlayerMapping* mMapping;
+    bool     mSourceNotifyConnected;
+    gchar*   mNextUri;
+    int      mNextFd;
+    GstPlayerMapping* mNextMapping;
+    bool     mSwitchAppSource;
+    pthread_mutex_t  mSourceMutex;
     // seek
     bool     mSeeking;
     GstState mSeekState;
+    // seeks requested while seeking are coalesced, only the latest one is
+    // kept in mPendingSeekMsec (-1 if none); mSupersededSeeks counts the
+    // replaced ones, which still owe a MEDIA_SEEK_COMPLETE event
+    int      mPendingSeekMsec;
+    GstPlayerSeekMode mPendingSeekMode;
+    GstClockTime mPendingSeekTime;
+    int      mSupersededSeeks;
+    // seek mode used by seekTo(msec), and latency of each mode
+    GstPlayerSeekMode mSeekMode;
+    GstPlayerSeekMode mCurrentSeekMode;
+    GstClockTime mSeekStartTime;
+    GstPlayerSeekStats mSeekStats[SEEK_MODE_COUNT];
+    // seek render latency, measured in streaming threads, so it's protected
+    // by mSeekRenderMutex instead of mActionMutex. After a seek, video ends
+    // at the first frame posted after FLUSH_STOP, audio when the audio
+    // sink's clock reaches the running time of the first buffer after
+    // FLUSH_STOP, i.e. when its first sample is heard.
+    GstClockTime mSeekRenderStart;
+    bool     mAwaitAudioFlush;
+    bool     mAwaitVideoFlush;
+    bool     mAwaitAudio;
+    bool     mAwaitVideo;
+    GstSegment mAudioSegment;
+    GstClockTime mAudioRenderTarget;
+    guint    mAudioRenderPoll;
+    gchar*   mSeekRenderFormat;
+    GHashTable* mSeekRenderStats;
+    pthread_mutex_t  mSeekRenderMutex;
+    // playback rate, 1 if not in trick play, and the speed of normal
+    // playback
+    int      mRate;
+    gdouble  mSpeed;
+    // audio stream type, and the profile selected by it
+    int      mAudioStreamType;
+    GstPlayerAudioProfile mAudioProfile;
+    // key frame index of current file
+    GstPlayerIndex mKeyIndex;
+    // decoded PCM of current file, captured or played from cache. When
+    // mPcmClip is set, appsrc feeds it instead of the mapped file, and
+    // mOffset and mLength are in bytes of PCM.
+    GstPlayerPcmCache mPcmCache;
+    GstBuffer* mPcmClip;
+    int      mPcmRate;
+    int      mPcmFrameSize;
     // prepare
     bool mAsynchPreparePending;
     // loop
     bool mIsLooping;
+    bool mFrameGrabMode;
     // internal audio sink
     sp<MediaPlayerInterface::AudioSink> mAudioOut;
     // main loop
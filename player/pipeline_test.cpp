@@ -21,6 +21,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <sys/time.h>
 #include <pthread.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -161,9 +162,57 @@ static void test_setDataSource_url()
 }
 
 
+static void test_setNextDataSource_fd()
+{
+    int fd = open("/sdcard/1.m4a", O_RDONLY);
+    int next_fd = open("/sdcard/2.m4a", O_RDONLY);
+    GstPlayerPipeline *pipeline = new GstPlayerPipeline(NULL);
+    printf("setDataSource\n");
+    pipeline->setDataSource(fd, 0, 0);
+    printf("setNextDataSource\n");
+    pipeline->setNextDataSource(next_fd, 0, 0);
+    printf("prepare\n");
+    pipeline->prepare();
+    printf("start, 2.m4a shall follow 1.m4a without gap\n");
+    pipeline->start();
+    sleep(60);
+
+    printf("delete pipeline\n");
+    delete pipeline;
+    close(next_fd);
+    close(fd);
+}
+
+static void test_captureFrame()
+{
+    const char* file = "/sdcard/1.mp4";
+    struct timeval start, end;
+    int count = 10;
+
+    gettimeofday(&start, NULL);
+    for (int i = 0; i < count; i++)
+    {
+        guint8* data = NULL;
+        int size = 0, width = 0, height = 0;
+        GstPlayerPipeline *pipeline = new GstPlayerPipeline(NULL, true);
+        pipeline->setDataSource(file);
+        if (pipeline->captureFrame(i * 1000, &data, &size, &width, &height))
+            printf("frame at %d ms: %dx%d, %d bytes\n", i * 1000, width, height, size);
+        else
+            printf("fail to capture frame at %d ms\n", i * 1000);
+        g_free(data);
+        delete pipeline;
+    }
+    gettimeofday(&end, NULL);
+    printf("%d thumbnails in %ld ms\n", count, 
+        (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000);
+}
+
 int main (int argc, char **argv[])
 {
     test_setDataSource_fd();
+    test_setNextDataSource_fd();
+    test_captureFrame();
     // test_setDataSource_url(); test_fd();
     return 0;
 
@@ -6,7 +6,12 @@ GST_MAJORMINOR:= 0.10
 
 LOCAL_SRC_FILES:= \
 	audioflinger_wrapper.cpp \
-	gstaudioflingersink.c         
+	audioflinger_convert.c \
+	audioflinger_gain.c \
+	audioflinger_resample.c \
+	audioflinger_stretch.c \
+	gstaudioflingersink.c \
+	gstaudioflingertempo.c
 
 LOCAL_SHARED_LIBRARIES := 	\
 	libgstreamer-0.10	\
@@ -52,4 +57,78 @@ LOCAL_C_INCLUDES := \
 LOCAL_CFLAGS := \
 	-DHAVE_CONFIG_H			
 
+# conversion kernels use NEON when the cpu has it
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+LOCAL_CFLAGS += -mfpu=neon
+endif
+
 include $(BUILD_PLUGIN_LIBRARY)
+
+# build conversion, gain, resampling and stretching kernel test application
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	audioflinger_convert.c \
+	audioflinger_gain.c \
+	audioflinger_resample.c \
+	audioflinger_stretch.c \
+	convert_test.c
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)
+
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+LOCAL_CFLAGS += -mfpu=neon
+endif
+
+LOCAL_MODULE:= audioconverttest
+
+include $(BUILD_EXECUTABLE)
+
+# build resampler benchmark application
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	audioflinger_resample.c \
+	resample_bench.c
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)
+
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+LOCAL_CFLAGS += -mfpu=neon
+endif
+
+LOCAL_MODULE:= audioresamplebench
+
+include $(BUILD_EXECUTABLE)
+
+# build seek latency benchmark application, it plays on the device
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	audioflinger_wrapper.cpp \
+	seek_bench.c
+
+LOCAL_SHARED_LIBRARIES := 	\
+	libglib-2.0		\
+	libcutils		\
+	libutils		\
+	libaudioflinger		\
+	libmediaplayerservice   \
+	libmedia
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)   \
+	$(LOCAL_PATH)/../../log   \
+	external/glib   \
+	external/glib/android   \
+	external/glib/glib   \
+	frameworks/base/libs/audioflinger \
+	frameworks/base/media/libmediaplayerservice \
+	frameworks/base/media/libmedia	\
+	frameworks/base/include/media
+
+LOCAL_MODULE:= audioseekbench
+
+include $(BUILD_EXECUTABLE)
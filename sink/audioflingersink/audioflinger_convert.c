@@ -0,0 +1,455 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include <math.h>
+#include "audioflinger_convert.h"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* frames converted to float at a time when downmixing, they stay in cache */
+#define CONVERT_BLOCK_FRAMES 128
+
+#define SCALE_S16 (1.0f / 32768.0f)
+#define SCALE_S24 (1.0f / 8388608.0f)
+#define SCALE_S32 (1.0f / 2147483648.0f)
+
+/* channel positions, and their weight in left and right output */
+enum { FL, FR, FC, LFE, RL, RR, SL, SR, RC };
+
+static const float downmix_left[] = {
+  1.0f, 0.0f, 0.7071f, 0.0f, 0.7071f, 0.0f, 0.7071f, 0.0f, 0.5f
+};
+static const float downmix_right[] = {
+  0.0f, 1.0f, 0.7071f, 0.0f, 0.0f, 0.7071f, 0.0f, 0.7071f, 0.5f
+};
+
+/* default positions for 3 to 8 channels */
+static const int downmix_layouts[][AUDIOFLINGER_CONVERT_MAX_CHANNELS] = {
+  {FL, FR, FC},
+  {FL, FR, RL, RR},
+  {FL, FR, FC, RL, RR},
+  {FL, FR, FC, LFE, RL, RR},
+  {FL, FR, FC, LFE, RL, RR, RC},
+  {FL, FR, FC, LFE, RL, RR, SL, SR},
+};
+
+/*
+ * Weights of each input channel in left and right output, normalized so
+ * that a full scale input on all channels doesn't clip.
+ */
+static void
+get_downmix (int channels, float *left, float *right)
+{
+  const int *layout = downmix_layouts[channels - 3];
+  float sum_left = 0.0f;
+  float sum_right = 0.0f;
+  int c;
+
+  for (c = 0; c < channels; c++) {
+    left[c] = downmix_left[layout[c]];
+    right[c] = downmix_right[layout[c]];
+    sum_left += left[c];
+    sum_right += right[c];
+  }
+  for (c = 0; c < channels; c++) {
+    left[c] /= sum_left;
+    right[c] /= sum_right;
+  }
+}
+
+static inline int16_t
+sat16 (int32_t v)
+{
+  if (v > 32767)
+    return 32767;
+  if (v < -32768)
+    return -32768;
+  return (int16_t) v;
+}
+
+static inline int16_t
+float_to_s16 (float f)
+{
+  float v = f * 32768.0f;
+
+  if (v >= 32767.0f)
+    return 32767;
+  if (v <= -32768.0f)
+    return -32768;
+  return (int16_t) floorf (v + 0.5f);
+}
+
+static inline int32_t
+read_s24_3 (const uint8_t * p)
+{
+  /* little endian, sign extended by shifting into the top byte */
+  return ((int32_t) ((uint32_t) p[0] << 8 | (uint32_t) p[1] << 16 |
+          (uint32_t) p[2] << 24)) >> 8;
+}
+
+int
+audioflinger_convert_sample_size (AudioFlingerConvertFormat format)
+{
+  switch (format) {
+    case AUDIOFLINGER_CONVERT_NONE:
+    case AUDIOFLINGER_CONVERT_S16:
+      return 2;
+    case AUDIOFLINGER_CONVERT_S24_3:
+      return 3;
+    default:
+      return 4;
+  }
+}
+
+int
+audioflinger_convert_out_channels (int channels)
+{
+  return (channels == 1) ? 1 : 2;
+}
+
+/*
+ * Kernels, samples are converted one by one, so they don't care about
+ * channels. SIMD loops do 8 samples at a time, the tail is scalar.
+ */
+static void
+convert_s32_s16 (const int32_t * src, int16_t * dest, int n)
+{
+  int i = 0;
+
+#if defined(__ARM_NEON__)
+  for (; i + 8 <= n; i += 8) {
+    int32x4_t a = vld1q_s32 (src + i);
+    int32x4_t b = vld1q_s32 (src + i + 4);
+    vst1q_s16 (dest + i, vcombine_s16 (vshrn_n_s32 (a, 16),
+            vshrn_n_s32 (b, 16)));
+  }
+#elif defined(__SSE2__)
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i b = _mm_loadu_si128 ((const __m128i *) (src + i + 4));
+    _mm_storeu_si128 ((__m128i *) (dest + i),
+        _mm_packs_epi32 (_mm_srai_epi32 (a, 16), _mm_srai_epi32 (b, 16)));
+  }
+#endif
+  for (; i < n; i++)
+    dest[i] = (int16_t) (src[i] >> 16);
+}
+
+static void
+convert_s24_32_s16 (const int32_t * src, int16_t * dest, int n)
+{
+  int i = 0;
+
+#if defined(__ARM_NEON__)
+  for (; i + 8 <= n; i += 8) {
+    int32x4_t a = vld1q_s32 (src + i);
+    int32x4_t b = vld1q_s32 (src + i + 4);
+    vst1q_s16 (dest + i, vcombine_s16 (vqshrn_n_s32 (a, 8),
+            vqshrn_n_s32 (b, 8)));
+  }
+#elif defined(__SSE2__)
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i b = _mm_loadu_si128 ((const __m128i *) (src + i + 4));
+    _mm_storeu_si128 ((__m128i *) (dest + i),
+        _mm_packs_epi32 (_mm_srai_epi32 (a, 8), _mm_srai_epi32 (b, 8)));
+  }
+#endif
+  for (; i < n; i++)
+    dest[i] = sat16 (src[i] >> 8);
+}
+
+static void
+convert_s24_3_s16 (const uint8_t * src, int16_t * dest, int n)
+{
+  int i;
+
+  /* 3 byte samples don't fit vector lanes, the high 2 bytes are the S16 */
+  for (i = 0; i < n; i++)
+    dest[i] = (int16_t) (src[3 * i + 1] | src[3 * i + 2] << 8);
+}
+
+static void
+convert_f32_s16 (const float *src, int16_t * dest, int n)
+{
+  int i = 0;
+
+#if defined(__ARM_NEON__)
+  {
+    const float32x4_t max = vdupq_n_f32 (32767.0f);
+    const float32x4_t min = vdupq_n_f32 (-32768.0f);
+    const float32x4_t half = vdupq_n_f32 (0.5f);
+    const uint32x4_t sign = vdupq_n_u32 (0x80000000);
+
+    for (; i + 8 <= n; i += 8) {
+      float32x4_t a = vmulq_n_f32 (vld1q_f32 (src + i), 32768.0f);
+      float32x4_t b = vmulq_n_f32 (vld1q_f32 (src + i + 4), 32768.0f);
+      a = vmaxq_f32 (vminq_f32 (a, max), min);
+      b = vmaxq_f32 (vminq_f32 (b, max), min);
+      /* vcvt truncates, add 0.5 with the sign of sample to round */
+      a = vaddq_f32 (a, vreinterpretq_f32_u32 (vorrq_u32 (vandq_u32 (
+                      vreinterpretq_u32_f32 (a), sign),
+                  vreinterpretq_u32_f32 (half))));
+      b = vaddq_f32 (b, vreinterpretq_f32_u32 (vorrq_u32 (vandq_u32 (
+                      vreinterpretq_u32_f32 (b), sign),
+                  vreinterpretq_u32_f32 (half))));
+      vst1q_s16 (dest + i, vcombine_s16 (vqmovn_s32 (vcvtq_s32_f32 (a)),
+              vqmovn_s32 (vcvtq_s32_f32 (b))));
+    }
+  }
+#elif defined(__SSE2__)
+  {
+    const __m128 scale = _mm_set1_ps (32768.0f);
+    const __m128 max = _mm_set1_ps (32767.0f);
+    const __m128 min = _mm_set1_ps (-32768.0f);
+
+    for (; i + 8 <= n; i += 8) {
+      __m128 a = _mm_mul_ps (_mm_loadu_ps (src + i), scale);
+      __m128 b = _mm_mul_ps (_mm_loadu_ps (src + i + 4), scale);
+      /* clamp first, cvtps2dq gives 0x80000000 for positive overflow */
+      a = _mm_max_ps (_mm_min_ps (a, max), min);
+      b = _mm_max_ps (_mm_min_ps (b, max), min);
+      _mm_storeu_si128 ((__m128i *) (dest + i),
+          _mm_packs_epi32 (_mm_cvtps_epi32 (a), _mm_cvtps_epi32 (b)));
+    }
+  }
+#endif
+  for (; i < n; i++)
+    dest[i] = float_to_s16 (src[i]);
+}
+
+static void
+convert_s16_f32 (const int16_t * src, float *dest, int n)
+{
+  int i = 0;
+
+#if defined(__ARM_NEON__)
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t a = vld1q_s16 (src + i);
+    vst1q_f32 (dest + i, vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (
+                    vget_low_s16 (a))), SCALE_S16));
+    vst1q_f32 (dest + i + 4, vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (
+                    vget_high_s16 (a))), SCALE_S16));
+  }
+#elif defined(__SSE2__)
+  {
+    const __m128 scale = _mm_set1_ps (SCALE_S16);
+
+    for (; i + 8 <= n; i += 8) {
+      __m128i a = _mm_loadu_si128 ((const __m128i *) (src + i));
+      /* sign extend by placing samples in the high half and shifting */
+      __m128i lo = _mm_srai_epi32 (_mm_unpacklo_epi16 (a, a), 16);
+      __m128i hi = _mm_srai_epi32 (_mm_unpackhi_epi16 (a, a), 16);
+      _mm_storeu_ps (dest + i, _mm_mul_ps (_mm_cvtepi32_ps (lo), scale));
+      _mm_storeu_ps (dest + i + 4, _mm_mul_ps (_mm_cvtepi32_ps (hi), scale));
+    }
+  }
+#endif
+  for (; i < n; i++)
+    dest[i] = src[i] * SCALE_S16;
+}
+
+static void
+convert_s32_f32 (const int32_t * src, float *dest, int n, float scale)
+{
+  int i = 0;
+
+#if defined(__ARM_NEON__)
+  for (; i + 4 <= n; i += 4)
+    vst1q_f32 (dest + i, vmulq_n_f32 (vcvtq_f32_s32 (vld1q_s32 (src + i)),
+            scale));
+#elif defined(__SSE2__)
+  {
+    const __m128 vscale = _mm_set1_ps (scale);
+
+    for (; i + 4 <= n; i += 4)
+      _mm_storeu_ps (dest + i, _mm_mul_ps (_mm_cvtepi32_ps (_mm_loadu_si128 (
+                      (const __m128i *) (src + i))), vscale));
+  }
+#endif
+  for (; i < n; i++)
+    dest[i] = src[i] * scale;
+}
+
+static void
+convert_s24_3_f32 (const uint8_t * src, float *dest, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    dest[i] = read_s24_3 (src + 3 * i) * SCALE_S24;
+}
+
+/* downmix frames of channels into stereo, the weights come from
+ * get_downmix() */
+static void
+downmix_f32 (const float *src, float *dest, int frames, int channels,
+    const float *left, const float *right)
+{
+  int i, c;
+
+  for (i = 0; i < frames; i++) {
+    float l = 0.0f;
+    float r = 0.0f;
+
+    for (c = 0; c < channels; c++) {
+      l += src[c] * left[c];
+      r += src[c] * right[c];
+    }
+    dest[2 * i] = l;
+    dest[2 * i + 1] = r;
+    src += channels;
+  }
+}
+
+void
+audioflinger_convert (AudioFlingerConvertFormat format, int channels,
+    const void *src, int16_t * dest, int frames)
+{
+  float left[AUDIOFLINGER_CONVERT_MAX_CHANNELS];
+  float right[AUDIOFLINGER_CONVERT_MAX_CHANNELS];
+  float block[CONVERT_BLOCK_FRAMES * AUDIOFLINGER_CONVERT_MAX_CHANNELS];
+  float stereo[CONVERT_BLOCK_FRAMES * 2];
+  const uint8_t *in = (const uint8_t *) src;
+  int sample_size = audioflinger_convert_sample_size (format);
+
+  if (frames <= 0)
+    return;
+
+  /* no downmix, convert samples in one pass */
+  if (channels <= 2) {
+    int n = frames * channels;
+
+    switch (format) {
+      case AUDIOFLINGER_CONVERT_S24_32:
+        convert_s24_32_s16 ((const int32_t *) src, dest, n);
+        break;
+      case AUDIOFLINGER_CONVERT_S24_3:
+        convert_s24_3_s16 (in, dest, n);
+        break;
+      case AUDIOFLINGER_CONVERT_S32:
+        convert_s32_s16 ((const int32_t *) src, dest, n);
+        break;
+      case AUDIOFLINGER_CONVERT_F32:
+        convert_f32_s16 ((const float *) src, dest, n);
+        break;
+      default:
+        memcpy (dest, src, n * sizeof (int16_t));
+        break;
+    }
+    return;
+  }
+
+  /* convert a block to float, downmix it, and convert it back to S16 */
+  get_downmix (channels, left, right);
+  while (frames > 0) {
+    int count = (frames < CONVERT_BLOCK_FRAMES) ? frames :
+        CONVERT_BLOCK_FRAMES;
+    int n = count * channels;
+    const float *samples = block;
+
+    switch (format) {
+      case AUDIOFLINGER_CONVERT_S24_32:
+        convert_s32_f32 ((const int32_t *) in, block, n, SCALE_S24);
+        break;
+      case AUDIOFLINGER_CONVERT_S24_3:
+        convert_s24_3_f32 (in, block, n);
+        break;
+      case AUDIOFLINGER_CONVERT_S32:
+        convert_s32_f32 ((const int32_t *) in, block, n, SCALE_S32);
+        break;
+      case AUDIOFLINGER_CONVERT_F32:
+        samples = (const float *) in;
+        break;
+      default:
+        convert_s16_f32 ((const int16_t *) in, block, n);
+        break;
+    }
+    downmix_f32 (samples, stereo, count, channels, left, right);
+    convert_f32_s16 (stereo, dest, 2 * count);
+
+    in += n * sample_size;
+    dest += 2 * count;
+    frames -= count;
+  }
+}
+
+void
+audioflinger_convert_ref (AudioFlingerConvertFormat format, int channels,
+    const void *src, int16_t * dest, int frames)
+{
+  float left[AUDIOFLINGER_CONVERT_MAX_CHANNELS];
+  float right[AUDIOFLINGER_CONVERT_MAX_CHANNELS];
+  const uint8_t *in = (const uint8_t *) src;
+  int sample_size = audioflinger_convert_sample_size (format);
+  int i, c;
+
+  if (channels > 2)
+    get_downmix (channels, left, right);
+
+  for (i = 0; i < frames; i++) {
+    float l = 0.0f;
+    float r = 0.0f;
+
+    for (c = 0; c < channels; c++) {
+      const uint8_t *p = in + (i * channels + c) * sample_size;
+      int16_t s16;
+      float f;
+
+      switch (format) {
+        case AUDIOFLINGER_CONVERT_S24_32:
+          s16 = sat16 (*(const int32_t *) p >> 8);
+          f = *(const int32_t *) p * SCALE_S24;
+          break;
+        case AUDIOFLINGER_CONVERT_S24_3:
+          s16 = (int16_t) (read_s24_3 (p) >> 8);
+          f = read_s24_3 (p) * SCALE_S24;
+          break;
+        case AUDIOFLINGER_CONVERT_S32:
+          s16 = (int16_t) (*(const int32_t *) p >> 16);
+          f = *(const int32_t *) p * SCALE_S32;
+          break;
+        case AUDIOFLINGER_CONVERT_F32:
+          s16 = float_to_s16 (*(const float *) p);
+          f = *(const float *) p;
+          break;
+        default:
+          s16 = *(const int16_t *) p;
+          f = s16 * SCALE_S16;
+          break;
+      }
+
+      if (channels <= 2) {
+        dest[i * channels + c] = s16;
+      } else {
+        l += f * left[c];
+        r += f * right[c];
+      }
+    }
+    if (channels > 2) {
+      dest[2 * i] = float_to_s16 (l);
+      dest[2 * i + 1] = float_to_s16 (r);
+    }
+  }
+}
@@ -0,0 +1,68 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * This file defines APIs to convert native endian PCM samples into the
+ * signed 16 bit mono or stereo samples of AudioTrack, with NEON or SSE2
+ * kernels when they are available.
+ */
+#ifndef __AUDIOFLINGER_CONVERT_H__
+#define __AUDIOFLINGER_CONVERT_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  AUDIOFLINGER_CONVERT_NONE,    /* S16, 1 or 2 channels, no conversion */
+  AUDIOFLINGER_CONVERT_S16,     /* S16, downmixed */
+  AUDIOFLINGER_CONVERT_S24_32,  /* S24 in 32 bits */
+  AUDIOFLINGER_CONVERT_S24_3,   /* packed S24 */
+  AUDIOFLINGER_CONVERT_S32,
+  AUDIOFLINGER_CONVERT_F32,
+} AudioFlingerConvertFormat;
+
+/* the most channels which can be downmixed */
+#define AUDIOFLINGER_CONVERT_MAX_CHANNELS 8
+
+/* bytes of one input sample */
+int audioflinger_convert_sample_size (AudioFlingerConvertFormat format);
+
+/* output channels for channels of input: 1 or 2 */
+int audioflinger_convert_out_channels (int channels);
+
+/*
+ * Convert frames of input with channels into S16 output frames. More than 2
+ * channels are downmixed to stereo, taking the default positions of
+ * channels: FL FR FC LFE RL RR SL SR, see downmix_layouts.
+ */
+void audioflinger_convert (AudioFlingerConvertFormat format, int channels,
+    const void *src, int16_t *dest, int frames);
+
+/* scalar reference of audioflinger_convert() */
+void audioflinger_convert_ref (AudioFlingerConvertFormat format,
+    int channels, const void *src, int16_t *dest, int frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AUDIOFLINGER_CONVERT_H__ */
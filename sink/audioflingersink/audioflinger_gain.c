@@ -0,0 +1,280 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include <math.h>
+#include "audioflinger_gain.h"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* constant gain is applied in Q12 */
+#define GAIN_SHIFT 12
+#define GAIN_ONE (1 << GAIN_SHIFT)
+
+/* log ramps start from or end at -60 dB instead of silence */
+#define LOG_RAMP_FLOOR 0.001f
+
+static inline int16_t
+sat16 (int32_t v)
+{
+  if (v > 32767)
+    return 32767;
+  if (v < -32768)
+    return -32768;
+  return (int16_t) v;
+}
+
+static inline int
+gain_to_q12 (float value)
+{
+  return (int) (value * GAIN_ONE + 0.5f);
+}
+
+void
+audioflinger_gain_init (AudioFlingerGain * gain, float value)
+{
+  gain->gain = value;
+  gain->target = value;
+  gain->step = 0.0f;
+  gain->ramp_frames = 0;
+  gain->shape = AUDIOFLINGER_RAMP_LINEAR;
+}
+
+void
+audioflinger_gain_set (AudioFlingerGain * gain, float target, int frames,
+    AudioFlingerRampShape shape)
+{
+  if (target < 0.0f)
+    target = 0.0f;
+  if (target > AUDIOFLINGER_GAIN_MAX)
+    target = AUDIOFLINGER_GAIN_MAX;
+
+  gain->target = target;
+  gain->shape = shape;
+  if (frames <= 0 || target == gain->gain) {
+    gain->gain = target;
+    gain->ramp_frames = 0;
+    return;
+  }
+
+  /* a new ramp starts from where the current one is */
+  if (shape == AUDIOFLINGER_RAMP_LOG) {
+    float from = (gain->gain > LOG_RAMP_FLOOR) ? gain->gain : LOG_RAMP_FLOOR;
+    float to = (target > LOG_RAMP_FLOOR) ? target : LOG_RAMP_FLOOR;
+
+    gain->gain = from;
+    gain->step = powf (to / from, 1.0f / frames);
+  } else {
+    gain->step = (target - gain->gain) / frames;
+  }
+  gain->ramp_frames = frames;
+}
+
+int
+audioflinger_gain_is_unity (const AudioFlingerGain * gain)
+{
+  return gain->ramp_frames == 0 && gain_to_q12 (gain->gain) == GAIN_ONE;
+}
+
+/* constant gain in Q12, 8 samples at a time with SIMD */
+static void
+apply_constant (int q, int16_t * samples, int n)
+{
+  int i = 0;
+
+#if defined(__ARM_NEON__)
+  {
+    const int16x4_t g = vdup_n_s16 ((int16_t) q);
+
+    for (; i + 8 <= n; i += 8) {
+      int16x8_t a = vld1q_s16 (samples + i);
+      int32x4_t lo = vmull_s16 (vget_low_s16 (a), g);
+      int32x4_t hi = vmull_s16 (vget_high_s16 (a), g);
+      vst1q_s16 (samples + i, vcombine_s16 (vqrshrn_n_s32 (lo, GAIN_SHIFT),
+              vqrshrn_n_s32 (hi, GAIN_SHIFT)));
+    }
+  }
+#elif defined(__SSE2__)
+  {
+    const __m128i g = _mm_set1_epi16 ((int16_t) q);
+    const __m128i round = _mm_set1_epi32 (1 << (GAIN_SHIFT - 1));
+
+    for (; i + 8 <= n; i += 8) {
+      __m128i a = _mm_loadu_si128 ((const __m128i *) (samples + i));
+      __m128i plo = _mm_mullo_epi16 (a, g);
+      __m128i phi = _mm_mulhi_epi16 (a, g);
+      /* interleave low and high halves into 32 bit products */
+      __m128i lo = _mm_add_epi32 (_mm_unpacklo_epi16 (plo, phi), round);
+      __m128i hi = _mm_add_epi32 (_mm_unpackhi_epi16 (plo, phi), round);
+      _mm_storeu_si128 ((__m128i *) (samples + i),
+          _mm_packs_epi32 (_mm_srai_epi32 (lo, GAIN_SHIFT),
+              _mm_srai_epi32 (hi, GAIN_SHIFT)));
+    }
+  }
+#endif
+  for (; i < n; i++)
+    samples[i] = sat16 ((samples[i] * q + (1 << (GAIN_SHIFT - 1))) >>
+        GAIN_SHIFT);
+}
+
+void
+audioflinger_gain_apply (AudioFlingerGain * gain, int16_t * samples,
+    int frames, int channels)
+{
+  int q;
+  int c;
+
+  /* ramps change gain every frame, they are short so they stay scalar */
+  while (frames > 0 && gain->ramp_frames > 0) {
+    for (c = 0; c < channels; c++)
+      samples[c] = sat16 ((int32_t) floorf (samples[c] * gain->gain + 0.5f));
+    samples += channels;
+    frames--;
+
+    if (--gain->ramp_frames == 0)
+      gain->gain = gain->target;
+    else if (gain->shape == AUDIOFLINGER_RAMP_LOG)
+      gain->gain *= gain->step;
+    else
+      gain->gain += gain->step;
+  }
+  if (frames <= 0)
+    return;
+
+  q = gain_to_q12 (gain->gain);
+  if (q == GAIN_ONE)
+    return;
+  if (q == 0)
+    memset (samples, 0, frames * channels * sizeof (int16_t));
+  else
+    apply_constant (q, samples, frames * channels);
+}
+
+void
+audioflinger_gain_apply_ref (float value, int16_t * samples, int n)
+{
+  int q = gain_to_q12 (value);
+  int i;
+
+  for (i = 0; i < n; i++)
+    samples[i] = sat16 ((samples[i] * q + (1 << (GAIN_SHIFT - 1))) >>
+        GAIN_SHIFT);
+}
+
+static inline int
+clamp_gain (float value)
+{
+  if (value < 0.0f)
+    value = 0.0f;
+  if (value > AUDIOFLINGER_GAIN_MAX)
+    value = AUDIOFLINGER_GAIN_MAX;
+  return gain_to_q12 (value);
+}
+
+/* products of gains in Q12 are saturated, then added with saturation, 8
+ * samples at a time with SIMD. Gains alternate left and right. */
+static void
+mix_constant (int16_t * dst, const int16_t * src, int n, int ql, int qr)
+{
+  int i = 0;
+
+#if defined(__ARM_NEON__)
+  {
+    const int16_t pattern[4] = { ql, qr, ql, qr };
+    const int16x4_t g = vld1_s16 (pattern);
+
+    if (ql == GAIN_ONE && qr == GAIN_ONE) {
+      for (; i + 8 <= n; i += 8)
+        vst1q_s16 (dst + i, vqaddq_s16 (vld1q_s16 (dst + i),
+                vld1q_s16 (src + i)));
+    } else {
+      for (; i + 8 <= n; i += 8) {
+        int16x8_t a = vld1q_s16 (src + i);
+        int32x4_t lo = vmull_s16 (vget_low_s16 (a), g);
+        int32x4_t hi = vmull_s16 (vget_high_s16 (a), g);
+        int16x8_t scaled = vcombine_s16 (vqrshrn_n_s32 (lo, GAIN_SHIFT),
+            vqrshrn_n_s32 (hi, GAIN_SHIFT));
+        vst1q_s16 (dst + i, vqaddq_s16 (vld1q_s16 (dst + i), scaled));
+      }
+    }
+  }
+#elif defined(__SSE2__)
+  {
+    const __m128i g = _mm_set_epi16 (qr, ql, qr, ql, qr, ql, qr, ql);
+    const __m128i round = _mm_set1_epi32 (1 << (GAIN_SHIFT - 1));
+
+    if (ql == GAIN_ONE && qr == GAIN_ONE) {
+      for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128 ((const __m128i *) (src + i));
+        __m128i d = _mm_loadu_si128 ((const __m128i *) (dst + i));
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_adds_epi16 (d, a));
+      }
+    } else {
+      for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128 ((const __m128i *) (src + i));
+        __m128i d = _mm_loadu_si128 ((const __m128i *) (dst + i));
+        __m128i plo = _mm_mullo_epi16 (a, g);
+        __m128i phi = _mm_mulhi_epi16 (a, g);
+        __m128i lo = _mm_add_epi32 (_mm_unpacklo_epi16 (plo, phi), round);
+        __m128i hi = _mm_add_epi32 (_mm_unpackhi_epi16 (plo, phi), round);
+        __m128i scaled = _mm_packs_epi32 (_mm_srai_epi32 (lo, GAIN_SHIFT),
+            _mm_srai_epi32 (hi, GAIN_SHIFT));
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_adds_epi16 (d, scaled));
+      }
+    }
+  }
+#endif
+  /* i is even here, so the tail starts on a left sample */
+  for (; i < n; i++) {
+    int q = (i & 1) ? qr : ql;
+    dst[i] = sat16 (dst[i] + sat16 ((src[i] * q + (1 << (GAIN_SHIFT - 1))) >>
+            GAIN_SHIFT));
+  }
+}
+
+void
+audioflinger_gain_mix (int16_t * dst, const int16_t * src, int frames,
+    int channels, float left, float right)
+{
+  int ql = clamp_gain (left);
+  int qr = (channels == 2) ? clamp_gain (right) : ql;
+
+  if (frames <= 0 || (ql == 0 && qr == 0))
+    return;
+  mix_constant (dst, src, frames * channels, ql, qr);
+}
+
+void
+audioflinger_gain_mix_ref (int16_t * dst, const int16_t * src, int frames,
+    int channels, float left, float right)
+{
+  int ql = clamp_gain (left);
+  int qr = (channels == 2) ? clamp_gain (right) : ql;
+  int i;
+
+  for (i = 0; i < frames * channels; i++) {
+    int q = (channels == 2 && (i & 1)) ? qr : ql;
+    dst[i] = sat16 (dst[i] + sat16 ((src[i] * q + (1 << (GAIN_SHIFT - 1))) >>
+            GAIN_SHIFT));
+  }
+}
@@ -0,0 +1,79 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * This file defines a software gain stage of S16 samples, gain changes
+ * ramp frame by frame so that they don't click. Sources are mixed with gain
+ * of their own.
+ */
+#ifndef __AUDIOFLINGER_GAIN_H__
+#define __AUDIOFLINGER_GAIN_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  AUDIOFLINGER_RAMP_LINEAR,     /* constant step of gain */
+  AUDIOFLINGER_RAMP_LOG,        /* constant step in dB */
+} AudioFlingerRampShape;
+
+/* the largest gain, it shall fit in Q12 of 16 bits */
+#define AUDIOFLINGER_GAIN_MAX 7.99f
+
+typedef struct {
+  float gain;                   /* gain of the next frame */
+  float target;
+  float step;                   /* added, or multiplied for log ramps */
+  int ramp_frames;              /* frames left to reach target */
+  AudioFlingerRampShape shape;
+} AudioFlingerGain;
+
+void audioflinger_gain_init (AudioFlingerGain * gain, float value);
+
+/* ramp to target in frames, at once if frames is 0 */
+void audioflinger_gain_set (AudioFlingerGain * gain, float target,
+    int frames, AudioFlingerRampShape shape);
+
+/* nothing to do: gain is 1 and not ramping */
+int audioflinger_gain_is_unity (const AudioFlingerGain * gain);
+
+/* apply gain to frames of interleaved samples in place */
+void audioflinger_gain_apply (AudioFlingerGain * gain, int16_t * samples,
+    int frames, int channels);
+
+/* scalar reference of a constant gain */
+void audioflinger_gain_apply_ref (float value, int16_t * samples, int n);
+
+/* add frames of interleaved src scaled by a constant gain to dst, with
+ * saturation. Stereo gets left and right gains, mono gets left. */
+void audioflinger_gain_mix (int16_t * dst, const int16_t * src, int frames,
+    int channels, float left, float right);
+
+/* scalar reference of audioflinger_gain_mix() */
+void audioflinger_gain_mix_ref (int16_t * dst, const int16_t * src,
+    int frames, int channels, float left, float right);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AUDIOFLINGER_GAIN_H__ */
@@ -0,0 +1,288 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "audioflinger_resample.h"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Output frame n is at input time n * M / L, where L / M is out_rate /
+ * in_rate reduced. Each of the L phases has its own set of taps, so a
+ * frame is one dot product of taps input samples.
+ */
+#define MAX_PHASES 1024
+#define MAX_CHANNELS 2
+/* the passband ends a bit below nyquist, to leave room for roll off */
+#define CUTOFF 0.93
+
+#define COEF_SHIFT 15
+
+struct _AudioFlingerResampler
+{
+  int channels;
+  int L;
+  int M;
+  int taps;
+  /* L * taps coefficients in Q15, phase by phase */
+  int16_t *coefs;
+  /* input of each channel, deinterleaved: taps / 2 samples of silence
+   * before the first one, so that filters are centered */
+  int16_t *history[MAX_CHANNELS];
+  int history_len;
+  int history_size;
+  /* first sample of the next output frame in history, and its phase */
+  int pos;
+  int phase;
+};
+
+static int
+gcd (int a, int b)
+{
+  while (b) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+static inline int16_t
+sat16 (int32_t v)
+{
+  if (v > 32767)
+    return 32767;
+  if (v < -32768)
+    return -32768;
+  return (int16_t) v;
+}
+
+/* Blackman windowed sinc, x in input samples, 0 beyond half taps */
+static double
+filter (double x, double fc, int taps)
+{
+  double u = x / (taps / 2);
+  double w, s;
+
+  if (u <= -1.0 || u >= 1.0)
+    return 0.0;
+  w = 0.42 + 0.5 * cos (M_PI * u) + 0.08 * cos (2 * M_PI * u);
+  s = (x == 0.0) ? 1.0 : sin (M_PI * fc * x) / (M_PI * fc * x);
+  return fc * s * w;
+}
+
+static void
+design (AudioFlingerResampler * resampler)
+{
+  int L = resampler->L;
+  int taps = resampler->taps;
+  /* downsampling shall also remove what's above the output nyquist */
+  double fc = CUTOFF * ((L < resampler->M) ? (double) L / resampler->M : 1.0);
+  double h[32];
+  int p, k;
+
+  for (p = 0; p < L; p++) {
+    double sum = 0.0;
+
+    for (k = 0; k < taps; k++) {
+      h[k] = filter ((double) p / L + taps / 2 - k, fc, taps);
+      sum += h[k];
+    }
+    /* unity gain at DC for every phase */
+    for (k = 0; k < taps; k++) {
+      double c = h[k] / sum * (1 << COEF_SHIFT);
+      resampler->coefs[p * taps + k] = sat16 ((int32_t) floor (c + 0.5));
+    }
+  }
+}
+
+AudioFlingerResampler *
+audioflinger_resampler_new (int channels, int in_rate, int out_rate,
+    AudioFlingerResampleQuality quality)
+{
+  AudioFlingerResampler *resampler;
+  int d, c;
+
+  if (quality == AUDIOFLINGER_RESAMPLE_NONE || channels < 1 ||
+      channels > MAX_CHANNELS || in_rate <= 0 || out_rate <= 0)
+    return NULL;
+
+  d = gcd (in_rate, out_rate);
+  if (out_rate / d > MAX_PHASES)
+    return NULL;
+
+  resampler = calloc (1, sizeof (AudioFlingerResampler));
+  if (resampler == NULL)
+    return NULL;
+  resampler->channels = channels;
+  resampler->L = out_rate / d;
+  resampler->M = in_rate / d;
+  resampler->taps = 8 << (quality - AUDIOFLINGER_RESAMPLE_LOW);
+  resampler->coefs = malloc (resampler->L * resampler->taps *
+      sizeof (int16_t));
+  resampler->history_size = 4096;
+  for (c = 0; c < channels; c++)
+    resampler->history[c] = malloc (resampler->history_size *
+        sizeof (int16_t));
+  if (resampler->coefs == NULL || resampler->history[0] == NULL ||
+      resampler->history[channels - 1] == NULL) {
+    audioflinger_resampler_free (resampler);
+    return NULL;
+  }
+
+  design (resampler);
+  audioflinger_resampler_reset (resampler);
+  return resampler;
+}
+
+void
+audioflinger_resampler_free (AudioFlingerResampler * resampler)
+{
+  int c;
+
+  if (resampler == NULL)
+    return;
+  for (c = 0; c < MAX_CHANNELS; c++)
+    free (resampler->history[c]);
+  free (resampler->coefs);
+  free (resampler);
+}
+
+void
+audioflinger_resampler_reset (AudioFlingerResampler * resampler)
+{
+  int c;
+
+  for (c = 0; c < resampler->channels; c++)
+    memset (resampler->history[c], 0, resampler->taps / 2 * sizeof (int16_t));
+  resampler->history_len = resampler->taps / 2;
+  resampler->pos = 0;
+  resampler->phase = 0;
+}
+
+int
+audioflinger_resampler_max_out (AudioFlingerResampler * resampler,
+    int in_frames)
+{
+  /* every output frame moves at least M / L input frames on */
+  return (int) ((int64_t) (resampler->history_len + in_frames) *
+      resampler->L / resampler->M) + 1;
+}
+
+/* taps is a multiple of 8 */
+static inline int16_t
+dot (const int16_t * x, const int16_t * c, int taps)
+{
+  int32_t sum;
+  int k;
+
+#if defined(__ARM_NEON__)
+  int32x4_t acc = vdupq_n_s32 (0);
+  int64x2_t pair;
+
+  for (k = 0; k < taps; k += 8) {
+    int16x8_t a = vld1q_s16 (x + k);
+    int16x8_t b = vld1q_s16 (c + k);
+    acc = vmlal_s16 (acc, vget_low_s16 (a), vget_low_s16 (b));
+    acc = vmlal_s16 (acc, vget_high_s16 (a), vget_high_s16 (b));
+  }
+  pair = vpaddlq_s32 (acc);
+  sum = (int32_t) (vgetq_lane_s64 (pair, 0) + vgetq_lane_s64 (pair, 1));
+#elif defined(__SSE2__)
+  __m128i acc = _mm_setzero_si128 ();
+
+  for (k = 0; k < taps; k += 8) {
+    __m128i a = _mm_loadu_si128 ((const __m128i *) (x + k));
+    __m128i b = _mm_loadu_si128 ((const __m128i *) (c + k));
+    acc = _mm_add_epi32 (acc, _mm_madd_epi16 (a, b));
+  }
+  acc = _mm_add_epi32 (acc, _mm_shuffle_epi32 (acc, _MM_SHUFFLE (1, 0, 3, 2)));
+  acc = _mm_add_epi32 (acc, _mm_shuffle_epi32 (acc, _MM_SHUFFLE (2, 3, 0, 1)));
+  sum = _mm_cvtsi128_si32 (acc);
+#else
+  sum = 0;
+  for (k = 0; k < taps; k++)
+    sum += x[k] * c[k];
+#endif
+
+  return sat16 ((sum + (1 << (COEF_SHIFT - 1))) >> COEF_SHIFT);
+}
+
+int
+audioflinger_resampler_process (AudioFlingerResampler * resampler,
+    const int16_t * in, int in_frames, int16_t * out)
+{
+  int channels = resampler->channels;
+  int taps = resampler->taps;
+  int n = 0;
+  int consumed;
+  int i, c;
+
+  /* append input to history */
+  if (resampler->history_len + in_frames > resampler->history_size) {
+    int size = resampler->history_len + in_frames;
+
+    for (c = 0; c < channels; c++) {
+      int16_t *history = realloc (resampler->history[c],
+          size * sizeof (int16_t));
+      if (history == NULL)
+        return 0;
+      resampler->history[c] = history;
+    }
+    resampler->history_size = size;
+  }
+  for (c = 0; c < channels; c++) {
+    int16_t *history = resampler->history[c] + resampler->history_len;
+    for (i = 0; i < in_frames; i++)
+      history[i] = in[i * channels + c];
+  }
+  resampler->history_len += in_frames;
+
+  while (resampler->pos + taps <= resampler->history_len) {
+    const int16_t *coefs = resampler->coefs + resampler->phase * taps;
+
+    for (c = 0; c < channels; c++)
+      out[n * channels + c] = dot (resampler->history[c] + resampler->pos,
+          coefs, taps);
+    n++;
+
+    resampler->phase += resampler->M;
+    resampler->pos += resampler->phase / resampler->L;
+    resampler->phase %= resampler->L;
+  }
+
+  /* drop input which no output frame needs any more */
+  consumed = (resampler->pos < resampler->history_len) ? resampler->pos :
+      resampler->history_len;
+  if (consumed > 0) {
+    for (c = 0; c < channels; c++)
+      memmove (resampler->history[c], resampler->history[c] + consumed,
+          (resampler->history_len - consumed) * sizeof (int16_t));
+    resampler->history_len -= consumed;
+    resampler->pos -= consumed;
+  }
+
+  return n;
+}
@@ -0,0 +1,65 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * This file defines a polyphase resampler of S16 mono or stereo samples,
+ * used to play at the native rate of AudioFlinger's mixer, which then
+ * doesn't resample the track itself.
+ */
+#ifndef __AUDIOFLINGER_RESAMPLE_H__
+#define __AUDIOFLINGER_RESAMPLE_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  AUDIOFLINGER_RESAMPLE_NONE,   /* no resampling */
+  AUDIOFLINGER_RESAMPLE_LOW,    /* 8 taps per phase */
+  AUDIOFLINGER_RESAMPLE_MEDIUM, /* 16 taps per phase */
+  AUDIOFLINGER_RESAMPLE_HIGH,   /* 32 taps per phase */
+} AudioFlingerResampleQuality;
+
+typedef struct _AudioFlingerResampler AudioFlingerResampler;
+
+/* NULL if quality is none, or the rates need too many phases */
+AudioFlingerResampler *audioflinger_resampler_new (int channels,
+    int in_rate, int out_rate, AudioFlingerResampleQuality quality);
+
+void audioflinger_resampler_free (AudioFlingerResampler * resampler);
+
+/* forget the input history, e.g. on flush */
+void audioflinger_resampler_reset (AudioFlingerResampler * resampler);
+
+/* the most frames process() outputs for in_frames */
+int audioflinger_resampler_max_out (AudioFlingerResampler * resampler,
+    int in_frames);
+
+/* resample in_frames of interleaved input, return the frames written to
+ * out, which shall have room for audioflinger_resampler_max_out() */
+int audioflinger_resampler_process (AudioFlingerResampler * resampler,
+    const int16_t * in, int in_frames, int16_t * out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AUDIOFLINGER_RESAMPLE_H__ */
@@ -0,0 +1,396 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "audioflinger_stretch.h"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Every segment is stride frames of output. Its first overlap frames are
+ * crossfaded with the overlap frames which followed the previous segment in
+ * input, then the rest is copied. The nominal start of segments moves on
+ * by stride * tempo input frames, and each one starts at the offset of
+ * [0, search) after it which correlates best with the previous segment.
+ */
+#define MAX_STRIDE_MS 200
+#define MAX_SEARCH_MS 50
+#define MIN_TEMPO 0.25
+#define MAX_TEMPO 4.0
+
+/* reference of search is scaled down to 12 bits, so that 32 products fit
+ * in an int32 accumulator */
+#define REF_SHIFT 18
+#define CORRELATE_BLOCK 32
+
+#define FADE_SHIFT 15
+#define FADE_ONE (1 << FADE_SHIFT)
+
+struct _AudioFlingerStretch
+{
+  int channels;
+  int stride;
+  int overlap;
+  int search;
+  int step;
+  double tempo;
+  /* input not consumed yet, interleaved, queue_len frames from head */
+  int16_t *queue;
+  int head;
+  int queue_len;
+  int queue_size;
+  /* input frames to drop before the next segment, and the fraction of a
+   * frame carried to the one after */
+  int skip;
+  double skip_frac;
+  /* overlap frames following the previous segment, and the same windowed
+   * as reference of search. have_prev is 0 before the first segment */
+  int16_t *prev;
+  int16_t *ref;
+  int have_prev;
+  /* Q15 weights: fade in of crossfade, and window of reference */
+  int16_t *fade;
+  int16_t *window;
+};
+
+static inline int
+clamp_int (int v, int min, int max)
+{
+  return (v < min) ? min : (v > max) ? max : v;
+}
+
+AudioFlingerStretch *
+audioflinger_stretch_new (int channels, int rate, int stride_ms,
+    int search_ms)
+{
+  AudioFlingerStretch *stretch;
+  int i;
+
+  if (channels < 1 || channels > AUDIOFLINGER_STRETCH_MAX_CHANNELS ||
+      rate <= 0 || stride_ms < 4 || stride_ms > MAX_STRIDE_MS ||
+      search_ms < 1 || search_ms > MAX_SEARCH_MS)
+    return NULL;
+
+  stretch = calloc (1, sizeof (AudioFlingerStretch));
+  if (stretch == NULL)
+    return NULL;
+  stretch->channels = channels;
+  stretch->stride = (int) ((int64_t) rate * stride_ms / 1000);
+  stretch->overlap = stretch->stride / 4;
+  stretch->search = (int) ((int64_t) rate * search_ms / 1000);
+  if (stretch->overlap < 1 || stretch->search < 1) {
+    free (stretch);
+    return NULL;
+  }
+  stretch->step = 1;
+  stretch->tempo = 1.0;
+  stretch->queue_size = 2 * (stretch->search + stretch->stride +
+      stretch->overlap);
+  stretch->queue = malloc (stretch->queue_size * channels * sizeof (int16_t));
+  stretch->prev = malloc (stretch->overlap * channels * sizeof (int16_t));
+  stretch->ref = malloc (stretch->overlap * channels * sizeof (int16_t));
+  stretch->fade = malloc (stretch->overlap * sizeof (int16_t));
+  stretch->window = malloc (stretch->overlap * sizeof (int16_t));
+  if (stretch->queue == NULL || stretch->prev == NULL ||
+      stretch->ref == NULL || stretch->fade == NULL ||
+      stretch->window == NULL) {
+    audioflinger_stretch_free (stretch);
+    return NULL;
+  }
+
+  /* linear crossfade, and a parabolic window which weighs the middle of
+   * the overlap the most */
+  for (i = 0; i < stretch->overlap; i++) {
+    int64_t n = stretch->overlap;
+
+    stretch->fade[i] = (int16_t) (((int64_t) i << FADE_SHIFT) / n);
+    stretch->window[i] = (int16_t) ((4 * (int64_t) (i + 1) * (n - i) *
+            (FADE_ONE - 1)) / ((n + 1) * (n + 1)));
+  }
+
+  audioflinger_stretch_reset (stretch);
+  return stretch;
+}
+
+void
+audioflinger_stretch_free (AudioFlingerStretch * stretch)
+{
+  if (stretch == NULL)
+    return;
+  free (stretch->queue);
+  free (stretch->prev);
+  free (stretch->ref);
+  free (stretch->fade);
+  free (stretch->window);
+  free (stretch);
+}
+
+void
+audioflinger_stretch_reset (AudioFlingerStretch * stretch)
+{
+  stretch->head = 0;
+  stretch->queue_len = 0;
+  stretch->skip = 0;
+  stretch->skip_frac = 0.0;
+  stretch->have_prev = 0;
+}
+
+void
+audioflinger_stretch_set_tempo (AudioFlingerStretch * stretch, double tempo)
+{
+  if (tempo < MIN_TEMPO)
+    tempo = MIN_TEMPO;
+  else if (tempo > MAX_TEMPO)
+    tempo = MAX_TEMPO;
+  stretch->tempo = tempo;
+}
+
+void
+audioflinger_stretch_set_step (AudioFlingerStretch * stretch, int step)
+{
+  stretch->step = clamp_int (step, 1, stretch->search);
+}
+
+int
+audioflinger_stretch_get_step (AudioFlingerStretch * stretch)
+{
+  return stretch->step;
+}
+
+int
+audioflinger_stretch_max_out (AudioFlingerStretch * stretch, int in_frames)
+{
+  /* every segment moves at least this far on in input */
+  int advance = (int) (stretch->stride * stretch->tempo);
+
+  if (advance < 1)
+    advance = 1;
+  return ((stretch->queue_len + in_frames) / advance + 1) * stretch->stride;
+}
+
+int64_t
+audioflinger_stretch_correlate_ref (const int16_t * ref, const int16_t * x,
+    int n)
+{
+  int64_t sum = 0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    sum += (int32_t) ref[i] * x[i];
+  return sum;
+}
+
+int64_t
+audioflinger_stretch_correlate (const int16_t * ref, const int16_t * x,
+    int n)
+{
+  int64_t sum = 0;
+  int i = 0;
+
+#if defined(__ARM_NEON__)
+  int64x2_t total = vdupq_n_s64 (0);
+
+  while (i + 8 <= n) {
+    int end = i + CORRELATE_BLOCK;
+    int32x4_t acc = vdupq_n_s32 (0);
+
+    if (end > (n & ~7))
+      end = n & ~7;
+    for (; i < end; i += 8) {
+      int16x8_t a = vld1q_s16 (ref + i);
+      int16x8_t b = vld1q_s16 (x + i);
+      acc = vmlal_s16 (acc, vget_low_s16 (a), vget_low_s16 (b));
+      acc = vmlal_s16 (acc, vget_high_s16 (a), vget_high_s16 (b));
+    }
+    total = vpadalq_s32 (total, acc);
+  }
+  sum = vgetq_lane_s64 (total, 0) + vgetq_lane_s64 (total, 1);
+#elif defined(__SSE2__)
+  __m128i total = _mm_setzero_si128 ();
+  int64_t lanes[2];
+
+  while (i + 8 <= n) {
+    int end = i + CORRELATE_BLOCK;
+    __m128i acc = _mm_setzero_si128 ();
+    __m128i sign;
+
+    if (end > (n & ~7))
+      end = n & ~7;
+    for (; i < end; i += 8) {
+      __m128i a = _mm_loadu_si128 ((const __m128i *) (ref + i));
+      __m128i b = _mm_loadu_si128 ((const __m128i *) (x + i));
+      acc = _mm_add_epi32 (acc, _mm_madd_epi16 (a, b));
+    }
+    /* sign extend to 64 bits */
+    sign = _mm_srai_epi32 (acc, 31);
+    total = _mm_add_epi64 (total, _mm_unpacklo_epi32 (acc, sign));
+    total = _mm_add_epi64 (total, _mm_unpackhi_epi32 (acc, sign));
+  }
+  _mm_storeu_si128 ((__m128i *) lanes, total);
+  sum = lanes[0] + lanes[1];
+#endif
+
+  for (; i < n; i++)
+    sum += (int32_t) ref[i] * x[i];
+  return sum;
+}
+
+/* offset of queued input at which a segment best continues the previous
+ * one */
+static int
+best_offset (AudioFlingerStretch * stretch)
+{
+  const int16_t *start = stretch->queue + stretch->head * stretch->channels;
+  int n = stretch->overlap * stretch->channels;
+  int step = stretch->step;
+  int64_t best_corr = 0;
+  int best = -1;
+  int off, lo, hi;
+
+  for (off = 0; off < stretch->search; off += step) {
+    int64_t corr = audioflinger_stretch_correlate (stretch->ref,
+        start + off * stretch->channels, n);
+    if (best < 0 || corr > best_corr) {
+      best_corr = corr;
+      best = off;
+    }
+  }
+  if (step == 1)
+    return best;
+
+  /* refine around the best of the coarse search */
+  lo = clamp_int (best - step + 1, 0, stretch->search - 1);
+  hi = clamp_int (best + step - 1, 0, stretch->search - 1);
+  for (off = lo; off <= hi; off++) {
+    int64_t corr;
+
+    if (off == best)
+      continue;
+    corr = audioflinger_stretch_correlate (stretch->ref,
+        start + off * stretch->channels, n);
+    if (corr > best_corr) {
+      best_corr = corr;
+      best = off;
+    }
+  }
+  return best;
+}
+
+/* output the segment at off of queued input */
+static void
+output_segment (AudioFlingerStretch * stretch, int off, int16_t * out)
+{
+  int channels = stretch->channels;
+  const int16_t *seg = stretch->queue + (stretch->head + off) * channels;
+  int i, c, done = 0;
+
+  if (stretch->have_prev) {
+    for (i = 0; i < stretch->overlap; i++) {
+      int32_t in = stretch->fade[i];
+      int32_t out_w = FADE_ONE - in;
+
+      for (c = 0; c < channels; c++) {
+        int k = i * channels + c;
+        out[k] = (int16_t) ((stretch->prev[k] * out_w + seg[k] * in +
+                (1 << (FADE_SHIFT - 1))) >> FADE_SHIFT);
+      }
+    }
+    done = stretch->overlap;
+  }
+  memcpy (out + done * channels, seg + done * channels,
+      (stretch->stride - done) * channels * sizeof (int16_t));
+
+  /* what follows the segment in input is what the next one shall match */
+  memcpy (stretch->prev, seg + stretch->stride * channels,
+      stretch->overlap * channels * sizeof (int16_t));
+  for (i = 0; i < stretch->overlap; i++) {
+    for (c = 0; c < channels; c++) {
+      int k = i * channels + c;
+      stretch->ref[k] = (int16_t) (((int32_t) stretch->prev[k] *
+              stretch->window[i]) >> REF_SHIFT);
+    }
+  }
+  stretch->have_prev = 1;
+}
+
+int
+audioflinger_stretch_process (AudioFlingerStretch * stretch,
+    const int16_t * in, int in_frames, int16_t * out)
+{
+  int channels = stretch->channels;
+  int needed = stretch->search + stretch->stride + stretch->overlap;
+  int n = 0;
+
+  while (in_frames > 0 || stretch->queue_len >= needed) {
+    int frames, off;
+    double advance;
+
+    /* drop input skipped by the tempo, without queueing it */
+    if (stretch->skip > 0) {
+      frames = (stretch->skip < stretch->queue_len) ? stretch->skip :
+          stretch->queue_len;
+      stretch->head += frames;
+      stretch->queue_len -= frames;
+      stretch->skip -= frames;
+      if (stretch->skip > 0) {
+        frames = (stretch->skip < in_frames) ? stretch->skip : in_frames;
+        in += frames * channels;
+        in_frames -= frames;
+        stretch->skip -= frames;
+        continue;
+      }
+    }
+
+    /* queue just enough input for the next segment */
+    if (stretch->queue_len < needed) {
+      if (in_frames == 0)
+        break;
+      if (stretch->head + needed > stretch->queue_size) {
+        memmove (stretch->queue, stretch->queue + stretch->head * channels,
+            stretch->queue_len * channels * sizeof (int16_t));
+        stretch->head = 0;
+      }
+      frames = needed - stretch->queue_len;
+      if (frames > in_frames)
+        frames = in_frames;
+      memcpy (stretch->queue + (stretch->head + stretch->queue_len) *
+          channels, in, frames * channels * sizeof (int16_t));
+      stretch->queue_len += frames;
+      in += frames * channels;
+      in_frames -= frames;
+      continue;
+    }
+
+    off = stretch->have_prev ? best_offset (stretch) : 0;
+    output_segment (stretch, off, out + n * channels);
+    n += stretch->stride;
+
+    advance = stretch->stride * stretch->tempo + stretch->skip_frac;
+    stretch->skip = (int) advance;
+    stretch->skip_frac = advance - stretch->skip;
+  }
+
+  return n;
+}
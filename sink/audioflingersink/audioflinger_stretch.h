@@ -0,0 +1,83 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+/*
+ * This file defines a WSOLA time stretcher of S16 interleaved samples. It
+ * changes the tempo of audio without changing its pitch, by cutting input
+ * into overlapping segments, and splicing each one where its waveform is
+ * the most similar to the end of the previous one.
+ */
+#ifndef __AUDIOFLINGER_STRETCH_H__
+#define __AUDIOFLINGER_STRETCH_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AUDIOFLINGER_STRETCH_MAX_CHANNELS 8
+
+typedef struct _AudioFlingerStretch AudioFlingerStretch;
+
+/* segments of stride_ms are output, a quarter of them crossfaded with the
+ * previous one, and spliced at the best of search_ms of offsets. NULL if
+ * the parameters are out of range */
+AudioFlingerStretch *audioflinger_stretch_new (int channels, int rate,
+    int stride_ms, int search_ms);
+
+void audioflinger_stretch_free (AudioFlingerStretch * stretch);
+
+/* forget queued input, e.g. on flush */
+void audioflinger_stretch_reset (AudioFlingerStretch * stretch);
+
+/* input frames per output frame, it takes effect at the next segment */
+void audioflinger_stretch_set_tempo (AudioFlingerStretch * stretch,
+    double tempo);
+
+/* compare every step-th offset first, then the neighbours of the best one.
+ * A larger step costs less cpu, 1 searches every offset */
+void audioflinger_stretch_set_step (AudioFlingerStretch * stretch, int step);
+
+int audioflinger_stretch_get_step (AudioFlingerStretch * stretch);
+
+/* the most frames process() outputs for in_frames */
+int audioflinger_stretch_max_out (AudioFlingerStretch * stretch,
+    int in_frames);
+
+/* stretch in_frames of interleaved input, return the frames written to out,
+ * which shall have room for audioflinger_stretch_max_out() */
+int audioflinger_stretch_process (AudioFlingerStretch * stretch,
+    const int16_t * in, int in_frames, int16_t * out);
+
+/* sum of ref[i] * x[i] of n samples, |ref[i]| shall be below 4096. The
+ * search compares the end of the previous segment with a candidate by it */
+int64_t audioflinger_stretch_correlate (const int16_t * ref,
+    const int16_t * x, int n);
+
+/* scalar reference of audioflinger_stretch_correlate() */
+int64_t audioflinger_stretch_correlate_ref (const int16_t * ref,
+    const int16_t * x, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AUDIOFLINGER_STRETCH_H__ */
@@ -22,7 +22,9 @@
 #include <AudioFlinger.h>
 #include <MediaPlayerInterface.h>
 #include <MediaPlayerService.h>
+#include <pthread.h>
 #include "audioflinger_wrapper.h"
+#include "audioflinger_gain.h"
 #include <glib/glib.h>
 #include <GstLog.h>
 
@@ -33,8 +35,65 @@ typedef struct _AudioFlingerDevice
   AudioTrack* audio_track;
   bool init;
   sp<MediaPlayerBase::AudioSink> audio_sink;
+  // region obtained from the shared buffer of audio_track
+  AudioTrack::Buffer buffer;
+  bool buffer_obtained;
+  // frames written to audio_track, wraps around like its position
+  uint32_t frames_written;
+  // data callback in callback mode
+  AudioFlingerDeviceCallback callback;
+  void* callback_user;
+  // times audio_track ran out of data
+  int underruns;
+  // configuration of the last set, valid if init. Setting the same one
+  // again reuses the track instead of creating a new one.
+  int stream_type;
+  int channel_count;
+  uint32_t sample_rate;
+  int frame_count;
+  bool with_callback;
+  int notification_frames;
+  // a source of the shared mixer instead of a track: stereo frames queued
+  // in fifo, frames_written counts those written and fifo_read those mixed.
+  // They are protected by mixer_mutex.
+  bool mixed;
+  int16_t* fifo;
+  uint32_t fifo_frames;
+  uint32_t fifo_read;
+  bool playing;
+  bool stopped;
+  bool muted;
+  float left;
+  float right;
 } AudioFlingerDevice;
 
+// Shared mixer of a stream type: one AudioTrack at the native rate, whose
+// callback mixes the fifos of its sources. It's created with the first
+// source and deleted with the last one.
+#define MIXER_STREAM_TYPES 10
+#define MIXER_CHANNELS 2
+#define MIXER_DEFAULT_RATE 44100
+
+typedef struct _AudioFlingerMixer
+{
+  AudioTrack* track;
+  uint32_t sample_rate;
+  // devices mixed, protected by mixer_mutex
+  GSList* sources;
+  // track is started, protected by mixer_track_mutex
+  bool started;
+} AudioFlingerMixer;
+
+static AudioFlingerMixer mixers[MIXER_STREAM_TYPES];
+// mixer_mutex guards mixing, it's held in the track's callback thread.
+// mixer_track_mutex serializes creating, starting and deleting tracks,
+// which wait for the callback thread, so mixer_mutex isn't held then. It's
+// also held while a track is read from another thread. It's taken first.
+static pthread_mutex_t mixer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t mixer_track_mutex = PTHREAD_MUTEX_INITIALIZER;
+// signalled when fifos are mixed, flushed, paused or stopped
+static pthread_cond_t mixer_cond = PTHREAD_COND_INITIALIZER;
+
 
 /* commonly used macro */
 #define AUDIO_FLINGER_DEVICE(handle) ((AudioFlingerDevice*)handle)
@@ -66,6 +125,14 @@ AudioFlingerDeviceHandle audioflinger_device_create()
   audiodev->init = false;
   audiodev->audio_track = (AudioTrack *) audiotr;
   audiodev->audio_sink = 0;
+  audiodev->buffer_obtained = false;
+  audiodev->frames_written = 0;
+  audiodev->callback = NULL;
+  audiodev->callback_user = NULL;
+  audiodev->underruns = 0;
+  audiodev->sample_rate = 0;
+  audiodev->mixed = false;
+  audiodev->fifo = NULL;
   GST_PLAYER_DEBUG("Create AudioTrack successfully\n");
 
   return (AudioFlingerDeviceHandle)audiodev;
@@ -90,11 +157,385 @@ AudioFlingerDeviceHandle audioflinger_device_open(void* audio_sink)
   audiodev->audio_track = NULL;
   audiodev->audio_sink = (MediaPlayerBase::AudioSink*)audio_sink;
   audiodev->init = false;
+  audiodev->buffer_obtained = false;
+  audiodev->frames_written = 0;
+  audiodev->callback = NULL;
+  audiodev->callback_user = NULL;
+  audiodev->underruns = 0;
+  audiodev->sample_rate = 0;
+  audiodev->mixed = false;
+  audiodev->fifo = NULL;
   GST_PLAYER_DEBUG("Open AudioSink successfully\n");
 
   return (AudioFlingerDeviceHandle)audiodev;    
 }
 
+AudioFlingerDeviceHandle audioflinger_device_create_mixed()
+{
+  AudioFlingerDevice* audiodev = NULL;
+
+  audiodev = new AudioFlingerDevice;
+  if (audiodev == NULL) {
+    GST_PLAYER_ERROR("Error to create AudioFlingerDevice\n");
+    return NULL;
+  }
+
+  // the track is the mixer's, it's acquired when the device is set
+  audiodev->audio_track = NULL;
+  audiodev->audio_sink = 0;
+  audiodev->init = false;
+  audiodev->buffer_obtained = false;
+  audiodev->frames_written = 0;
+  audiodev->callback = NULL;
+  audiodev->callback_user = NULL;
+  audiodev->underruns = 0;
+  audiodev->sample_rate = 0;
+  audiodev->mixed = true;
+  audiodev->fifo = NULL;
+  audiodev->fifo_frames = 0;
+  audiodev->fifo_read = 0;
+  audiodev->playing = false;
+  audiodev->stopped = false;
+  audiodev->muted = false;
+  audiodev->left = 1.0f;
+  audiodev->right = 1.0f;
+  GST_PLAYER_DEBUG("Create mixed device successfully\n");
+
+  return (AudioFlingerDeviceHandle)audiodev;
+}
+
+int audioflinger_device_mixer_rate (void)
+{
+  int rate = audioflinger_device_native_rate();
+
+  return (rate > 0) ? rate : MIXER_DEFAULT_RATE;
+}
+
+// Mix sources into buffer, in the track's callback thread. A playing source
+// which can't fill the buffer underruns, the rest is silence.
+static void audioflinger_mixer_callback (int event, void* user, void* info)
+{
+  AudioFlingerMixer* mixer = (AudioFlingerMixer*)user;
+  AudioTrack::Buffer* buffer;
+  int16_t* out;
+  uint32_t frames;
+
+  if (event != AudioTrack::EVENT_MORE_DATA)
+    return;
+  buffer = (AudioTrack::Buffer*)info;
+  out = (int16_t*)buffer->raw;
+  frames = buffer->size / (MIXER_CHANNELS * sizeof(int16_t));
+  memset(out, 0, buffer->size);
+
+  pthread_mutex_lock(&mixer_mutex);
+  for (GSList* l = mixer->sources; l != NULL; l = l->next) {
+    AudioFlingerDevice* audiodev = (AudioFlingerDevice*)l->data;
+    uint32_t queued = audiodev->frames_written - audiodev->fifo_read;
+    uint32_t n = (queued < frames) ? queued : frames;
+    uint32_t done = 0;
+
+    if (!audiodev->playing)
+      continue;
+    if (n < frames && audiodev->frames_written != 0)
+      audiodev->underruns++;
+    while (done < n) {
+      uint32_t at = (audiodev->fifo_read + done) & (audiodev->fifo_frames - 1);
+      uint32_t chunk = audiodev->fifo_frames - at;
+
+      if (chunk > n - done)
+        chunk = n - done;
+      if (!audiodev->muted)
+        audioflinger_gain_mix(out + done * MIXER_CHANNELS, 
+            audiodev->fifo + at * MIXER_CHANNELS, chunk, MIXER_CHANNELS, 
+            audiodev->left, audiodev->right);
+      done += chunk;
+    }
+    audiodev->fifo_read += n;
+  }
+  pthread_cond_broadcast(&mixer_cond);
+  pthread_mutex_unlock(&mixer_mutex);
+}
+
+// Start the track of mixer if any of its sources plays, pause it if none
+// does, so an idle mixer doesn't keep AudioFlinger busy
+static void audioflinger_mixer_update (AudioFlingerMixer* mixer)
+{
+  bool playing = false;
+
+  pthread_mutex_lock(&mixer_track_mutex);
+  pthread_mutex_lock(&mixer_mutex);
+  for (GSList* l = mixer->sources; l != NULL; l = l->next) {
+    if (((AudioFlingerDevice*)l->data)->playing)
+      playing = true;
+  }
+  pthread_mutex_unlock(&mixer_mutex);
+
+  if (mixer->track != NULL && playing != mixer->started) {
+    if (playing)
+      mixer->track->start();
+    else
+      mixer->track->pause();
+    mixer->started = playing;
+  }
+  pthread_mutex_unlock(&mixer_track_mutex);
+}
+
+// Remove the device from its mixer, the mixer's track is deleted with its
+// last source
+static void audioflinger_mixer_remove (AudioFlingerDevice* audiodev)
+{
+  AudioFlingerMixer* mixer = &mixers[audiodev->stream_type];
+  AudioTrack* track = NULL;
+
+  pthread_mutex_lock(&mixer_track_mutex);
+  pthread_mutex_lock(&mixer_mutex);
+  mixer->sources = g_slist_remove(mixer->sources, audiodev);
+  audiodev->playing = false;
+  if (mixer->sources == NULL) {
+    track = mixer->track;
+    mixer->track = NULL;
+    mixer->started = false;
+  }
+  pthread_cond_broadcast(&mixer_cond);
+  pthread_mutex_unlock(&mixer_mutex);
+  if (track) {
+    GST_PLAYER_DEBUG("Release mixer of stream type %d\n", 
+        audiodev->stream_type);
+    track->stop();
+    delete track;
+  }
+  pthread_mutex_unlock(&mixer_track_mutex);
+
+  if (track == NULL)
+    audioflinger_mixer_update(mixer);
+}
+
+// Add the device to the mixer of streamType, creating its track for the
+// first source. Return the mixer, NULL if its track can't be created.
+static AudioFlingerMixer* audioflinger_mixer_add (AudioFlingerDevice* audiodev,
+    int streamType)
+{
+  AudioFlingerMixer* mixer = &mixers[streamType];
+  status_t status;
+
+  pthread_mutex_lock(&mixer_track_mutex);
+  if (mixer->track == NULL) {
+    uint32_t rate = audioflinger_device_mixer_rate();
+    AudioTrack* track = new AudioTrack ();
+
+    // the smallest buffer AudioTrack takes, refilled half by half
+    status = track->set(streamType, rate, AudioSystem::PCM_16_BIT, 
+        MIXER_CHANNELS, 0, 0, audioflinger_mixer_callback, mixer, 0);
+    GST_PLAYER_DEBUG("Create mixer of stream type %d, status: %d, "
+        "sampleRate: %d, frameCount: %d\n", streamType, status, rate,
+        track->frameCount());
+    if (status != NO_ERROR) {
+      delete track;
+      pthread_mutex_unlock(&mixer_track_mutex);
+      return NULL;
+    }
+    mixer->sample_rate = rate;
+    mixer->started = false;
+    pthread_mutex_lock(&mixer_mutex);
+    mixer->track = track;
+    pthread_mutex_unlock(&mixer_mutex);
+  }
+  pthread_mutex_lock(&mixer_mutex);
+  mixer->sources = g_slist_prepend(mixer->sources, audiodev);
+  pthread_mutex_unlock(&mixer_mutex);
+  pthread_mutex_unlock(&mixer_track_mutex);
+  return mixer;
+}
+
+// Set a mixed device. Sources are mixed as they are, so they shall be at
+// the mixer's rate. The fifo holds frameCount frames, twice the mixer's
+// track if it's 0, rounded up to a power of 2 so that its index wraps
+// around with the frame counters.
+static int audioflinger_mixer_set (AudioFlingerDevice* audiodev, 
+    int streamType, int channelCount, uint32_t sampleRate, int frameCount)
+{
+  AudioFlingerMixer* mixer;
+  uint32_t fifo_frames;
+
+  if (streamType < 0 || streamType >= MIXER_STREAM_TYPES || 
+      channelCount < 1 || channelCount > MIXER_CHANNELS)
+    return -1;
+
+  if (audiodev->init) {
+    if (audiodev->stream_type == streamType && 
+        audiodev->channel_count == channelCount &&
+        audiodev->sample_rate == sampleRate && 
+        audiodev->frame_count == frameCount) {
+      GST_PLAYER_DEBUG("Reuse mixed device, sampleRate: %d, "
+          "channelCount: %d\n", sampleRate, channelCount);
+      pthread_mutex_lock(&mixer_mutex);
+      audiodev->playing = false;
+      audiodev->stopped = true;
+      audiodev->frames_written = 0;
+      audiodev->fifo_read = 0;
+      audiodev->underruns = 0;
+      pthread_cond_broadcast(&mixer_cond);
+      pthread_mutex_unlock(&mixer_mutex);
+      audioflinger_mixer_update(&mixers[streamType]);
+      return 0;
+    }
+    audiodev->init = false;
+    audioflinger_mixer_remove(audiodev);
+  }
+
+  mixer = audioflinger_mixer_add(audiodev, streamType);
+  if (mixer == NULL)
+    return -1;
+  audiodev->stream_type = streamType;
+  if (sampleRate != mixer->sample_rate) {
+    GST_PLAYER_ERROR("Mixed device shall be at %d, not %d\n", 
+        mixer->sample_rate, sampleRate);
+    audioflinger_mixer_remove(audiodev);
+    return -1;
+  }
+
+  if (frameCount <= 0)
+    frameCount = 2 * mixer->track->frameCount();
+  for (fifo_frames = 1; fifo_frames < (uint32_t)frameCount; fifo_frames <<= 1)
+    ;
+  pthread_mutex_lock(&mixer_mutex);
+  g_free(audiodev->fifo);
+  audiodev->fifo = g_new0(int16_t, fifo_frames * MIXER_CHANNELS);
+  audiodev->fifo_frames = fifo_frames;
+  audiodev->fifo_read = 0;
+  audiodev->frames_written = 0;
+  audiodev->underruns = 0;
+  audiodev->playing = false;
+  audiodev->stopped = false;
+  pthread_mutex_unlock(&mixer_mutex);
+
+  audiodev->channel_count = channelCount;
+  audiodev->sample_rate = sampleRate;
+  audiodev->frame_count = frameCount;
+  audiodev->init = true;
+  GST_PLAYER_DEBUG("Set mixed device, streamType: %d, sampleRate: %d, "
+      "channelCount: %d, fifo: %d frames\n", streamType, sampleRate, 
+      channelCount, fifo_frames);
+  return 0;
+}
+
+// Queue size bytes into the fifo of a mixed device, mono is upmixed. Block
+// while it's full, like AudioTrack::write(), until it's paused or stopped:
+// the fifo isn't mixed then, and the ring buffer thread must get back to be
+// paused or joined.
+static ssize_t audioflinger_mixer_write (AudioFlingerDevice* audiodev, 
+    const void* buffer, size_t size)
+{
+  const int16_t* in = (const int16_t*)buffer;
+  int channels = audiodev->channel_count;
+  uint32_t frames = size / (channels * sizeof(int16_t));
+  uint32_t done = 0;
+
+  pthread_mutex_lock(&mixer_mutex);
+  while (done < frames) {
+    uint32_t space = audiodev->fifo_frames - 
+        (audiodev->frames_written - audiodev->fifo_read);
+    uint32_t at = audiodev->frames_written & (audiodev->fifo_frames - 1);
+    uint32_t n;
+
+    if (space == 0) {
+      if (audiodev->stopped || !audiodev->playing)
+        break;
+      pthread_cond_wait(&mixer_cond, &mixer_mutex);
+      continue;
+    }
+    n = frames - done;
+    if (n > space)
+      n = space;
+    if (n > audiodev->fifo_frames - at)
+      n = audiodev->fifo_frames - at;
+
+    if (channels == MIXER_CHANNELS) {
+      memcpy(audiodev->fifo + at * MIXER_CHANNELS, in + done * channels,
+          n * MIXER_CHANNELS * sizeof(int16_t));
+    }
+    else {
+      for (uint32_t i = 0; i < n; i++) {
+        audiodev->fifo[(at + i) * MIXER_CHANNELS] = in[done + i];
+        audiodev->fifo[(at + i) * MIXER_CHANNELS + 1] = in[done + i];
+      }
+    }
+    audiodev->frames_written += n;
+    done += n;
+  }
+  pthread_mutex_unlock(&mixer_mutex);
+  return (ssize_t)(done * channels * sizeof(int16_t));
+}
+
+static void audioflinger_mixer_set_state (AudioFlingerDevice* audiodev, 
+    bool playing, bool stopped, bool flush)
+{
+  pthread_mutex_lock(&mixer_mutex);
+  audiodev->playing = playing;
+  audiodev->stopped = stopped;
+  if (flush) {
+    audiodev->frames_written = 0;
+    audiodev->fifo_read = 0;
+  }
+  pthread_cond_broadcast(&mixer_cond);
+  pthread_mutex_unlock(&mixer_mutex);
+  audioflinger_mixer_update(&mixers[audiodev->stream_type]);
+}
+
+// Get the device ready to be set with a configuration. If it's set with the
+// same one, it's flushed and reused, and true is returned. If it's set
+// with another one, the track is closed, AudioTrack can't be set twice.
+static bool audioflinger_device_reuse (AudioFlingerDevice* audiodev,
+  int streamType, int channelCount, uint32_t sampleRate, int frameCount,
+  bool withCallback, int notificationFrames)
+{
+  if (!audiodev->init)
+    goto CONFIGURE;
+
+  if (audiodev->stream_type == streamType && 
+      audiodev->channel_count == channelCount &&
+      audiodev->sample_rate == sampleRate && 
+      audiodev->frame_count == frameCount &&
+      audiodev->with_callback == withCallback &&
+      audiodev->notification_frames == notificationFrames) {
+    GST_PLAYER_DEBUG("Reuse device, sampleRate: %d, channelCount: %d\n",
+        sampleRate, channelCount);
+    if (audiodev->audio_track) {
+      audiodev->audio_track->stop();
+      audiodev->audio_track->flush();
+    }
+    else {
+      audiodev->audio_sink->stop();
+      audiodev->audio_sink->flush();
+    }
+    audiodev->buffer_obtained = false;
+    audiodev->frames_written = 0;
+    audiodev->underruns = 0;
+    return true;
+  }
+
+  GST_PLAYER_DEBUG("Reconfigure device, sampleRate: %d -> %d, "
+      "channelCount: %d -> %d\n", audiodev->sample_rate, sampleRate, 
+      audiodev->channel_count, channelCount);
+  audiodev->init = false;
+  if (audiodev->audio_track) {
+    delete audiodev->audio_track;
+    audiodev->audio_track = new AudioTrack ();
+  }
+  else {
+    audiodev->audio_sink->close();
+  }
+
+CONFIGURE:
+  audiodev->stream_type = streamType;
+  audiodev->channel_count = channelCount;
+  audiodev->sample_rate = sampleRate;
+  audiodev->frame_count = frameCount;
+  audiodev->with_callback = withCallback;
+  audiodev->notification_frames = notificationFrames;
+  return false;
+}
+
 int audioflinger_device_set (AudioFlingerDeviceHandle handle, 
   int streamType, int channelCount, uint32_t sampleRate, int bufferCount)
 {
@@ -105,6 +546,14 @@ int audioflinger_device_set (AudioFlingerDeviceHandle handle,
   if (handle == NULL)
       return -1;
 
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed)
+    return audioflinger_mixer_set(AUDIO_FLINGER_DEVICE(handle), streamType,
+        channelCount, sampleRate, bufferCount);
+
+  if (audioflinger_device_reuse(AUDIO_FLINGER_DEVICE(handle), streamType,
+      channelCount, sampleRate, bufferCount, false, 0))
+    return 0;
+
   if(AUDIO_FLINGER_DEVICE_TRACK(handle)) {
     // bufferCount is not the number of internal buffer, but the internal
     // buffer size 
@@ -126,6 +575,72 @@ int audioflinger_device_set (AudioFlingerDeviceHandle handle,
     return -1;
 
   AUDIO_FLINGER_DEVICE(handle)->init = true;
+  AUDIO_FLINGER_DEVICE(handle)->buffer_obtained = false;
+  AUDIO_FLINGER_DEVICE(handle)->frames_written = 0;
+  AUDIO_FLINGER_DEVICE(handle)->underruns = 0;
+
+  return 0;
+}
+
+// AudioTrack callback, in AudioTrack's thread
+static void audioflinger_device_track_callback (int event, void* user, 
+    void* info)
+{
+  AudioFlingerDevice* audiodev = (AudioFlingerDevice*)user;
+
+  if (event == AudioTrack::EVENT_MORE_DATA) {
+    AudioTrack::Buffer* buffer = (AudioTrack::Buffer*)info;
+    buffer->size = audiodev->callback(audiodev->callback_user, buffer->raw, 
+        buffer->size);
+    audiodev->frames_written += buffer->size / 
+        audiodev->audio_track->frameSize();
+  }
+  else if (event == AudioTrack::EVENT_UNDERRUN) {
+    audiodev->underruns++;
+  }
+}
+
+int audioflinger_device_set_callback (AudioFlingerDeviceHandle handle, 
+  int streamType, int channelCount, uint32_t sampleRate, int frameCount,
+  AudioFlingerDeviceCallback callback, void* user, int notificationFrames)
+{
+  AudioFlingerDevice* audiodev = AUDIO_FLINGER_DEVICE(handle);
+  status_t status;
+
+  int format = AudioSystem::PCM_16_BIT;
+
+  if (handle == NULL || callback == NULL)
+    return -1;
+
+  if (audiodev->audio_track == NULL) {
+    // MediaPlayerBase::AudioSink doesn't provide callback interface, and
+    // the mixer calls back itself
+    GST_PLAYER_ERROR("AudioSink and mixed device don't support callback\n");
+    return -1;
+  }
+
+  // the track calls back through audiodev, so a reused track serves the
+  // new callback
+  audiodev->callback = callback;
+  audiodev->callback_user = user;
+  if (audioflinger_device_reuse(audiodev, streamType, channelCount, 
+      sampleRate, frameCount, true, notificationFrames))
+    return 0;
+
+  status = audiodev->audio_track->set(streamType, sampleRate, format, 
+      channelCount, frameCount, 0, audioflinger_device_track_callback, 
+      audiodev, notificationFrames);
+  GST_PLAYER_DEBUG("Set AudioTrack with callback, status: %d, streamType: %d, "
+      "sampleRate: %d, channelCount: %d, frameCount: %d, "
+      "notificationFrames: %d\n", status, streamType, sampleRate, 
+      channelCount, frameCount, notificationFrames);
+  if (status != NO_ERROR) 
+    return -1;
+
+  audiodev->init = true;
+  audiodev->buffer_obtained = false;
+  audiodev->frames_written = 0;
+  audiodev->underruns = 0;
 
   return 0;
 }
@@ -136,7 +651,13 @@ void audioflinger_device_release (AudioFlingerDeviceHandle handle)
     return;
 
   GST_PLAYER_DEBUG("Enter\n");
-  if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed) {
+    GST_PLAYER_DEBUG("Release mixed device\n");
+    if (AUDIO_FLINGER_DEVICE(handle)->init)
+      audioflinger_mixer_remove(AUDIO_FLINGER_DEVICE(handle));
+    g_free(AUDIO_FLINGER_DEVICE(handle)->fifo);
+  }
+  else if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
     GST_PLAYER_DEBUG("Release AudioTrack\n");
     delete AUDIO_FLINGER_DEVICE_TRACK(handle);
   }
@@ -156,6 +677,12 @@ void audioflinger_device_start (AudioFlingerDeviceHandle handle)
   if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
     return;
 
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed) {
+    audioflinger_mixer_set_state(AUDIO_FLINGER_DEVICE(handle), true, false,
+        false);
+    return;
+  }
+
   if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
     AUDIO_FLINGER_DEVICE_TRACK(handle)->start();
   }
@@ -169,6 +696,12 @@ void audioflinger_device_stop (AudioFlingerDeviceHandle handle)
   if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
     return;
 
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed) {
+    audioflinger_mixer_set_state(AUDIO_FLINGER_DEVICE(handle), false, true,
+        false);
+    return;
+  }
+
   if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
     AUDIO_FLINGER_DEVICE_TRACK(handle)->stop();
   }
@@ -182,8 +715,16 @@ void audioflinger_device_flush (AudioFlingerDeviceHandle handle)
   if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
     return;
 
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed) {
+    audioflinger_mixer_set_state(AUDIO_FLINGER_DEVICE(handle), 
+        AUDIO_FLINGER_DEVICE(handle)->playing, 
+        AUDIO_FLINGER_DEVICE(handle)->stopped, true);
+    return;
+  }
+
   if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
     AUDIO_FLINGER_DEVICE_TRACK(handle)->flush();
+    AUDIO_FLINGER_DEVICE(handle)->frames_written = 0;
   }
   else {
     AUDIO_FLINGER_DEVICE_SINK(handle)->flush();
@@ -195,6 +736,12 @@ void audioflinger_device_pause (AudioFlingerDeviceHandle handle)
   if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
     return;
 
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed) {
+    audioflinger_mixer_set_state(AUDIO_FLINGER_DEVICE(handle), false, false,
+        false);
+    return;
+  }
+
   if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
     AUDIO_FLINGER_DEVICE_TRACK(handle)->pause();
   }
@@ -208,6 +755,11 @@ void audioflinger_device_mute (AudioFlingerDeviceHandle handle, int mute)
   if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
     return;
 
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed) {
+    AUDIO_FLINGER_DEVICE(handle)->muted = (mute != 0);
+    return;
+  }
+
   if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
     AUDIO_FLINGER_DEVICE_TRACK(handle)->mute((bool)mute);
   }
@@ -221,6 +773,9 @@ int audioflinger_device_muted (AudioFlingerDeviceHandle handle)
   if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
       return -1;
 
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed)
+    return (int) AUDIO_FLINGER_DEVICE(handle)->muted;
+
   if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
     return (int) AUDIO_FLINGER_DEVICE_TRACK(handle)->muted ();
   }
@@ -237,6 +792,13 @@ void audioflinger_device_set_volume (AudioFlingerDeviceHandle handle, float left
   if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
     return;
 
+  // mixed devices apply their volume when they are mixed
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed) {
+    AUDIO_FLINGER_DEVICE(handle)->left = left;
+    AUDIO_FLINGER_DEVICE(handle)->right = right;
+    return;
+  }
+
   if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
     AUDIO_FLINGER_DEVICE_TRACK(handle)->setVolume (left, right);
   }
@@ -246,13 +808,34 @@ void audioflinger_device_set_volume (AudioFlingerDeviceHandle handle, float left
   }        
 }
 
+// The track has played everything written, so it's been starving. Only
+// the callback mode gets EVENT_UNDERRUN from AudioTrack.
+static void audioflinger_device_check_underrun (AudioFlingerDevice* audiodev)
+{
+  uint32_t position;
+
+  if (audiodev->frames_written == 0 || audiodev->callback != NULL)
+    return;
+  if (audiodev->audio_track->getPosition(&position) == NO_ERROR &&
+      position == audiodev->frames_written)
+    audiodev->underruns++;
+}
+
 ssize_t audioflinger_device_write (AudioFlingerDeviceHandle handle, const void *buffer,
     size_t size)
 {
   if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
     return -1;
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed)
+    return audioflinger_mixer_write(AUDIO_FLINGER_DEVICE(handle), buffer, 
+        size);
   if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
-    return AUDIO_FLINGER_DEVICE_TRACK(handle)->write(buffer, size);
+    audioflinger_device_check_underrun(AUDIO_FLINGER_DEVICE(handle));
+    ssize_t written = AUDIO_FLINGER_DEVICE_TRACK(handle)->write(buffer, size);
+    if (written > 0)
+      AUDIO_FLINGER_DEVICE(handle)->frames_written += 
+          written / AUDIO_FLINGER_DEVICE_TRACK(handle)->frameSize();
+    return written;
   }
   else {
     return AUDIO_FLINGER_DEVICE_SINK(handle)->write(buffer, size);
@@ -263,6 +846,8 @@ int audioflinger_device_frameCount (AudioFlingerDeviceHandle handle)
 {
   if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
     return -1;
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed)
+    return (int)AUDIO_FLINGER_DEVICE(handle)->fifo_frames;
   if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
     return (int)AUDIO_FLINGER_DEVICE_TRACK(handle)->frameCount();
   }
@@ -275,6 +860,8 @@ int audioflinger_device_frameSize (AudioFlingerDeviceHandle handle)
 {
   if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
     return -1;
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed)
+    return AUDIO_FLINGER_DEVICE(handle)->channel_count * sizeof(int16_t);
   if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
     return (int)AUDIO_FLINGER_DEVICE_TRACK(handle)->frameSize();
   }
@@ -287,6 +874,21 @@ int64_t audioflinger_device_latency (AudioFlingerDeviceHandle handle)
 {
   if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
     return -1;
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed) {
+    // the fifo, then the mixer's track
+    AudioFlingerDevice* audiodev = AUDIO_FLINGER_DEVICE(handle);
+    AudioTrack* track;
+    int64_t latency = 0;
+
+    // the track may be deleted when the mixer is reconfigured
+    pthread_mutex_lock(&mixer_track_mutex);
+    track = mixers[audiodev->stream_type].track;
+    if (track)
+      latency = (int64_t)track->latency();
+    pthread_mutex_unlock(&mixer_track_mutex);
+    return (int64_t)audiodev->fifo_frames * 1000 / audiodev->sample_rate +
+        latency;
+  }
   if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
     return (int64_t)AUDIO_FLINGER_DEVICE_TRACK(handle)->latency();
   }
@@ -295,10 +897,21 @@ int64_t audioflinger_device_latency (AudioFlingerDeviceHandle handle)
   }     
 }
 
+int audioflinger_device_native_rate (void)
+{
+  int rate;
+
+  if (AudioSystem::getOutputSamplingRate(&rate) != NO_ERROR || rate <= 0)
+    return -1;
+  return rate;
+}
+
 int audioflinger_device_format (AudioFlingerDeviceHandle handle)
 {
   if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
     return -1;
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed)
+    return AudioSystem::PCM_16_BIT;
   if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
     return (int)AUDIO_FLINGER_DEVICE_TRACK(handle)->format();
   }
@@ -313,6 +926,8 @@ int audioflinger_device_channelCount (AudioFlingerDeviceHandle handle)
 {
   if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
     return -1;
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed)
+    return AUDIO_FLINGER_DEVICE(handle)->channel_count;
   if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
     return (int)AUDIO_FLINGER_DEVICE_TRACK(handle)->channelCount();
   }
@@ -325,6 +940,8 @@ uint32_t audioflinger_device_sampleRate (AudioFlingerDeviceHandle handle)
 {
   if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
     return 0;
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed)
+    return AUDIO_FLINGER_DEVICE(handle)->sample_rate;
   if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
     return (int)AUDIO_FLINGER_DEVICE_TRACK(handle)->sampleRate();
   }
@@ -334,3 +951,156 @@ uint32_t audioflinger_device_sampleRate (AudioFlingerDeviceHandle handle)
     return -1;
   }
 }
+
+int audioflinger_device_get_position (AudioFlingerDeviceHandle handle, 
+    uint32_t* position)
+{
+  if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
+    return -1;
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed) {
+    // frames mixed, ahead of the mixer's track
+    pthread_mutex_lock(&mixer_mutex);
+    *position = AUDIO_FLINGER_DEVICE(handle)->fifo_read;
+    pthread_mutex_unlock(&mixer_mutex);
+    return 0;
+  }
+  if (AUDIO_FLINGER_DEVICE_TRACK(handle))  {
+    if (AUDIO_FLINGER_DEVICE_TRACK(handle)->getPosition(position) != NO_ERROR)
+      return -1;
+    return 0;
+  }
+  else {
+    // do nothing here, MediaPlayerBase::AudioSink doesn't provide 
+    // getPosition() interface
+    return -1;
+  }
+}
+
+int audioflinger_device_get_playback_head (AudioFlingerDeviceHandle handle,
+    uint32_t* position, uint32_t* latency_frames)
+{
+  AudioTrack* track;
+  int64_t latency;
+
+  if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
+    return -1;
+  if (AUDIO_FLINGER_DEVICE(handle)->mixed) {
+    // frames mixed are still to play through the whole track of the mixer
+    AudioFlingerDevice* audiodev = AUDIO_FLINGER_DEVICE(handle);
+
+    pthread_mutex_lock(&mixer_track_mutex);
+    track = mixers[audiodev->stream_type].track;
+    if (track == NULL) {
+      pthread_mutex_unlock(&mixer_track_mutex);
+      return -1;
+    }
+    pthread_mutex_lock(&mixer_mutex);
+    *position = audiodev->fifo_read;
+    pthread_mutex_unlock(&mixer_mutex);
+    *latency_frames = (uint32_t)((int64_t)track->latency() * 
+        track->sampleRate() / 1000);
+    pthread_mutex_unlock(&mixer_track_mutex);
+    return 0;
+  }
+  // MediaPlayerBase::AudioSink doesn't provide getPosition() interface
+  track = AUDIO_FLINGER_DEVICE_TRACK(handle);
+  if (track == NULL || track->getPosition(position) != NO_ERROR)
+    return -1;
+
+  // latency() counts the whole track buffer on top of the output's latency
+  latency = (int64_t)track->latency() * track->sampleRate() / 1000 - 
+      track->frameCount();
+  *latency_frames = (latency > 0) ? (uint32_t)latency : 0;
+  return 0;
+}
+
+ssize_t audioflinger_device_obtain_buffer (AudioFlingerDeviceHandle handle, 
+    void** buffer, size_t size, int blocking)
+{
+  AudioFlingerDevice* audiodev = AUDIO_FLINGER_DEVICE(handle);
+  status_t status;
+
+  if (handle == NULL || audiodev->init == false)
+    return -1;
+  if (audiodev->audio_track == NULL)  {
+    // do nothing here, MediaPlayerBase::AudioSink and mixed devices don't
+    // provide obtainBuffer() interface
+    return -1;
+  }
+  if (audiodev->buffer_obtained) {
+    GST_PLAYER_ERROR("Previous buffer is not released\n");
+    return -1;
+  }
+
+  audiodev->buffer.frameCount = size / audiodev->audio_track->frameSize();
+  if (audiodev->buffer.frameCount == 0)
+    return 0;
+  audioflinger_device_check_underrun(audiodev);
+
+  // waitCount -1 waits until there is free space or the track stops
+  status = audiodev->audio_track->obtainBuffer(&audiodev->buffer, 
+      blocking ? -1 : 0);
+  if (status != NO_ERROR) {
+    // WOULD_BLOCK, or NO_MORE_BUFFERS when the track is stopped
+    return 0;
+  }
+
+  audiodev->buffer_obtained = true;
+  *buffer = audiodev->buffer.raw;
+  return (ssize_t)audiodev->buffer.size;
+}
+
+void audioflinger_device_release_buffer (AudioFlingerDeviceHandle handle, 
+    size_t size)
+{
+  AudioFlingerDevice* audiodev = AUDIO_FLINGER_DEVICE(handle);
+  size_t frame_size;
+
+  if (handle == NULL || audiodev->audio_track == NULL || 
+      !audiodev->buffer_obtained)
+    return;
+
+  // only the filled part is handed to the track
+  frame_size = audiodev->audio_track->frameSize();
+  if (size > audiodev->buffer.size)
+    size = audiodev->buffer.size;
+  audiodev->buffer.frameCount = size / frame_size;
+  audiodev->buffer.size = audiodev->buffer.frameCount * frame_size;
+  audiodev->audio_track->releaseBuffer(&audiodev->buffer);
+  audiodev->frames_written += audiodev->buffer.frameCount;
+  audiodev->buffer_obtained = false;
+}
+
+ssize_t audioflinger_device_free_space (AudioFlingerDeviceHandle handle)
+{
+  AudioFlingerDevice* audiodev = AUDIO_FLINGER_DEVICE(handle);
+  uint32_t position;
+  uint32_t queued;
+  uint32_t frame_count;
+
+  if (handle == NULL || audiodev->init == false)
+    return -1;
+  if (audiodev->mixed) {
+    pthread_mutex_lock(&mixer_mutex);
+    queued = audiodev->frames_written - audiodev->fifo_read;
+    pthread_mutex_unlock(&mixer_mutex);
+    return (ssize_t)((audiodev->fifo_frames - queued) * 
+        audiodev->channel_count * sizeof(int16_t));
+  }
+  if (audiodev->audio_track == NULL ||
+      audiodev->audio_track->getPosition(&position) != NO_ERROR)
+    return -1;
+
+  frame_count = audiodev->audio_track->frameCount();
+  queued = audiodev->frames_written - position;
+  if (queued > frame_count)
+    queued = frame_count;
+  return (ssize_t)((frame_count - queued) * audiodev->audio_track->frameSize());
+}
+
+int audioflinger_device_underruns (AudioFlingerDeviceHandle handle)
+{
+  if (handle == NULL || AUDIO_FLINGER_DEVICE(handle)->init == false)
+    return 0;
+  return AUDIO_FLINGER_DEVICE(handle)->underruns;
+}
@@ -30,13 +30,36 @@ extern "C" {
 
 typedef void* AudioFlingerDeviceHandle;
 
+/* called in AudioTrack's thread to fill size bytes at buffer, return the
+ * bytes filled */
+typedef size_t (*AudioFlingerDeviceCallback) (void* user, void* buffer, 
+    size_t size);
+
 AudioFlingerDeviceHandle audioflinger_device_create();
 
 AudioFlingerDeviceHandle audioflinger_device_open(void* audio_sink);
 
+/* a source of the process-wide mixer of its stream type, instead of a track
+ * of its own. Sources share one AudioTrack, each is mixed with its volume
+ * and mute. It shall be set at audioflinger_device_mixer_rate(), and it
+ * can't be set with callback. */
+AudioFlingerDeviceHandle audioflinger_device_create_mixed();
+
+/* sample rate of the shared mixer */
+int audioflinger_device_mixer_rate(void);
+
+/* setting the configuration of the last set again flushes and reuses the
+ * track, another one replaces it */
 int audioflinger_device_set (AudioFlingerDeviceHandle handle, 
   int streamType, int channelCount, uint32_t sampleRate, int bufferCount);
 
+/* like audioflinger_device_set(), but AudioTrack pulls data by callback
+ * every notificationFrames, instead of write(). AudioSink of media service
+ * doesn't support it, -1 is returned. */
+int audioflinger_device_set_callback (AudioFlingerDeviceHandle handle, 
+  int streamType, int channelCount, uint32_t sampleRate, int frameCount,
+  AudioFlingerDeviceCallback callback, void* user, int notificationFrames);
+
 void audioflinger_device_release(AudioFlingerDeviceHandle handle);
 
 void audioflinger_device_start(AudioFlingerDeviceHandle handle);
@@ -46,6 +69,8 @@ void audioflinger_device_stop(AudioFlingerDeviceHandle handle);
 ssize_t  audioflinger_device_write(AudioFlingerDeviceHandle handle, 
     const void* buffer, size_t size);
 
+/* drop data queued in the device, which shall be paused or stopped first.
+ * The position starts again from 0 */
 void audioflinger_device_flush(AudioFlingerDeviceHandle handle);
 
 void audioflinger_device_pause(AudioFlingerDeviceHandle handle);
@@ -63,12 +88,44 @@ int audioflinger_device_frameSize(AudioFlingerDeviceHandle handle);
 
 int64_t audioflinger_device_latency(AudioFlingerDeviceHandle handle);
 
+/* sample rate of AudioFlinger's output, tracks at this rate aren't
+ * resampled by its mixer. Return -1 if it's unknown */
+int audioflinger_device_native_rate(void);
+
 int audioflinger_device_format(AudioFlingerDeviceHandle handle);
 
 int audioflinger_device_channelCount(AudioFlingerDeviceHandle handle);
 
 uint32_t  audioflinger_device_sampleRate(AudioFlingerDeviceHandle handle);
 
+/* number of frames played since the device is set, return -1 if the device
+ * doesn't report it */
+int audioflinger_device_get_position(AudioFlingerDeviceHandle handle, 
+    uint32_t* position);
+
+/* playback head: frames played by AudioFlinger's mixer since the device is
+ * set or flushed, and frames of output latency after the mixer, which are
+ * still to be heard. Return -1 if the device doesn't report its position */
+int audioflinger_device_get_playback_head(AudioFlingerDeviceHandle handle, 
+    uint32_t* position, uint32_t* latency_frames);
+
+/* get a region of the device's shared buffer to fill, at most size bytes.
+ * Return its size, 0 if there's no free space (and blocking is 0 or the
+ * device is stopped), -1 if the device doesn't support it. The region shall
+ * be handed back by audioflinger_device_release_buffer() with the number of
+ * bytes filled, before obtaining another one */
+ssize_t audioflinger_device_obtain_buffer(AudioFlingerDeviceHandle handle, 
+    void** buffer, size_t size, int blocking);
+
+void audioflinger_device_release_buffer(AudioFlingerDeviceHandle handle, 
+    size_t size);
+
+/* free space in the device's shared buffer in bytes, -1 if unknown */
+ssize_t audioflinger_device_free_space(AudioFlingerDeviceHandle handle);
+
+/* times the device ran out of data since it's set */
+int audioflinger_device_underruns(AudioFlingerDeviceHandle handle);
+
 #ifdef __cplusplus
 }
 #endif
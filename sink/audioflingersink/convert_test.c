@@ -0,0 +1,440 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * This is a test application of audio conversion, gain, mixing, resampling
+ * and time stretching kernels, it checks them against the scalar reference
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "audioflinger_convert.h"
+#include "audioflinger_gain.h"
+#include "audioflinger_resample.h"
+#include "audioflinger_stretch.h"
+
+#define MAX_FRAMES 1031
+
+static const char *format_names[] = {
+  "none", "s16", "s24_32", "s24_3", "s32", "f32"
+};
+
+static const int frame_counts[] = { 0, 1, 3, 7, 8, 9, 127, 128, 129, MAX_FRAMES };
+
+static const float gains[] = { 0.0f, 0.25f, 0.7f, 1.0f, 1.5f, 7.99f };
+
+static const int resample_rates[][2] = {
+  {44100, 48000}, {22050, 48000}, {8000, 48000}, {48000, 44100},
+  {96000, 48000}, {11025, 44100}
+};
+
+static const double tempos[] = { 0.5, 0.8, 1.0, 1.25, 2.0, 3.0 };
+
+static uint32_t seed = 1;
+
+static uint32_t
+random_u32 (void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) | ((seed * 1103515245 + 12345) & 0xffff0000);
+}
+
+/* random samples, every 16th one at full scale or beyond */
+static void
+fill_input (AudioFlingerConvertFormat format, uint8_t * buf, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    uint32_t r = random_u32 ();
+    int extreme = (i % 16 == 0);
+
+    switch (format) {
+      case AUDIOFLINGER_CONVERT_S24_32:
+        ((int32_t *) buf)[i] = extreme ? ((r & 1) ? 8388607 : -8388608) :
+            ((int32_t) r >> 8);
+        break;
+      case AUDIOFLINGER_CONVERT_S24_3:
+        buf[3 * i] = r & 0xff;
+        buf[3 * i + 1] = (r >> 8) & 0xff;
+        buf[3 * i + 2] = extreme ? 0x80 : (r >> 16) & 0xff;
+        break;
+      case AUDIOFLINGER_CONVERT_S32:
+        ((int32_t *) buf)[i] = extreme ? ((r & 1) ? 0x7fffffff :
+            (int32_t) 0x80000000) : (int32_t) r;
+        break;
+      case AUDIOFLINGER_CONVERT_F32:
+        /* beyond full scale shall saturate */
+        ((float *) buf)[i] = extreme ? ((r & 1) ? 1.5f : -1.5f) :
+            ((int32_t) r / 2147483648.0f);
+        break;
+      default:
+        ((int16_t *) buf)[i] = extreme ? ((r & 1) ? 32767 : -32768) :
+            (int16_t) r;
+        break;
+    }
+  }
+}
+
+/* integer conversions shall be exact, rounding of float may differ by 1 */
+static int
+run_test (AudioFlingerConvertFormat format, int channels, int frames)
+{
+  static uint8_t input[MAX_FRAMES * AUDIOFLINGER_CONVERT_MAX_CHANNELS * 4];
+  static int16_t output[MAX_FRAMES * 2 + 1];
+  static int16_t expected[MAX_FRAMES * 2 + 1];
+  int out_channels = audioflinger_convert_out_channels (channels);
+  int n = frames * out_channels;
+  int tolerance;
+  int i;
+
+  tolerance = (format == AUDIOFLINGER_CONVERT_F32 || channels > 2) ? 1 : 0;
+
+  fill_input (format, input, frames * channels);
+  /* a guard sample after the output shall not be touched */
+  output[n] = expected[n] = 0x5a5a;
+  audioflinger_convert (format, channels, input, output, frames);
+  audioflinger_convert_ref (format, channels, input, expected, frames);
+
+  if (output[n] != 0x5a5a) {
+    printf ("FAIL %s %d channels %d frames: wrote past the end\n",
+        format_names[format], channels, frames);
+    return 1;
+  }
+  for (i = 0; i < n; i++) {
+    if (abs (output[i] - expected[i]) > tolerance) {
+      printf ("FAIL %s %d channels %d frames: sample %d is %d, "
+          "expected %d\n", format_names[format], channels, frames, i,
+          output[i], expected[i]);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* constant gain shall be exact */
+static int
+run_gain_test (float value, int channels, int frames)
+{
+  static int16_t output[MAX_FRAMES * 2];
+  static int16_t expected[MAX_FRAMES * 2];
+  AudioFlingerGain gain;
+  int n = frames * channels;
+  int i;
+
+  fill_input (AUDIOFLINGER_CONVERT_S16, (uint8_t *) output, n);
+  memcpy (expected, output, n * sizeof (int16_t));
+  audioflinger_gain_init (&gain, value);
+  audioflinger_gain_apply (&gain, output, frames, channels);
+  audioflinger_gain_apply_ref (value, expected, n);
+
+  for (i = 0; i < n; i++) {
+    if (output[i] != expected[i]) {
+      printf ("FAIL gain %f %d channels %d frames: sample %d is %d, "
+          "expected %d\n", value, channels, frames, i, output[i],
+          expected[i]);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* mixing shall be exact, with a gain of each channel */
+static int
+run_mix_test (float left, float right, int channels, int frames)
+{
+  static int16_t src[MAX_FRAMES * 2];
+  static int16_t output[MAX_FRAMES * 2];
+  static int16_t expected[MAX_FRAMES * 2];
+  int n = frames * channels;
+  int i;
+
+  fill_input (AUDIOFLINGER_CONVERT_S16, (uint8_t *) src, n);
+  fill_input (AUDIOFLINGER_CONVERT_S16, (uint8_t *) output, n);
+  memcpy (expected, output, n * sizeof (int16_t));
+  audioflinger_gain_mix (output, src, frames, channels, left, right);
+  audioflinger_gain_mix_ref (expected, src, frames, channels, left, right);
+
+  for (i = 0; i < n; i++) {
+    if (output[i] != expected[i]) {
+      printf ("FAIL mix %f/%f %d channels %d frames: sample %d is %d, "
+          "expected %d\n", left, right, channels, frames, i, output[i],
+          expected[i]);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* a ramp from silence to unity shall rise monotonically to full level in
+ * exactly its length of frames, whatever the buffer size */
+static int
+run_ramp_test (AudioFlingerRampShape shape, int chunk)
+{
+  static int16_t samples[MAX_FRAMES * 2];
+  AudioFlingerGain gain;
+  int ramp = 300;
+  int done = 0;
+  int i;
+
+  for (i = 0; i < MAX_FRAMES * 2; i++)
+    samples[i] = 20000;
+  audioflinger_gain_init (&gain, 0.0f);
+  audioflinger_gain_set (&gain, 1.0f, ramp, shape);
+  while (done < MAX_FRAMES) {
+    int frames = (MAX_FRAMES - done < chunk) ? MAX_FRAMES - done : chunk;
+    audioflinger_gain_apply (&gain, samples + 2 * done, frames, 2);
+    done += frames;
+  }
+
+  for (i = 1; i < MAX_FRAMES; i++) {
+    if (samples[2 * i] < samples[2 * (i - 1)] || 
+        samples[2 * i] != samples[2 * i + 1] ||
+        (i >= ramp) != (samples[2 * i] == 20000)) {
+      printf ("FAIL ramp %d chunk %d: frame %d is %d\n", shape, chunk, i,
+          samples[2 * i]);
+      return 1;
+    }
+  }
+  return !audioflinger_gain_is_unity (&gain);
+}
+
+/* DC shall pass at unity gain, the number of output frames shall follow
+ * the ratio of rates, and it shall not matter how input is chunked */
+static int
+run_resample_test (int in_rate, int out_rate, 
+    AudioFlingerResampleQuality quality)
+{
+  static int16_t input[MAX_FRAMES * 4 * 2];
+  static int16_t whole[MAX_FRAMES * 4 * 2 * 12];
+  static int16_t chunked[MAX_FRAMES * 4 * 2 * 12];
+  AudioFlingerResampler *a, *b;
+  int in_frames = MAX_FRAMES * 4;
+  int n_whole, n_chunked = 0;
+  int done, expected, i;
+
+  for (i = 0; i < in_frames * 2; i++)
+    input[i] = 10000;
+  a = audioflinger_resampler_new (2, in_rate, out_rate, quality);
+  b = audioflinger_resampler_new (2, in_rate, out_rate, quality);
+  if (a == NULL || b == NULL) {
+    printf ("FAIL resample %d -> %d: not supported\n", in_rate, out_rate);
+    return 1;
+  }
+
+  n_whole = audioflinger_resampler_process (a, input, in_frames, whole);
+  for (done = 0; done < in_frames; done += 7) {
+    int frames = (in_frames - done < 7) ? in_frames - done : 7;
+    n_chunked += audioflinger_resampler_process (b, input + 2 * done, frames,
+        chunked + 2 * n_chunked);
+  }
+  audioflinger_resampler_free (a);
+  audioflinger_resampler_free (b);
+
+  /* the filter holds back its last half taps of input */
+  expected = (int) ((long long) in_frames * out_rate / in_rate);
+  if (n_whole != n_chunked || n_whole > expected + 1 || 
+      n_whole < expected - 32 * out_rate / in_rate - 1) {
+    printf ("FAIL resample %d -> %d: %d and %d frames, expected %d\n",
+        in_rate, out_rate, n_whole, n_chunked, expected);
+    return 1;
+  }
+  if (memcmp (whole, chunked, n_whole * 2 * sizeof (int16_t)) != 0) {
+    printf ("FAIL resample %d -> %d: chunked output differs\n", in_rate,
+        out_rate);
+    return 1;
+  }
+  /* skip the ramp up from the silence before the first frame */
+  for (i = n_whole / 2; i < n_whole * 2; i++) {
+    if (abs (whole[i] - 10000) > 4) {
+      printf ("FAIL resample %d -> %d: DC sample %d is %d\n", in_rate,
+          out_rate, i, whole[i]);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* correlation shall be exact, with the largest reference */
+static int
+run_correlate_test (int n)
+{
+  static int16_t ref[MAX_FRAMES];
+  static int16_t x[MAX_FRAMES];
+  int64_t result, expected;
+  int i;
+
+  fill_input (AUDIOFLINGER_CONVERT_S16, (uint8_t *) x, n);
+  fill_input (AUDIOFLINGER_CONVERT_S16, (uint8_t *) ref, n);
+  for (i = 0; i < n; i++)
+    ref[i] = (i % 16 == 0) ? ((ref[i] < 0) ? -4095 : 4095) : ref[i] >> 4;
+  result = audioflinger_stretch_correlate (ref, x, n);
+  expected = audioflinger_stretch_correlate_ref (ref, x, n);
+
+  if (result != expected) {
+    printf ("FAIL correlate %d samples: %lld, expected %lld\n", n,
+        (long long) result, (long long) expected);
+    return 1;
+  }
+  return 0;
+}
+
+/* the number of output frames shall follow the tempo, the pitch of a sine
+ * shall not change, and it shall not matter how input is chunked */
+static int
+run_stretch_test (double tempo, int channels, int step)
+{
+  static int16_t input[44100 * 2];
+  static int16_t whole[44100 * 2 * 3];
+  static int16_t chunked[44100 * 2 * 3];
+  AudioFlingerStretch *a, *b;
+  int in_frames = 44100;
+  int n_whole, n_chunked = 0;
+  int done, expected, crossings, i, c;
+
+  for (i = 0; i < in_frames; i++) {
+    for (c = 0; c < channels; c++)
+      input[i * channels + c] = (int16_t) (16000.0 *
+          sin (2.0 * M_PI * 440.0 * i / 44100.0));
+  }
+  a = audioflinger_stretch_new (channels, 44100, 30, 14);
+  b = audioflinger_stretch_new (channels, 44100, 30, 14);
+  if (a == NULL || b == NULL) {
+    printf ("FAIL stretch %.2f: not supported\n", tempo);
+    return 1;
+  }
+  audioflinger_stretch_set_tempo (a, tempo);
+  audioflinger_stretch_set_tempo (b, tempo);
+  audioflinger_stretch_set_step (a, step);
+  audioflinger_stretch_set_step (b, step);
+
+  if (audioflinger_stretch_max_out (a, in_frames) > 44100 * 3) {
+    printf ("FAIL stretch %.2f: max out %d\n", tempo,
+        audioflinger_stretch_max_out (a, in_frames));
+    return 1;
+  }
+  n_whole = audioflinger_stretch_process (a, input, in_frames, whole);
+  for (done = 0; done < in_frames; done += 129) {
+    int frames = (in_frames - done < 129) ? in_frames - done : 129;
+    n_chunked += audioflinger_stretch_process (b, input + channels * done,
+        frames, chunked + channels * n_chunked);
+  }
+  audioflinger_stretch_free (a);
+  audioflinger_stretch_free (b);
+
+  /* the stretcher holds back up to a stride, an overlap and a search */
+  expected = (int) (in_frames / tempo);
+  if (n_whole != n_chunked || n_whole > expected + 1323 ||
+      n_whole < expected - 3 * 1323) {
+    printf ("FAIL stretch %.2f %d channels: %d and %d frames, expected "
+        "%d\n", tempo, channels, n_whole, n_chunked, expected);
+    return 1;
+  }
+  if (memcmp (whole, chunked, n_whole * channels * sizeof (int16_t)) != 0) {
+    printf ("FAIL stretch %.2f %d channels: chunked output differs\n",
+        tempo, channels);
+    return 1;
+  }
+
+  /* 440 Hz is 440 rising zero crossings a second */
+  crossings = 0;
+  for (i = 1; i < n_whole; i++) {
+    if (whole[(i - 1) * channels] < 0 && whole[i * channels] >= 0)
+      crossings++;
+  }
+  expected = (int) (440.0 * n_whole / 44100.0);
+  if (abs (crossings - expected) > expected / 50 + 1) {
+    printf ("FAIL stretch %.2f %d channels: %d zero crossings, expected "
+        "%d\n", tempo, channels, crossings, expected);
+    return 1;
+  }
+  return 0;
+}
+
+int
+main (void)
+{
+  int failures = 0;
+  int tests = 0;
+  int format, channels;
+  unsigned int k;
+
+  for (format = AUDIOFLINGER_CONVERT_S16; format <= AUDIOFLINGER_CONVERT_F32;
+      format++) {
+    for (channels = 1; channels <= AUDIOFLINGER_CONVERT_MAX_CHANNELS;
+        channels++) {
+      for (k = 0; k < sizeof (frame_counts) / sizeof (frame_counts[0]); k++) {
+        failures += run_test ((AudioFlingerConvertFormat) format, channels,
+            frame_counts[k]);
+        tests++;
+      }
+    }
+  }
+
+  for (k = 0; k < sizeof (gains) / sizeof (gains[0]); k++) {
+    for (channels = 1; channels <= 2; channels++) {
+      failures += run_gain_test (gains[k], channels, 1);
+      failures += run_gain_test (gains[k], channels, MAX_FRAMES);
+      tests += 2;
+    }
+  }
+  for (k = 0; k < sizeof (gains) / sizeof (gains[0]); k++) {
+    for (channels = 1; channels <= 2; channels++) {
+      unsigned int j;
+
+      for (j = 0; j < sizeof (frame_counts) / sizeof (frame_counts[0]); j++) {
+        failures += run_mix_test (gains[k], gains[(k + 2) % 6], channels,
+            frame_counts[j]);
+        tests++;
+      }
+    }
+  }
+  for (k = 0; k < 2; k++) {
+    failures += run_ramp_test ((AudioFlingerRampShape) k, 7);
+    failures += run_ramp_test ((AudioFlingerRampShape) k, MAX_FRAMES);
+    tests += 2;
+  }
+
+  for (k = 0; k < sizeof (resample_rates) / sizeof (resample_rates[0]); k++) {
+    int quality;
+    for (quality = AUDIOFLINGER_RESAMPLE_LOW; 
+        quality <= AUDIOFLINGER_RESAMPLE_HIGH; quality++) {
+      failures += run_resample_test (resample_rates[k][0], 
+          resample_rates[k][1], (AudioFlingerResampleQuality) quality);
+      tests++;
+    }
+  }
+
+  for (k = 0; k < sizeof (frame_counts) / sizeof (frame_counts[0]); k++) {
+    failures += run_correlate_test (frame_counts[k]);
+    tests++;
+  }
+  for (k = 0; k < sizeof (tempos) / sizeof (tempos[0]); k++) {
+    for (channels = 1; channels <= 2; channels++) {
+      failures += run_stretch_test (tempos[k], channels, 1);
+      failures += run_stretch_test (tempos[k], channels, 4);
+      tests += 2;
+    }
+  }
+
+  printf ("%d of %d tests passed\n", tests - failures, tests);
+  return failures ? 1 : 0;
+}
@@ -31,12 +31,39 @@
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
+#include <string.h>
 #include "gstaudioflingersink.h"
+#include "gstaudioflingertempo.h"
+#include "gstaudioclock.h"
 
 #define DEFAULT_BUFFERTIME (500*GST_MSECOND) / (GST_USECOND)
 #define DEFAULT_LATENCYTIME (50*GST_MSECOND) / (GST_USECOND)
 #define DEFAULT_VOLUME 0.7
 #define DEFAULT_MUTE FALSE
+#define DEFAULT_CALLBACK_MODE FALSE
+#define DEFAULT_STREAM_TYPE 3   /* AudioSystem::MUSIC */
+#define DEFAULT_PROFILE GST_AUDIOFLINGER_SINK_PROFILE_DEFAULT
+#define DEFAULT_GAIN 1.0
+#define DEFAULT_RAMP_TIME 10
+#define DEFAULT_RAMP_SHAPE AUDIOFLINGER_RAMP_LINEAR
+#define DEFAULT_RESAMPLE_QUALITY AUDIOFLINGER_RESAMPLE_NONE
+#define DEFAULT_STATS_INTERVAL 5000
+#define DEFAULT_COALESCE_SIZE 0
+#define DEFAULT_COALESCE_LATENCY 40
+#define DEFAULT_SHARED_MIXER FALSE
+
+/* The profile times are provisional: they haven't been checked for
+ * underruns on a device yet. Underruns are logged with the profile when
+ * the device is released, and posted in the stats message, to tune them. */
+/* low latency: 10 ms segments, and the minimal track buffer */
+#define LOW_LATENCY_BUFFERTIME (40*GST_MSECOND) / (GST_USECOND)
+#define LOW_LATENCY_LATENCYTIME (10*GST_MSECOND) / (GST_USECOND)
+/* deep buffer: 250 ms segments, the track buffer holds two of them */
+#define DEEP_BUFFER_BUFFERTIME (1000*GST_MSECOND) / (GST_USECOND)
+#define DEEP_BUFFER_LATENCYTIME (250*GST_MSECOND) / (GST_USECOND)
+/* buffers of AudioSink, which sizes its own track. It's
+ * DEFAULT_AUDIOSINK_BUFFERCOUNT of MediaPlayerInterface */
+#define AUDIOSINK_BUFFER_COUNT 4
 
 /*
  * PROPERTY_ID
@@ -47,6 +74,26 @@ enum
   PROP_VOLUME,
   PROP_MUTE,
   PROP_AUDIO_SINK,
+  PROP_CALLBACK_MODE,
+  PROP_STREAM_TYPE,
+  PROP_PROFILE,
+  PROP_UNDERRUNS,
+  PROP_GAIN,
+  PROP_RAMP_TIME,
+  PROP_RAMP_SHAPE,
+  PROP_RESAMPLE_QUALITY,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_COALESCE_SIZE,
+  PROP_COALESCE_LATENCY,
+  PROP_SHARED_MIXER,
+};
+
+/* upper limits of the write time histogram bins in us, the last one is
+ * open */
+static const GstClockTime 
+    write_bin_limits[GST_AUDIOFLINGER_SINK_WRITE_BINS - 1] = {
+  100, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000
 };
 
 GST_DEBUG_CATEGORY_STATIC (audioflinger_debug);
@@ -73,6 +120,7 @@ static void gst_audioflinger_sink_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec);
 
 static GstCaps *gst_audioflinger_sink_getcaps (GstBaseSink * bsink);
+static GstCaps *gst_audioflinger_sink_probe_caps (void);
 
 static gboolean gst_audioflinger_sink_open (GstAudioSink * asink);
 static gboolean gst_audioflinger_sink_close (GstAudioSink * asink);
@@ -81,8 +129,53 @@ static gboolean gst_audioflinger_sink_prepare (GstAudioSink * asink,
 static gboolean gst_audioflinger_sink_unprepare (GstAudioSink * asink);
 static guint gst_audioflinger_sink_write (GstAudioSink * asink, gpointer data,
     guint length);
-/* static guint gst_audioflinger_sink_delay (GstAudioSink * asink); */
+static guint gst_audioflinger_sink_delay (GstAudioSink * asink);
+static gboolean gst_audioflinger_sink_setup (GstAudioFlingerSink * 
+    audioflinger, GstRingBufferSpec * spec, GstRingBuffer * ringbuffer);
+static GstRingBuffer *gst_audioflinger_sink_create_ringbuffer (
+    GstBaseAudioSink * sink);
 static void gst_audioflinger_sink_reset (GstAudioFlingerSink * asink);
+static gboolean gst_audioflinger_sink_event (GstBaseSink * bsink,
+    GstEvent * event);
+static GstFlowReturn gst_audioflinger_sink_render (GstBaseSink * bsink,
+    GstBuffer * buffer);
+static void gst_audioflinger_sink_flush_device (GstAudioFlingerSink *
+    audioflinger);
+static void gst_audioflinger_sink_reset_written (GstAudioFlingerSink *
+    audioflinger);
+static guint gst_audioflinger_sink_write_segment (GstAudioFlingerSink *
+    audioflinger, gpointer data, guint length);
+static void gst_audioflinger_sink_commit (GstAudioFlingerSink * 
+    audioflinger);
+static guint gst_audioflinger_sink_write_data (GstAudioFlingerSink *
+    audioflinger, gpointer data, guint length, gboolean * failed);
+static void gst_audioflinger_sink_stats_record (GstAudioFlingerSink *
+    audioflinger, guint written, guint length, GstClockTime duration,
+    gboolean failed);
+static GstStructure *gst_audioflinger_sink_stats_get (GstAudioFlingerSink *
+    audioflinger);
+static void gst_audioflinger_sink_stats_post (GstAudioFlingerSink *
+    audioflinger);
+static GstClockTime gst_audioflinger_sink_get_time (GstClock * clock,
+    GstAudioFlingerSink * audioflinger);
+static gboolean gst_audioflinger_sink_update_head (GstAudioFlingerSink *
+    audioflinger, guint32 * latency_frames);
+static void gst_audioflinger_sink_save_played (GstAudioFlingerSink *
+    audioflinger);
+static void gst_audioflinger_sink_apply_profile (GstAudioFlingerSink *
+    audioflinger_sink, GstAudioFlingerSinkProfile profile);
+static gboolean gst_audioflinger_sink_set_convert (GstAudioFlingerSink *
+    audioflinger, GstRingBufferSpec * spec);
+static void gst_audioflinger_sink_convert (GstAudioFlingerSink * 
+    audioflinger, const guint8 * src, guint8 * dest, gint frames);
+static void gst_audioflinger_sink_update_gain (GstAudioFlingerSink *
+    audioflinger_sink);
+static gboolean gst_audioflinger_sink_apply_gain (GstAudioFlingerSink *
+    audioflinger, guint8 * data, gint frames, gboolean check);
+static void gst_audioflinger_sink_set_resampler (GstAudioFlingerSink *
+    audioflinger, GstRingBufferSpec * spec, gboolean callback);
+static guint gst_audioflinger_sink_write_resampled (GstAudioFlingerSink *
+    audioflinger, gpointer data, guint length, gboolean * failed);
 static GstStateChangeReturn gst_audioflinger_sink_change_state (GstElement * 
     element, GstStateChange transition); 
 static void gst_audioflinger_sink_set_mute (GstAudioFlingerSink *
@@ -100,11 +193,386 @@ static GstStaticPadTemplate audioflingersink_sink_factory =
         "signed = (boolean) { TRUE, FALSE }, "
         "width = (int) 16, "
         "depth = (int) 16, "
-        "rate = (int) [ 1, MAX ], " "channels = (int) [ 1, 2 ]; ")
+        "rate = (int) [ 1, MAX ], " "channels = (int) [ 1, 2 ]; "
+        "audio/x-raw-int, "
+        "endianness = (int) { " G_STRINGIFY (G_BYTE_ORDER) " }, "
+        "signed = (boolean) TRUE, "
+        "width = (int) 16, "
+        "depth = (int) 16, "
+        "rate = (int) [ 1, MAX ], " "channels = (int) [ 3, 8 ]; "
+        "audio/x-raw-int, "
+        "endianness = (int) { " G_STRINGIFY (G_BYTE_ORDER) " }, "
+        "signed = (boolean) TRUE, "
+        "width = (int) 32, "
+        "depth = (int) { 24, 32 }, "
+        "rate = (int) [ 1, MAX ], " "channels = (int) [ 1, 8 ]; "
+        "audio/x-raw-int, "
+        "endianness = (int) { " G_STRINGIFY (G_BYTE_ORDER) " }, "
+        "signed = (boolean) TRUE, "
+        "width = (int) 24, "
+        "depth = (int) 24, "
+        "rate = (int) [ 1, MAX ], " "channels = (int) [ 1, 8 ]; "
+        "audio/x-raw-float, "
+        "endianness = (int) { " G_STRINGIFY (G_BYTE_ORDER) " }, "
+        "width = (int) 32, "
+        "rate = (int) [ 1, MAX ], " "channels = (int) [ 1, 8 ]; ")
     );
 
+/*
+ * Caps of the output, in order of preference: S16 mono or stereo is played
+ * as it is, and at the rate of AudioFlinger's output its mixer doesn't
+ * resample either. The rest is converted by the sink. AudioFlinger takes
+ * tracks up to twice its rate. The rates are filled in when probing.
+ */
+#define PROBED_CAPS_FORMAT \
+    "audio/x-raw-int, " \
+    "endianness = (int) " G_STRINGIFY (G_BYTE_ORDER) ", " \
+    "signed = (boolean) TRUE, " \
+    "width = (int) 16, " \
+    "depth = (int) 16, " \
+    "rate = (int) %d, " "channels = (int) [ 1, 2 ]; " \
+    "audio/x-raw-int, " \
+    "endianness = (int) " G_STRINGIFY (G_BYTE_ORDER) ", " \
+    "signed = (boolean) TRUE, " \
+    "width = (int) 16, " \
+    "depth = (int) 16, " \
+    "rate = (int) [ 1, %d ], " "channels = (int) [ 1, 2 ]; " \
+    "audio/x-raw-int, " \
+    "endianness = (int) " G_STRINGIFY (G_BYTE_ORDER) ", " \
+    "signed = (boolean) TRUE, " \
+    "width = (int) 16, " \
+    "depth = (int) 16, " \
+    "rate = (int) [ 1, %d ], " "channels = (int) [ 3, 8 ]; " \
+    "audio/x-raw-int, " \
+    "endianness = (int) " G_STRINGIFY (G_BYTE_ORDER) ", " \
+    "signed = (boolean) TRUE, " \
+    "width = (int) 32, " \
+    "depth = (int) { 24, 32 }, " \
+    "rate = (int) [ 1, %d ], " "channels = (int) [ 1, 8 ]; " \
+    "audio/x-raw-int, " \
+    "endianness = (int) " G_STRINGIFY (G_BYTE_ORDER) ", " \
+    "signed = (boolean) TRUE, " \
+    "width = (int) 24, " \
+    "depth = (int) 24, " \
+    "rate = (int) [ 1, %d ], " "channels = (int) [ 1, 8 ]; " \
+    "audio/x-raw-float, " \
+    "endianness = (int) " G_STRINGIFY (G_BYTE_ORDER) ", " \
+    "width = (int) 32, " \
+    "rate = (int) [ 1, %d ], " "channels = (int) [ 1, 8 ]"
+
+/* the output is probed once per process */
+G_LOCK_DEFINE_STATIC (probe);
+static GstCaps *probed_output_caps = NULL;
+
 static GstElementClass *parent_class = NULL;
 
+/*
+ * GstAudioFlingerRingBuffer
+ *
+ * In callback mode, AudioTrack's callback thread reads segments of the ring
+ * buffer directly (EVENT_MORE_DATA), instead of a GstAudioSink thread which
+ * writes them with AudioTrack::write().
+ */
+#define GST_TYPE_AUDIOFLINGER_RING_BUFFER \
+    (gst_audioflinger_ring_buffer_get_type())
+#define GST_AUDIOFLINGER_RING_BUFFER(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_AUDIOFLINGER_RING_BUFFER,GstAudioFlingerRingBuffer))
+
+typedef struct _GstAudioFlingerRingBuffer GstAudioFlingerRingBuffer;
+typedef struct _GstAudioFlingerRingBufferClass GstAudioFlingerRingBufferClass;
+
+struct _GstAudioFlingerRingBuffer
+{
+  GstRingBuffer object;
+
+  /* protects data against release while the callback reads it */
+  GMutex *lock;
+  /* bytes of current segment already given to AudioTrack */
+  gint segoffset;
+};
+
+struct _GstAudioFlingerRingBufferClass
+{
+  GstRingBufferClass parent_class;
+};
+
+static void gst_audioflinger_ring_buffer_class_init (
+    GstAudioFlingerRingBufferClass * klass);
+static void gst_audioflinger_ring_buffer_init (
+    GstAudioFlingerRingBuffer * ringbuffer, 
+    GstAudioFlingerRingBufferClass * klass);
+static void gst_audioflinger_ring_buffer_finalize (GObject * object);
+
+static gboolean gst_audioflinger_ring_buffer_open_device (
+    GstRingBuffer * buf);
+static gboolean gst_audioflinger_ring_buffer_close_device (
+    GstRingBuffer * buf);
+static gboolean gst_audioflinger_ring_buffer_acquire (GstRingBuffer * buf,
+    GstRingBufferSpec * spec);
+static gboolean gst_audioflinger_ring_buffer_release (GstRingBuffer * buf);
+static gboolean gst_audioflinger_ring_buffer_start (GstRingBuffer * buf);
+static gboolean gst_audioflinger_ring_buffer_pause (GstRingBuffer * buf);
+static gboolean gst_audioflinger_ring_buffer_stop (GstRingBuffer * buf);
+static guint gst_audioflinger_ring_buffer_delay (GstRingBuffer * buf);
+
+static GstRingBufferClass *ring_parent_class = NULL;
+
+static GType
+gst_audioflinger_ring_buffer_get_type (void)
+{
+  static GType ringbuffer_type = 0;
+
+  if (!ringbuffer_type) {
+    static const GTypeInfo ringbuffer_info = {
+      sizeof (GstAudioFlingerRingBufferClass),
+      NULL,
+      NULL,
+      (GClassInitFunc) gst_audioflinger_ring_buffer_class_init,
+      NULL,
+      NULL,
+      sizeof (GstAudioFlingerRingBuffer),
+      0,
+      (GInstanceInitFunc) gst_audioflinger_ring_buffer_init,
+      NULL
+    };
+
+    ringbuffer_type =
+        g_type_register_static (GST_TYPE_RING_BUFFER,
+        "GstAudioFlingerRingBuffer", &ringbuffer_info, 0);
+  }
+  return ringbuffer_type;
+}
+
+static void
+gst_audioflinger_ring_buffer_class_init (GstAudioFlingerRingBufferClass * klass)
+{
+  GObjectClass *gobject_class;
+  GstRingBufferClass *gstringbuffer_class;
+
+  gobject_class = (GObjectClass *) klass;
+  gstringbuffer_class = (GstRingBufferClass *) klass;
+
+  ring_parent_class = g_type_class_peek_parent (klass);
+
+  gobject_class->finalize = 
+      GST_DEBUG_FUNCPTR (gst_audioflinger_ring_buffer_finalize);
+
+  gstringbuffer_class->open_device =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_ring_buffer_open_device);
+  gstringbuffer_class->close_device =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_ring_buffer_close_device);
+  gstringbuffer_class->acquire =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_ring_buffer_acquire);
+  gstringbuffer_class->release =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_ring_buffer_release);
+  gstringbuffer_class->start =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_ring_buffer_start);
+  gstringbuffer_class->resume =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_ring_buffer_start);
+  gstringbuffer_class->pause =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_ring_buffer_pause);
+  gstringbuffer_class->stop =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_ring_buffer_stop);
+  gstringbuffer_class->delay =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_ring_buffer_delay);
+}
+
+static void
+gst_audioflinger_ring_buffer_init (GstAudioFlingerRingBuffer * ringbuffer,
+    GstAudioFlingerRingBufferClass * g_class)
+{
+  ringbuffer->lock = g_mutex_new ();
+  ringbuffer->segoffset = 0;
+}
+
+static void
+gst_audioflinger_ring_buffer_finalize (GObject * object)
+{
+  GstAudioFlingerRingBuffer *ringbuffer = 
+      GST_AUDIOFLINGER_RING_BUFFER (object);
+
+  g_mutex_free (ringbuffer->lock);
+
+  G_OBJECT_CLASS (ring_parent_class)->finalize (object);
+}
+
+static void
+gst_audioflinger_ring_buffer_fill_silence (GstRingBuffer * buf,
+    guint8 * dest, gint len)
+{
+  gint i;
+
+  /* silence_sample repeats the silence of one sample */
+  for (i = 0; i < len; i++)
+    dest[i] = buf->spec.silence_sample[i % 32];
+}
+
+/* AudioTrack callback, in AudioTrack's thread. It always fills the whole
+ * request, with silence if ring buffer isn't started, otherwise AudioTrack
+ * calls it again at once. */
+static size_t
+gst_audioflinger_ring_buffer_callback (void *user, void *data, size_t size)
+{
+  GstRingBuffer *buf = GST_RING_BUFFER (user);
+  GstAudioFlingerRingBuffer *abuf = GST_AUDIOFLINGER_RING_BUFFER (user);
+  GstAudioFlingerSink *sink;
+  guint8 *dest = (guint8 *) data;
+  gint left = (gint) size;
+  GstClockTime start = gst_util_get_timestamp ();
+
+  g_mutex_lock (abuf->lock);
+  sink = GST_AUDIOFLINGERSINK (GST_OBJECT_PARENT (buf));
+
+  while (left > 0 && buf->data != NULL) {
+    gint segment, len, frames;
+    guint8 *readptr;
+
+    if (!gst_ring_buffer_prepare_read (buf, &segment, &readptr, &len))
+      break;
+
+    /* segments hold input frames, AudioTrack takes converted ones */
+    frames = MIN ((len - abuf->segoffset) / sink->bytes_per_sample,
+        left / sink->out_bytes_per_sample);
+    if (frames == 0)
+      break;
+    gst_audioflinger_sink_convert (sink, readptr + abuf->segoffset, dest,
+        frames);
+    gst_audioflinger_sink_apply_gain (sink, dest, frames, FALSE);
+    abuf->segoffset += frames * sink->bytes_per_sample;
+    dest += frames * sink->out_bytes_per_sample;
+    left -= frames * sink->out_bytes_per_sample;
+
+    /* segment is consumed, clear it and wake up the writer. Advancing takes
+     * the object lock, which release() holds when it takes our lock. */
+    if (abuf->segoffset == len) {
+      gst_ring_buffer_clear (buf, segment);
+      abuf->segoffset = 0;
+      g_mutex_unlock (abuf->lock);
+      gst_ring_buffer_advance (buf, 1);
+      g_mutex_lock (abuf->lock);
+    }
+  }
+  if (left > 0) {
+    if (sink->convert_format == AUDIOFLINGER_CONVERT_NONE)
+      gst_audioflinger_ring_buffer_fill_silence (buf, dest, left);
+    else
+      memset (dest, 0, left);
+  }
+
+  if (sink->out_bytes_per_sample > 0)
+    sink->frames_written += size / sink->out_bytes_per_sample;
+  /* what's padded with silence is short */
+  gst_audioflinger_sink_stats_record (sink, size - left, size, 
+      gst_util_get_timestamp () - start, FALSE);
+  g_mutex_unlock (abuf->lock);
+
+  /* stats are posted by the streaming thread, see render() */
+  return size;
+}
+
+static gboolean
+gst_audioflinger_ring_buffer_open_device (GstRingBuffer * buf)
+{
+  GstAudioSink *sink = GST_AUDIO_SINK (GST_OBJECT_PARENT (buf));
+
+  return gst_audioflinger_sink_open (sink);
+}
+
+static gboolean
+gst_audioflinger_ring_buffer_close_device (GstRingBuffer * buf)
+{
+  GstAudioSink *sink = GST_AUDIO_SINK (GST_OBJECT_PARENT (buf));
+
+  return gst_audioflinger_sink_close (sink);
+}
+
+static gboolean
+gst_audioflinger_ring_buffer_acquire (GstRingBuffer * buf,
+    GstRingBufferSpec * spec)
+{
+  GstAudioFlingerRingBuffer *abuf = GST_AUDIOFLINGER_RING_BUFFER (buf);
+  GstAudioFlingerSink *sink = GST_AUDIOFLINGERSINK (GST_OBJECT_PARENT (buf));
+  GstBuffer *data;
+
+  /* allocate the ring buffer memory before AudioTrack may call back */
+  spec->bytes_per_sample = (spec->width / 8) * spec->channels;
+  data = gst_buffer_new_and_alloc (spec->segtotal * spec->segsize);
+  gst_audioflinger_ring_buffer_fill_silence (buf, GST_BUFFER_DATA (data),
+      GST_BUFFER_SIZE (data));
+
+  g_mutex_lock (abuf->lock);
+  buf->data = data;
+  abuf->segoffset = 0;
+  g_mutex_unlock (abuf->lock);
+
+  if (!gst_audioflinger_sink_setup (sink, spec, buf)) {
+    g_mutex_lock (abuf->lock);
+    buf->data = NULL;
+    g_mutex_unlock (abuf->lock);
+    gst_buffer_unref (data);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static gboolean
+gst_audioflinger_ring_buffer_release (GstRingBuffer * buf)
+{
+  GstAudioFlingerRingBuffer *abuf = GST_AUDIOFLINGER_RING_BUFFER (buf);
+  GstAudioSink *sink = GST_AUDIO_SINK (GST_OBJECT_PARENT (buf));
+  GstBuffer *data;
+
+  gst_audioflinger_sink_unprepare (sink);
+
+  /* the callback may still be running until AudioTrack's thread exits */
+  g_mutex_lock (abuf->lock);
+  data = buf->data;
+  buf->data = NULL;
+  g_mutex_unlock (abuf->lock);
+
+  if (data)
+    gst_buffer_unref (data);
+  return TRUE;
+}
+
+static gboolean
+gst_audioflinger_ring_buffer_start (GstRingBuffer * buf)
+{
+  GstAudioFlingerSink *sink = GST_AUDIOFLINGERSINK (GST_OBJECT_PARENT (buf));
+
+  GST_DEBUG_OBJECT (sink, "start device");
+  audioflinger_device_start (sink->audioflinger_device);
+  return TRUE;
+}
+
+static gboolean
+gst_audioflinger_ring_buffer_pause (GstRingBuffer * buf)
+{
+  GstAudioFlingerSink *sink = GST_AUDIOFLINGERSINK (GST_OBJECT_PARENT (buf));
+
+  GST_DEBUG_OBJECT (sink, "pause device");
+  audioflinger_device_pause (sink->audioflinger_device);
+  return TRUE;
+}
+
+static gboolean
+gst_audioflinger_ring_buffer_stop (GstRingBuffer * buf)
+{
+  GstAudioFlingerSink *sink = GST_AUDIOFLINGERSINK (GST_OBJECT_PARENT (buf));
+
+  GST_DEBUG_OBJECT (sink, "stop device");
+  audioflinger_device_stop (sink->audioflinger_device);
+  return TRUE;
+}
+
+static guint
+gst_audioflinger_ring_buffer_delay (GstRingBuffer * buf)
+{
+  GstAudioSink *sink = GST_AUDIO_SINK (GST_OBJECT_PARENT (buf));
+
+  return gst_audioflinger_sink_delay (sink);
+}
+
 GType
 gst_audioflinger_sink_get_type (void)
 {
@@ -185,6 +653,10 @@ gst_audioflinger_sink_class_init (GstAudioFlingerSinkClass * klass)
       GST_DEBUG_FUNCPTR (gst_audioflinger_sink_change_state); 
   gstbasesink_class->get_caps =
       GST_DEBUG_FUNCPTR (gst_audioflinger_sink_getcaps);
+  gstbasesink_class->event = GST_DEBUG_FUNCPTR (gst_audioflinger_sink_event);
+  gstbasesink_class->render = GST_DEBUG_FUNCPTR (gst_audioflinger_sink_render);
+  gstbaseaudiosink_class->create_ringbuffer =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_sink_create_ringbuffer);
 
   gstaudiosink_class->open = GST_DEBUG_FUNCPTR (gst_audioflinger_sink_open);
   gstaudiosink_class->close = GST_DEBUG_FUNCPTR (gst_audioflinger_sink_close);
@@ -193,8 +665,7 @@ gst_audioflinger_sink_class_init (GstAudioFlingerSinkClass * klass)
   gstaudiosink_class->unprepare =
       GST_DEBUG_FUNCPTR (gst_audioflinger_sink_unprepare);
   gstaudiosink_class->write = GST_DEBUG_FUNCPTR (gst_audioflinger_sink_write);
-  /* Edward : AFAICS, we have no way of knowing how many samples were already read */
-  /*   gstaudiosink_class->delay = GST_DEBUG_FUNCPTR (gst_audioflinger_sink_delay); */
+  gstaudiosink_class->delay = GST_DEBUG_FUNCPTR (gst_audioflinger_sink_delay);
 
   /* Install properties */
   g_object_class_install_property (gobject_class, PROP_MUTE,
@@ -206,13 +677,150 @@ gst_audioflinger_sink_class_init (GstAudioFlingerSinkClass * klass)
   g_object_class_install_property (gobject_class, PROP_AUDIO_SINK,
       g_param_spec_pointer("audiosink", "AudioSink",
           "The pointer of MediaPlayerBase::AudioSink", G_PARAM_WRITABLE));
+  g_object_class_install_property (gobject_class, PROP_CALLBACK_MODE,
+      g_param_spec_boolean ("callback-mode", "Callback mode",
+          "AudioTrack pulls data by callback instead of a write thread, "
+          "not supported with audiosink", DEFAULT_CALLBACK_MODE, 
+          G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_STREAM_TYPE,
+      g_param_spec_int ("stream-type", "Stream type",
+          "AudioSystem stream type of the track, not used with audiosink",
+          0, G_MAXINT, DEFAULT_STREAM_TYPE, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_PROFILE,
+      g_param_spec_enum ("profile", "Profile",
+          "Buffering profile, it overrides buffer-time and latency-time "
+          "unless it's default", GST_TYPE_AUDIOFLINGERSINK_PROFILE,
+          DEFAULT_PROFILE, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_UNDERRUNS,
+      g_param_spec_uint ("underruns", "Underruns",
+          "Times the track ran out of data since it's prepared",
+          0, G_MAXUINT, 0, G_PARAM_READABLE));
+  g_object_class_install_property (gobject_class, PROP_GAIN,
+      g_param_spec_float ("gain", "Gain",
+          "Software gain applied to written data, for fades and ducking",
+          0.0, AUDIOFLINGER_GAIN_MAX, DEFAULT_GAIN, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_RAMP_TIME,
+      g_param_spec_uint ("ramp-time", "Ramp time",
+          "Time in ms to ramp to a new gain or to/from mute, 0 at once",
+          0, G_MAXUINT, DEFAULT_RAMP_TIME, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_RAMP_SHAPE,
+      g_param_spec_enum ("ramp-shape", "Ramp shape",
+          "Shape of gain ramps", GST_TYPE_AUDIOFLINGERSINK_RAMP_SHAPE,
+          DEFAULT_RAMP_SHAPE, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_RESAMPLE_QUALITY,
+      g_param_spec_enum ("resample-quality", "Resample quality",
+          "Resample to the native output rate, so that AudioFlinger's mixer "
+          "doesn't, not used in callback mode",
+          GST_TYPE_AUDIOFLINGERSINK_RESAMPLE_QUALITY,
+          DEFAULT_RESAMPLE_QUALITY, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Telemetry of writes since the device is set: bytes, writes, "
+          "blocked-time (ns), short-writes, failures, underruns, "
+          "write-time, a histogram of write durations, and writes-per-second",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics interval",
+          "Interval in ms to post stats as element messages, 0 to not post",
+          0, G_MAXUINT, DEFAULT_STATS_INTERVAL, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_COALESCE_SIZE,
+      g_param_spec_uint ("coalesce-size", "Coalesce size",
+          "Gather segments up to this many bytes before writing them to the "
+          "track, 0 to write each one, not used in callback mode",
+          0, G_MAXUINT, DEFAULT_COALESCE_SIZE, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_COALESCE_LATENCY,
+      g_param_spec_uint ("coalesce-latency", "Coalesce latency",
+          "Most time in ms gathered segments wait before they are written",
+          1, G_MAXUINT, DEFAULT_COALESCE_LATENCY, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_SHARED_MIXER,
+      g_param_spec_boolean ("shared-mixer", "Shared mixer",
+          "Mix with other sinks of the process into one track of the stream "
+          "type, data is resampled to its rate. Not supported with "
+          "audiosink, it overrides callback-mode", DEFAULT_SHARED_MIXER,
+          G_PARAM_READWRITE));
+}
+
+GType
+gst_audioflinger_sink_resample_quality_get_type (void)
+{
+  static GType resample_quality_type = 0;
+
+  if (!resample_quality_type) {
+    static const GEnumValue qualities[] = {
+      {AUDIOFLINGER_RESAMPLE_NONE, "Leave resampling to the mixer", "none"},
+      {AUDIOFLINGER_RESAMPLE_LOW, "8 taps per phase", "low"},
+      {AUDIOFLINGER_RESAMPLE_MEDIUM, "16 taps per phase", "medium"},
+      {AUDIOFLINGER_RESAMPLE_HIGH, "32 taps per phase", "high"},
+      {0, NULL, NULL}
+    };
+
+    resample_quality_type = g_enum_register_static (
+        "GstAudioFlingerSinkResampleQuality", qualities);
+  }
+  return resample_quality_type;
+}
+
+GType
+gst_audioflinger_sink_ramp_shape_get_type (void)
+{
+  static GType ramp_shape_type = 0;
+
+  if (!ramp_shape_type) {
+    static const GEnumValue shapes[] = {
+      {AUDIOFLINGER_RAMP_LINEAR, "Constant step of gain", "linear"},
+      {AUDIOFLINGER_RAMP_LOG, "Constant step in dB", "log"},
+      {0, NULL, NULL}
+    };
+
+    ramp_shape_type = g_enum_register_static ("GstAudioFlingerSinkRampShape",
+        shapes);
+  }
+  return ramp_shape_type;
+}
+
+GType
+gst_audioflinger_sink_profile_get_type (void)
+{
+  static GType profile_type = 0;
+
+  if (!profile_type) {
+    static const GEnumValue profiles[] = {
+      {GST_AUDIOFLINGER_SINK_PROFILE_DEFAULT, 
+          "Use buffer-time and latency-time", "default"},
+      {GST_AUDIOFLINGER_SINK_PROFILE_LOW_LATENCY, 
+          "Small segments and minimal track buffer", "low-latency"},
+      {GST_AUDIOFLINGER_SINK_PROFILE_DEEP_BUFFER, 
+          "Large segments and few wakeups", "deep-buffer"},
+      {0, NULL, NULL}
+    };
+
+    profile_type = g_enum_register_static ("GstAudioFlingerSinkProfile", 
+        profiles);
+  }
+  return profile_type;
 }
 
 static void
 gst_audioflinger_sink_init (GstAudioFlingerSink * audioflinger_sink)
 {
+  GstBaseAudioSink *baseaudiosink = (GstBaseAudioSink *) audioflinger_sink;
+
   GST_DEBUG_OBJECT (audioflinger_sink, "initializing audioflinger_sink");
   gst_audioflinger_sink_reset (audioflinger_sink);
+
+  /* the clock follows the playback head of the track, rather than the
+   * samples handed to it */
+  gst_object_unref (baseaudiosink->provided_clock);
+  baseaudiosink->provided_clock = gst_audio_clock_new (
+      "GstAudioFlingerSinkClock", (GstAudioClockGetTimeFunc) gst_audioflinger_sink_get_time,
+      audioflinger_sink);
+
+  /* set our defaults here instead of in open(), so that buffer-time and
+   * latency-time set by the application are not overwritten */
+  baseaudiosink->buffer_time = DEFAULT_BUFFERTIME;
+  baseaudiosink->latency_time = DEFAULT_LATENCYTIME;
+  audioflinger_sink->default_buffer_time = DEFAULT_BUFFERTIME;
+  audioflinger_sink->default_latency_time = DEFAULT_LATENCYTIME;
 }
 
 static void
@@ -229,6 +837,78 @@ gst_audioflinger_sink_reset (GstAudioFlingerSink * asink)
   asink->m_mute = DEFAULT_MUTE;
   asink->m_init = FALSE;
   asink->m_audiosink = NULL;
+  asink->rate = 0;
+  asink->frames_written = 0;
+  asink->direct_write = TRUE;
+  asink->flushing = FALSE;
+  asink->reprime = FALSE;
+  asink->played_time = 0;
+  asink->head_frames = 0;
+  asink->head_position = 0;
+  asink->coalesce_size = DEFAULT_COALESCE_SIZE;
+  asink->coalesce_latency = DEFAULT_COALESCE_LATENCY;
+  asink->coalesce_chunk = 0;
+  g_free (asink->coalesce_buf);
+  asink->coalesce_buf = NULL;
+  asink->coalesce_buf_size = 0;
+  asink->coalesce_len = 0;
+  memset (&asink->stats, 0, sizeof (asink->stats));
+  asink->stats_interval = DEFAULT_STATS_INTERVAL;
+  asink->stats_posted = GST_CLOCK_TIME_NONE;
+  asink->callback_mode = DEFAULT_CALLBACK_MODE;
+  asink->shared_mixer = DEFAULT_SHARED_MIXER;
+  asink->stream_type = DEFAULT_STREAM_TYPE;
+  asink->profile = DEFAULT_PROFILE;
+  asink->convert_format = AUDIOFLINGER_CONVERT_NONE;
+  asink->channels = 0;
+  asink->out_bytes_per_sample = 0;
+  g_free (asink->convert_buf);
+  asink->convert_buf = NULL;
+  asink->convert_buf_size = 0;
+  asink->gain_value = DEFAULT_GAIN;
+  asink->ramp_time = DEFAULT_RAMP_TIME;
+  asink->ramp_shape = DEFAULT_RAMP_SHAPE;
+  audioflinger_gain_init (&asink->gain, DEFAULT_GAIN);
+  asink->resample_quality = DEFAULT_RESAMPLE_QUALITY;
+  audioflinger_resampler_free (asink->resampler);
+  asink->resampler = NULL;
+  asink->device_rate = 0;
+  g_free (asink->resample_buf);
+  asink->resample_buf = NULL;
+  asink->resample_buf_size = 0;
+}
+
+/*
+ * Set buffer-time and latency-time of the profile, they take effect when the
+ * ring buffer is acquired. The times set while the default profile is used
+ * are kept aside, and restored when it's selected again.
+ */
+static void
+gst_audioflinger_sink_apply_profile (GstAudioFlingerSink * audioflinger_sink,
+    GstAudioFlingerSinkProfile profile)
+{
+  GstBaseAudioSink *baseaudiosink = (GstBaseAudioSink *) audioflinger_sink;
+
+  if (audioflinger_sink->profile == GST_AUDIOFLINGER_SINK_PROFILE_DEFAULT) {
+    audioflinger_sink->default_buffer_time = baseaudiosink->buffer_time;
+    audioflinger_sink->default_latency_time = baseaudiosink->latency_time;
+  }
+  audioflinger_sink->profile = profile;
+
+  switch (profile) {
+    case GST_AUDIOFLINGER_SINK_PROFILE_LOW_LATENCY:
+      baseaudiosink->buffer_time = LOW_LATENCY_BUFFERTIME;
+      baseaudiosink->latency_time = LOW_LATENCY_LATENCYTIME;
+      break;
+    case GST_AUDIOFLINGER_SINK_PROFILE_DEEP_BUFFER:
+      baseaudiosink->buffer_time = DEEP_BUFFER_BUFFERTIME;
+      baseaudiosink->latency_time = DEEP_BUFFER_LATENCYTIME;
+      break;
+    default:
+      baseaudiosink->buffer_time = audioflinger_sink->default_buffer_time;
+      baseaudiosink->latency_time = audioflinger_sink->default_latency_time;
+      break;
+  }
 }
 
 static void
@@ -267,6 +947,47 @@ gst_audioflinger_sink_get_property (GObject * object, guint prop_id,
     case PROP_AUDIO_SINK:
       GST_ERROR_OBJECT(audioflinger_sink, "Shall not go here!");
       break;
+    case PROP_CALLBACK_MODE:
+      g_value_set_boolean (value, audioflinger_sink->callback_mode);
+      break;
+    case PROP_STREAM_TYPE:
+      g_value_set_int (value, audioflinger_sink->stream_type);
+      break;
+    case PROP_PROFILE:
+      g_value_set_enum (value, audioflinger_sink->profile);
+      break;
+    case PROP_UNDERRUNS:
+      g_value_set_uint (value, (guint) audioflinger_device_underruns (
+              audioflinger_sink->audioflinger_device));
+      break;
+    case PROP_GAIN:
+      g_value_set_float (value, audioflinger_sink->gain_value);
+      break;
+    case PROP_RAMP_TIME:
+      g_value_set_uint (value, audioflinger_sink->ramp_time);
+      break;
+    case PROP_RAMP_SHAPE:
+      g_value_set_enum (value, audioflinger_sink->ramp_shape);
+      break;
+    case PROP_RESAMPLE_QUALITY:
+      g_value_set_enum (value, audioflinger_sink->resample_quality);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, 
+          gst_audioflinger_sink_stats_get (audioflinger_sink));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, audioflinger_sink->stats_interval);
+      break;
+    case PROP_COALESCE_SIZE:
+      g_value_set_uint (value, audioflinger_sink->coalesce_size);
+      break;
+    case PROP_COALESCE_LATENCY:
+      g_value_set_uint (value, audioflinger_sink->coalesce_latency);
+      break;
+    case PROP_SHARED_MIXER:
+      g_value_set_boolean (value, audioflinger_sink->shared_mixer);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -284,13 +1005,11 @@ gst_audioflinger_sink_set_property (GObject * object, guint prop_id,
   GST_OBJECT_LOCK (audioflinger_sink);
   switch (prop_id) {
     case PROP_MUTE:
-      audioflinger_sink->m_mute = g_value_get_boolean (value);
       GST_DEBUG_OBJECT (audioflinger_sink, "set mute: %d", 
-              audioflinger_sink->m_mute);
-      /* set device if it's initialized */
-      if(audioflinger_sink->audioflinger_device && audioflinger_sink->m_init)
-        gst_audioflinger_sink_set_mute (audioflinger_sink, 
-                (int)(audioflinger_sink->m_mute));
+              g_value_get_boolean (value));
+      /* ramped in software, the same for AudioTrack and AudioSink */
+      gst_audioflinger_sink_set_mute (audioflinger_sink, 
+              g_value_get_boolean (value));
       break;
     case PROP_VOLUME:
       audioflinger_sink->m_volume = g_value_get_float (value);
@@ -299,13 +1018,65 @@ gst_audioflinger_sink_set_property (GObject * object, guint prop_id,
       /* set device if it's initialized */
       if(audioflinger_sink->audioflinger_device && audioflinger_sink->m_init)
         gst_audioflinger_sink_set_volume (audioflinger_sink, 
-                (int)(audioflinger_sink->m_volume*100));
+                audioflinger_sink->m_volume);
       break;
     case PROP_AUDIO_SINK:
       audioflinger_sink->m_audiosink = g_value_get_pointer (value);
       GST_DEBUG_OBJECT (audioflinger_sink, "set audiosink: %p", 
               audioflinger_sink->m_audiosink);
       break;      
+    case PROP_CALLBACK_MODE:
+      /* takes effect when the ring buffer is created, in NULL to READY */
+      audioflinger_sink->callback_mode = g_value_get_boolean (value);
+      GST_DEBUG_OBJECT (audioflinger_sink, "set callback mode: %d", 
+              audioflinger_sink->callback_mode);
+      break;
+    case PROP_STREAM_TYPE:
+      /* takes effect when the device is set, in READY to PAUSED */
+      audioflinger_sink->stream_type = g_value_get_int (value);
+      GST_DEBUG_OBJECT (audioflinger_sink, "set stream type: %d", 
+              audioflinger_sink->stream_type);
+      break;
+    case PROP_PROFILE:
+      gst_audioflinger_sink_apply_profile (audioflinger_sink, 
+              g_value_get_enum (value));
+      GST_DEBUG_OBJECT (audioflinger_sink, "set profile: %d", 
+              audioflinger_sink->profile);
+      break;
+    case PROP_GAIN:
+      audioflinger_sink->gain_value = g_value_get_float (value);
+      GST_DEBUG_OBJECT (audioflinger_sink, "set gain: %f", 
+              audioflinger_sink->gain_value);
+      gst_audioflinger_sink_update_gain (audioflinger_sink);
+      break;
+    case PROP_RAMP_TIME:
+      audioflinger_sink->ramp_time = g_value_get_uint (value);
+      break;
+    case PROP_RAMP_SHAPE:
+      audioflinger_sink->ramp_shape = g_value_get_enum (value);
+      break;
+    case PROP_RESAMPLE_QUALITY:
+      /* takes effect when the device is set, in READY to PAUSED */
+      audioflinger_sink->resample_quality = g_value_get_enum (value);
+      GST_DEBUG_OBJECT (audioflinger_sink, "set resample quality: %d", 
+              audioflinger_sink->resample_quality);
+      break;
+    case PROP_STATS_INTERVAL:
+      audioflinger_sink->stats_interval = g_value_get_uint (value);
+      break;
+    /* take effect when the device is set, in READY to PAUSED */
+    case PROP_COALESCE_SIZE:
+      audioflinger_sink->coalesce_size = g_value_get_uint (value);
+      break;
+    case PROP_COALESCE_LATENCY:
+      audioflinger_sink->coalesce_latency = g_value_get_uint (value);
+      break;
+    case PROP_SHARED_MIXER:
+      /* takes effect when the device is created, in NULL to READY */
+      audioflinger_sink->shared_mixer = g_value_get_boolean (value);
+      GST_DEBUG_OBJECT (audioflinger_sink, "set shared mixer: %d", 
+              audioflinger_sink->shared_mixer);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -321,18 +1092,58 @@ gst_audioflinger_sink_getcaps (GstBaseSink * bsink)
 
   audioflinger_sink = GST_AUDIOFLINGERSINK (bsink);
   GST_DEBUG_OBJECT (audioflinger_sink, "enter,%p", audioflinger_sink->audioflinger_device);
-  if (audioflinger_sink->audioflinger_device == NULL 
-    || audioflinger_sink->m_init == FALSE) {
+  /* getcaps may be called in several threads at once. Probe outside the
+   * lock, the first probed caps are kept */
+  GST_OBJECT_LOCK (audioflinger_sink);
+  caps = audioflinger_sink->probed_caps ? 
+      gst_caps_ref (audioflinger_sink->probed_caps) : NULL;
+  GST_OBJECT_UNLOCK (audioflinger_sink);
+  if (caps == NULL) {
+    GstCaps *probed = gst_audioflinger_sink_probe_caps ();
+
+    GST_OBJECT_LOCK (audioflinger_sink);
+    if (audioflinger_sink->probed_caps == NULL)
+      audioflinger_sink->probed_caps = probed;
+    else if (probed)
+      gst_caps_unref (probed);
+    caps = audioflinger_sink->probed_caps ? 
+        gst_caps_ref (audioflinger_sink->probed_caps) : NULL;
+    GST_OBJECT_UNLOCK (audioflinger_sink);
+  }
+
+  if (caps == NULL) {
     caps = gst_caps_copy (gst_pad_get_pad_template_caps (GST_BASE_SINK_PAD
             (bsink)));
-  } else if (audioflinger_sink->probed_caps) {
-    caps = gst_caps_copy (audioflinger_sink->probed_caps);
-  } else {
-    caps = gst_caps_new_any ();
-    if (caps && !gst_caps_is_empty (caps)) {
-      audioflinger_sink->probed_caps = gst_caps_copy (caps);
+  }
+
+  return caps;
+}
+
+/*
+ * Probe the caps of AudioFlinger's output, or return those probed before.
+ * Return NULL if its rate is unknown, e.g. the service isn't running yet.
+ */
+static GstCaps *
+gst_audioflinger_sink_probe_caps (void)
+{
+  GstCaps *caps = NULL;
+  gint rate;
+
+  G_LOCK (probe);
+  if (probed_output_caps == NULL) {
+    rate = audioflinger_device_native_rate ();
+    if (rate > 0) {
+      gchar *str = g_strdup_printf (PROBED_CAPS_FORMAT, rate, 2 * rate,
+          2 * rate, 2 * rate, 2 * rate, 2 * rate);
+
+      probed_output_caps = gst_caps_from_string (str);
+      g_free (str);
+      GST_INFO ("probed output caps %" GST_PTR_FORMAT, probed_output_caps);
     }
   }
+  if (probed_output_caps)
+    caps = gst_caps_ref (probed_output_caps);
+  G_UNLOCK (probe);
 
   return caps;
 }
@@ -341,14 +1152,10 @@ static gboolean
 gst_audioflinger_sink_open (GstAudioSink * asink)
 {
   GstAudioFlingerSink *audioflinger = GST_AUDIOFLINGERSINK (asink);
-  GstBaseAudioSink *baseaudiosink = (GstBaseAudioSink *) audioflinger;
 
   GST_DEBUG_OBJECT (audioflinger, "enter");
   g_return_val_if_fail (audioflinger != NULL, FALSE);
 
-  baseaudiosink->buffer_time = DEFAULT_BUFFERTIME;
-  baseaudiosink->latency_time = DEFAULT_LATENCYTIME;
-
   if (audioflinger->audioflinger_device == NULL) {
     if (audioflinger->m_audiosink)  {
       if (!(audioflinger->audioflinger_device = 
@@ -357,6 +1164,13 @@ gst_audioflinger_sink_open (GstAudioSink * asink)
       GST_DEBUG_OBJECT (audioflinger, "open an existed flinger, %p", 
             audioflinger->audioflinger_device);
     }
+    else if (audioflinger->shared_mixer) {
+      if (!(audioflinger->audioflinger_device = 
+            audioflinger_device_create_mixed ()))
+        goto failed_creation;
+      GST_DEBUG_OBJECT (audioflinger, "create a mixed flinger, %p", 
+            audioflinger->audioflinger_device);
+    }
     else {
       if (!(audioflinger->audioflinger_device = audioflinger_device_create ()))
         goto failed_creation;
@@ -394,12 +1208,33 @@ gst_audioflinger_sink_close (GstAudioSink * asink)
 static gboolean
 gst_audioflinger_sink_prepare (GstAudioSink * asink, GstRingBufferSpec * spec)
 {
-  GstAudioFlingerSink *audioflinger;
+  return gst_audioflinger_sink_setup (GST_AUDIOFLINGERSINK (asink), spec, 
+      NULL);
+}
 
-  audioflinger = GST_AUDIOFLINGERSINK (asink);
+/*
+ * Set the device for spec. With ringbuffer, AudioTrack reads its segments by
+ * callback, one notification per segment; otherwise data is written.
+ */
+static gboolean
+gst_audioflinger_sink_setup (GstAudioFlingerSink * audioflinger, 
+    GstRingBufferSpec * spec, GstRingBuffer * ringbuffer)
+{
+  gint ret;
 
   GST_DEBUG_OBJECT (audioflinger, "enter");
 
+  /* the track may be replaced, the clock keeps the time it played */
+  GST_OBJECT_LOCK (audioflinger);
+  gst_audioflinger_sink_save_played (audioflinger);
+  audioflinger->m_init = FALSE;
+  GST_OBJECT_UNLOCK (audioflinger);
+
+  if (!gst_audioflinger_sink_set_convert (audioflinger, spec))
+    goto dodgy_width;
+  gst_audioflinger_sink_set_resampler (audioflinger, spec, 
+      ringbuffer != NULL);
+
   /* FIXME: 
    * 
    * Pipeline crashes in audioflinger_device_set(), after releasing audio
@@ -410,17 +1245,86 @@ gst_audioflinger_sink_prepare (GstAudioSink * asink, GstRingBufferSpec * spec)
    * different thread in playbin2. Till now, I haven't found way to
    * create/release device in the same thread. Fortunately, it will not effect
    * the gst-launch usage 
+   *
+   * The device keeps its track across prepare and unprepare, it's only
+   * recreated when rate, channels or buffer size change, so replay and
+   * looping neither create a new one nor wait for it.
    */
-  if( audioflinger_device_set (audioflinger->audioflinger_device, 
-        3, spec->channels, spec->rate,
-        spec->segsize) == -1)
+  if (ringbuffer) {
+    gint bytes_per_sample = (spec->width / 8) * spec->channels;
+
+    /* track buffer holds two segments, refilled one at a time */
+    ret = audioflinger_device_set_callback (audioflinger->audioflinger_device,
+        audioflinger->stream_type, 
+        audioflinger_convert_out_channels (spec->channels), spec->rate, 
+        2 * spec->segsize / bytes_per_sample,
+        gst_audioflinger_ring_buffer_callback, ringbuffer,
+        spec->segsize / bytes_per_sample);
+  }
+  else {
+    gint frame_count;
+
+    if (audioflinger->m_audiosink) {
+      /* for audiosink, it's the buffer count passed to open() */
+      frame_count = AUDIOSINK_BUFFER_COUNT;
+    }
+    else if (audioflinger->profile == 
+        GST_AUDIOFLINGER_SINK_PROFILE_LOW_LATENCY) {
+      /* AudioTrack picks its minimal frame count */
+      frame_count = 0;
+    }
+    else {
+      /* track buffer holds two segments, in frames at the device rate */
+      frame_count = (gint) ((gint64) 2 * spec->segsize / 
+          ((spec->width / 8) * spec->channels) * 
+          audioflinger->device_rate / spec->rate);
+    }
+    ret = audioflinger_device_set (audioflinger->audioflinger_device, 
+        audioflinger->stream_type, 
+        audioflinger_convert_out_channels (spec->channels), 
+        audioflinger->device_rate, frame_count);
+  }
+  if (ret == -1)
       goto failed_creation;
 
-  audioflinger->m_init = TRUE;
+  GST_DEBUG_OBJECT (audioflinger, "convert format: %d, channels: %d",
+      audioflinger->convert_format, spec->channels);
+
   gst_audioflinger_sink_set_volume (audioflinger, audioflinger->m_volume);
-  gst_audioflinger_sink_set_mute (audioflinger, audioflinger->m_mute);
+  /* new data starts at the gain, without ramp */
+  GST_OBJECT_LOCK (audioflinger);
+  audioflinger->m_init = TRUE;
+  audioflinger_gain_init (&audioflinger->gain, 
+      audioflinger->m_mute ? 0.0 : audioflinger->gain_value);
+  GST_OBJECT_UNLOCK (audioflinger);
   spec->bytes_per_sample = (spec->width / 8) * spec->channels;
   audioflinger->bytes_per_sample = spec->bytes_per_sample;
+  audioflinger->rate = spec->rate;
+  audioflinger->frames_written = 0;
+  audioflinger->direct_write = TRUE;
+  GST_OBJECT_LOCK (audioflinger);
+  audioflinger->reprime = FALSE;
+  GST_OBJECT_UNLOCK (audioflinger);
+  /* nothing writes yet, so no reader sees it half reset */
+  g_atomic_int_inc (&audioflinger->stats.seq);
+  memset (&audioflinger->stats.bytes, 0, sizeof (audioflinger->stats) - 
+      G_STRUCT_OFFSET (GstAudioFlingerSinkStats, bytes));
+  g_atomic_int_inc (&audioflinger->stats.seq);
+  audioflinger->stats_posted = GST_CLOCK_TIME_NONE;
+
+  /* the chunk is bounded by the latency ceiling, it's of whole frames */
+  audioflinger->coalesce_chunk = 0;
+  audioflinger->coalesce_len = 0;
+  if (audioflinger->coalesce_size > 0 && ringbuffer == NULL) {
+    guint64 chunk = (guint64) audioflinger->coalesce_latency * spec->rate / 
+        1000 * spec->bytes_per_sample;
+
+    chunk = MIN (chunk, audioflinger->coalesce_size);
+    audioflinger->coalesce_chunk = (guint) chunk - 
+        (guint) chunk % spec->bytes_per_sample;
+    GST_DEBUG_OBJECT (audioflinger, "coalesce %u bytes, segments of %d", 
+        audioflinger->coalesce_chunk, spec->segsize);
+  }
 
   GST_DEBUG_OBJECT (audioflinger,
       "channels: %d, rate: %d, width: %d, got segsize: %d, segtotal: %d, "
@@ -450,6 +1354,145 @@ dodgy_width:
   }
 }
 
+/*
+ * Pick the conversion of spec into S16 mono or stereo, which AudioTrack
+ * plays. Return FALSE if the format isn't supported.
+ */
+static gboolean
+gst_audioflinger_sink_set_convert (GstAudioFlingerSink * audioflinger,
+    GstRingBufferSpec * spec)
+{
+  AudioFlingerConvertFormat format;
+
+  if (spec->channels < 1 || 
+      spec->channels > AUDIOFLINGER_CONVERT_MAX_CHANNELS)
+    return FALSE;
+
+  if (spec->type == GST_BUFTYPE_FLOAT) {
+    if (spec->width != 32)
+      return FALSE;
+    format = AUDIOFLINGER_CONVERT_F32;
+  } else if (spec->type == GST_BUFTYPE_LINEAR) {
+    switch (spec->width) {
+      case 16:
+        format = (spec->channels > 2) ? AUDIOFLINGER_CONVERT_S16 :
+            AUDIOFLINGER_CONVERT_NONE;
+        break;
+      case 24:
+        format = AUDIOFLINGER_CONVERT_S24_3;
+        break;
+      case 32:
+        format = (spec->depth == 24) ? AUDIOFLINGER_CONVERT_S24_32 :
+            AUDIOFLINGER_CONVERT_S32;
+        break;
+      default:
+        return FALSE;
+    }
+  } else {
+    return FALSE;
+  }
+
+  audioflinger->convert_format = format;
+  audioflinger->channels = spec->channels;
+  audioflinger->out_bytes_per_sample = 
+      2 * audioflinger_convert_out_channels (spec->channels);
+  return TRUE;
+}
+
+/*
+ * Resample to the native rate of AudioFlinger if it's enabled and the rate
+ * of spec differs, the device is then set at device_rate. The callback mode
+ * takes whole ring buffer segments, so it doesn't resample. The shared mixer
+ * only takes data at its rate, so it's always resampled to it, at low
+ * quality unless a quality is set.
+ */
+static void
+gst_audioflinger_sink_set_resampler (GstAudioFlingerSink * audioflinger,
+    GstRingBufferSpec * spec, gboolean callback)
+{
+  AudioFlingerResampleQuality quality = audioflinger->resample_quality;
+  gint native_rate;
+
+  audioflinger_resampler_free (audioflinger->resampler);
+  audioflinger->resampler = NULL;
+  audioflinger->device_rate = spec->rate;
+
+  if (audioflinger->shared_mixer && audioflinger->m_audiosink == NULL) {
+    native_rate = audioflinger_device_mixer_rate ();
+    if (quality == AUDIOFLINGER_RESAMPLE_NONE)
+      quality = AUDIOFLINGER_RESAMPLE_LOW;
+  }
+  else {
+    if (quality == AUDIOFLINGER_RESAMPLE_NONE || callback)
+      return;
+    native_rate = audioflinger_device_native_rate ();
+  }
+  if (native_rate <= 0 || native_rate == spec->rate)
+    return;
+
+  audioflinger->resampler = audioflinger_resampler_new (
+      audioflinger_convert_out_channels (spec->channels), spec->rate,
+      native_rate, quality);
+  if (audioflinger->resampler == NULL) {
+    GST_WARNING_OBJECT (audioflinger, "can't resample %d to %d",
+        spec->rate, native_rate);
+    return;
+  }
+  GST_DEBUG_OBJECT (audioflinger, "resample %d to %d, quality %d",
+      spec->rate, native_rate, quality);
+  audioflinger->device_rate = native_rate;
+}
+
+/*
+ * Ramp to the gain of properties, called with the object lock. It's set at
+ * once if the device isn't set, the rate is unknown then.
+ */
+static void
+gst_audioflinger_sink_update_gain (GstAudioFlingerSink * audioflinger_sink)
+{
+  gint frames = 0;
+
+  /* gain is applied to frames at the rate of device */
+  if (audioflinger_sink->m_init && audioflinger_sink->device_rate > 0)
+    frames = (gint) ((gint64) audioflinger_sink->ramp_time * 
+        audioflinger_sink->device_rate / 1000);
+  audioflinger_gain_set (&audioflinger_sink->gain, 
+      audioflinger_sink->m_mute ? 0.0 : audioflinger_sink->gain_value,
+      frames, audioflinger_sink->ramp_shape);
+}
+
+/*
+ * Apply gain to frames of converted data. With check, nothing is done and
+ * FALSE is returned if gain is unity. 
+ */
+static gboolean
+gst_audioflinger_sink_apply_gain (GstAudioFlingerSink * audioflinger,
+    guint8 * data, gint frames, gboolean check)
+{
+  gboolean unity;
+
+  GST_OBJECT_LOCK (audioflinger);
+  unity = audioflinger_gain_is_unity (&audioflinger->gain);
+  if (!unity && !check)
+    audioflinger_gain_apply (&audioflinger->gain, (gint16 *) data, frames,
+        audioflinger->out_bytes_per_sample / 2);
+  GST_OBJECT_UNLOCK (audioflinger);
+
+  return !unity;
+}
+
+/* copy frames of input into dest, converted for the device */
+static void
+gst_audioflinger_sink_convert (GstAudioFlingerSink * audioflinger,
+    const guint8 * src, guint8 * dest, gint frames)
+{
+  if (audioflinger->convert_format == AUDIOFLINGER_CONVERT_NONE)
+    memcpy (dest, src, frames * audioflinger->bytes_per_sample);
+  else
+    audioflinger_convert (audioflinger->convert_format, 
+        audioflinger->channels, src, (gint16 *) dest, frames);
+}
+
 static gboolean
 gst_audioflinger_sink_unprepare (GstAudioSink * asink)
 {
@@ -460,22 +1503,80 @@ gst_audioflinger_sink_unprepare (GstAudioSink * asink)
 
   if (audioflinger->audioflinger_device != NULL) {
     GST_DEBUG_OBJECT (audioflinger, "release flinger device");
-    audioflinger_device_stop(audioflinger->audioflinger_device);
+    audioflinger->coalesce_len = 0;
+    /* the position is reset once the track is stopped */
+    GST_OBJECT_LOCK (audioflinger);
+    gst_audioflinger_sink_save_played (audioflinger);
     audioflinger->m_init = FALSE;
+    GST_OBJECT_UNLOCK (audioflinger);
+    audioflinger_device_stop(audioflinger->audioflinger_device);
+    GST_INFO_OBJECT (audioflinger, "profile %d, underruns: %d, short "
+        "writes: %u, failures: %u", audioflinger->profile,
+        audioflinger_device_underruns (audioflinger->audioflinger_device),
+        audioflinger->stats.short_writes, audioflinger->stats.failures);
   }
+  audioflinger_resampler_free (audioflinger->resampler);
+  audioflinger->resampler = NULL;
 
   return TRUE;
 }
 
+/*
+ * Copy data from ring buffer straight into regions of the AudioTrack shared
+ * buffer, as they become free, converting it on the way. Return the bytes
+ * of data written, 0 if the track is
+ * stopped, or if the device has no shared buffer, in which case
+ * direct_write is cleared and write() is used from now on.
+ */
+static guint
+gst_audioflinger_sink_write_direct (GstAudioFlingerSink * audioflinger,
+    gpointer data, guint length)
+{
+  guint8 *src = (guint8 *) data;
+  guint left = length;
+
+  GST_LOG_OBJECT (audioflinger, "free space: %d",
+      (gint) audioflinger_device_free_space (audioflinger->audioflinger_device));
+
+  while (left >= (guint) audioflinger->bytes_per_sample) {
+    gpointer region;
+    gssize size;
+    gint frames;
+
+    size = audioflinger_device_obtain_buffer (audioflinger->audioflinger_device,
+        &region, left / audioflinger->bytes_per_sample * 
+        audioflinger->out_bytes_per_sample, TRUE);
+    if (size < 0) {
+      GST_DEBUG_OBJECT (audioflinger, "no shared buffer, use write()");
+      audioflinger->direct_write = FALSE;
+      break;
+    }
+    if (size == 0)
+      break;
+
+    /* obtained regions are whole frames */
+    frames = size / audioflinger->out_bytes_per_sample;
+    gst_audioflinger_sink_convert (audioflinger, src, region, frames);
+    gst_audioflinger_sink_apply_gain (audioflinger, region, frames, FALSE);
+    audioflinger_device_release_buffer (audioflinger->audioflinger_device,
+        frames * audioflinger->out_bytes_per_sample);
+    src += frames * audioflinger->bytes_per_sample;
+    left -= frames * audioflinger->bytes_per_sample;
+  }
+
+  return length - left;
+}
+
 static guint
 gst_audioflinger_sink_write (GstAudioSink * asink, gpointer data, guint length)
 {
   GstAudioFlingerSink *audioflinger;
-  guint ret = 0;
+  GstClockTime now;
+  guint size;
 
   audioflinger = GST_AUDIOFLINGERSINK (asink);
 
-  GST_INFO_OBJECT (audioflinger, "write length=%d", length);
+  GST_LOG_OBJECT (audioflinger, "write length=%d", length);
 
   if (audioflinger->audioflinger_device == NULL || 
           audioflinger->m_init == FALSE)
@@ -485,43 +1586,592 @@ gst_audioflinger_sink_write (GstAudioSink * asink, gpointer data, guint length)
     return length;
   }
 
-  /* FIXME : Instead of using write, we should be using obtainBuffer/releaseBuffer
-   * which gives us a more granular feedback. */
-  ret =
-      audioflinger_device_write (audioflinger->audioflinger_device, data,
+  if (audioflinger->coalesce_chunk == 0 || 
+      (audioflinger->coalesce_len == 0 && 
+          length >= audioflinger->coalesce_chunk))
+    return gst_audioflinger_sink_write_segment (audioflinger, data, length);
+
+  /* gather data, it's written once there's a chunk of it or the first
+   * of it waited for the latency ceiling */
+  now = gst_util_get_timestamp ();
+  size = audioflinger->coalesce_len + length;
+  if (size > audioflinger->coalesce_buf_size) {
+    audioflinger->coalesce_buf = g_realloc (audioflinger->coalesce_buf, size);
+    audioflinger->coalesce_buf_size = size;
+  }
+  if (audioflinger->coalesce_len == 0)
+    audioflinger->coalesce_start = now;
+  memcpy (audioflinger->coalesce_buf + audioflinger->coalesce_len, data,
       length);
+  audioflinger->coalesce_len = size;
+
+  if (size >= audioflinger->coalesce_chunk || 
+      now - audioflinger->coalesce_start >= 
+      (GstClockTime) audioflinger->coalesce_latency * GST_MSECOND)
+    gst_audioflinger_sink_commit (audioflinger);
+
+  return length;
+}
+
+/*
+ * Write all gathered data to the device.
+ */
+static void
+gst_audioflinger_sink_commit (GstAudioFlingerSink * audioflinger)
+{
+  guint8 *data = audioflinger->coalesce_buf;
+  guint left = audioflinger->coalesce_len;
+
+  GST_LOG_OBJECT (audioflinger, "commit %u bytes", left);
+  while (left > 0) {
+    guint ret = gst_audioflinger_sink_write_segment (audioflinger, data, 
+        left);
+
+    data += ret;
+    left -= ret;
+  }
+  audioflinger->coalesce_len = 0;
+}
+
+/*
+ * Write data to the device, return the bytes consumed. It's all of them if
+ * it's flushing.
+ */
+static guint
+gst_audioflinger_sink_write_segment (GstAudioFlingerSink * audioflinger,
+    gpointer data, guint length)
+{
+  gboolean flushing, reprime;
+  gboolean failed = FALSE;
+  GstClockTime start;
+  guint ret;
+
+  GST_OBJECT_LOCK (audioflinger);
+  flushing = audioflinger->flushing;
+  GST_OBJECT_UNLOCK (audioflinger);
+  /* data of before the seek, the device was paused to return at once */
+  if (flushing) {
+    GST_DEBUG_OBJECT (audioflinger, "flushing, drop %d bytes", length);
+    return length;
+  }
+
+  start = gst_util_get_timestamp ();
+  ret = gst_audioflinger_sink_write_data (audioflinger, data, length, 
+      &failed);
+  gst_audioflinger_sink_stats_record (audioflinger, ret, length,
+      gst_util_get_timestamp () - start, failed);
+  gst_audioflinger_sink_stats_post (audioflinger);
+
+  /* the first data after a flush is in the device, start it again if
+   * it's playing. PAUSED_TO_PLAYING starts it otherwise. */
+  GST_OBJECT_LOCK (audioflinger);
+  reprime = audioflinger->reprime && 
+      GST_STATE (audioflinger) == GST_STATE_PLAYING;
+  if (reprime)
+    audioflinger->reprime = FALSE;
+  GST_OBJECT_UNLOCK (audioflinger);
+  if (reprime) {
+    GST_DEBUG_OBJECT (audioflinger, "restart device after flush");
+    audioflinger_device_start (audioflinger->audioflinger_device);
+  }
+
+  return ret;
+}
+
+/*
+ * Write data to the device, return the bytes of data consumed. When the
+ * device fails, failed is set and data is consumed all the same, the write
+ * thread would only retry it otherwise.
+ */
+static guint
+gst_audioflinger_sink_write_data (GstAudioFlingerSink * audioflinger, 
+    gpointer data, guint length, gboolean * failed)
+{
+  gssize ret = 0;
+
+  if (audioflinger->resampler)
+    return gst_audioflinger_sink_write_resampled (audioflinger, data, length,
+        failed);
+
+  if (audioflinger->direct_write) {
+    ret = gst_audioflinger_sink_write_direct (audioflinger, data, length);
+    if (ret > 0) {
+      audioflinger->frames_written += ret / audioflinger->bytes_per_sample;
+      GST_LOG_OBJECT (audioflinger, "written=%u", (guint) ret);
+      return ret;
+    }
+  }
+
+  /* unconverted data at unity gain is written as it is */
+  if (audioflinger->convert_format == AUDIOFLINGER_CONVERT_NONE &&
+      !gst_audioflinger_sink_apply_gain (audioflinger, data, 0, TRUE)) {
+    ret = audioflinger_device_write (audioflinger->audioflinger_device, data,
+        length);
+  } else {
+    gint frames = length / audioflinger->bytes_per_sample;
+    guint size = frames * audioflinger->out_bytes_per_sample;
+
+    if (size > audioflinger->convert_buf_size) {
+      g_free (audioflinger->convert_buf);
+      audioflinger->convert_buf = g_malloc (size);
+      audioflinger->convert_buf_size = size;
+    }
+    gst_audioflinger_sink_convert (audioflinger, data, 
+        audioflinger->convert_buf, frames);
+    gst_audioflinger_sink_apply_gain (audioflinger, 
+        audioflinger->convert_buf, frames, FALSE);
+    ret = audioflinger_device_write (audioflinger->audioflinger_device,
+        audioflinger->convert_buf, size);
+    if (ret > 0)
+      ret = ret / audioflinger->out_bytes_per_sample * 
+          audioflinger->bytes_per_sample;
+  }
+
+  if (ret <= 0) {
+    GST_WARNING_OBJECT (audioflinger, "Write failure: %d", (gint) ret);
+    *failed = TRUE;
+    return length;
+  }
+
+  audioflinger->frames_written += ret / audioflinger->bytes_per_sample;
+  GST_LOG_OBJECT (audioflinger, "written=%u", (guint) ret);
+
+  return ret;
+}
 
-  if (ret == 0) {
-    GST_WARNING_OBJECT (audioflinger, "Write failure");
-    ret = length;
+/*
+ * Count a write of length bytes, of which written were consumed, or one
+ * callback when it's in callback mode. Called by the writing thread only.
+ */
+static void
+gst_audioflinger_sink_stats_record (GstAudioFlingerSink * audioflinger,
+    guint written, guint length, GstClockTime duration, gboolean failed)
+{
+  GstAudioFlingerSinkStats *stats = &audioflinger->stats;
+  GstClockTime us = duration / GST_USECOND;
+  gint bin;
+
+  for (bin = 0; bin < GST_AUDIOFLINGER_SINK_WRITE_BINS - 1; bin++)
+    if (us < write_bin_limits[bin])
+      break;
+
+  g_atomic_int_inc (&stats->seq);
+  stats->writes++;
+  stats->blocked += duration;
+  stats->write_bins[bin]++;
+  if (failed) {
+    stats->failures++;
+  } else {
+    stats->bytes += written;
+    if (written < length)
+      stats->short_writes++;
   }
+  g_atomic_int_inc (&stats->seq);
+}
+
+/*
+ * Copy the stats into a new structure, it's called from any thread.
+ */
+static GstStructure *
+gst_audioflinger_sink_stats_get (GstAudioFlingerSink * audioflinger)
+{
+  GstAudioFlingerSinkStats stats;
+  GstStructure *structure;
+  GValue bins = { 0 };
+  GValue value = { 0 };
+  gint seq, i;
+
+  do {
+    seq = g_atomic_int_get (&audioflinger->stats.seq);
+    memcpy (&stats, &audioflinger->stats, sizeof (stats));
+  } while ((seq & 1) || seq != g_atomic_int_get (&audioflinger->stats.seq));
+
+  structure = gst_structure_new ("audioflingersink-stats",
+      "bytes", G_TYPE_UINT64, stats.bytes,
+      "writes", G_TYPE_UINT, stats.writes,
+      "blocked-time", G_TYPE_UINT64, stats.blocked,
+      "short-writes", G_TYPE_UINT, stats.short_writes,
+      "failures", G_TYPE_UINT, stats.failures,
+      "underruns", G_TYPE_INT, 
+      MAX (audioflinger_device_underruns (audioflinger->audioflinger_device), 
+          0), NULL);
+
+  /* count of writes under 0.1, 0.5, 1, 2, 5, 10, 20, 50, 100 ms, and over */
+  g_value_init (&bins, GST_TYPE_ARRAY);
+  g_value_init (&value, G_TYPE_UINT);
+  for (i = 0; i < GST_AUDIOFLINGER_SINK_WRITE_BINS; i++) {
+    g_value_set_uint (&value, stats.write_bins[i]);
+    gst_value_array_append_value (&bins, &value);
+  }
+  gst_structure_set_value (structure, "write-time", &bins);
+
+  /* device writes, i.e. wakeups of the writing thread, per second of audio */
+  if (stats.bytes > 0 && audioflinger->bytes_per_sample > 0)
+    gst_structure_set (structure, "writes-per-second", G_TYPE_DOUBLE,
+        (gdouble) stats.writes * audioflinger->rate * 
+        audioflinger->bytes_per_sample / stats.bytes, NULL);
+  g_value_unset (&value);
+  g_value_unset (&bins);
 
-  GST_INFO_OBJECT (audioflinger, "written=%u", ret);
+  return structure;
+}
+
+/*
+ * Post the stats as an element message once stats_interval passed since
+ * they were last posted. Called by the writing thread only, or by the
+ * streaming thread in callback mode: posting allocates and may run the
+ * application's sync handler, which AudioTrack's callback can't wait for.
+ */
+static void
+gst_audioflinger_sink_stats_post (GstAudioFlingerSink * audioflinger)
+{
+  GstClockTime now;
+
+  if (audioflinger->stats_interval == 0)
+    return;
+  now = gst_util_get_timestamp ();
+  if (GST_CLOCK_TIME_IS_VALID (audioflinger->stats_posted) && 
+      now - audioflinger->stats_posted < 
+      (GstClockTime) audioflinger->stats_interval * GST_MSECOND)
+    return;
+  audioflinger->stats_posted = now;
+
+  gst_element_post_message (GST_ELEMENT (audioflinger),
+      gst_message_new_element (GST_OBJECT (audioflinger),
+          gst_audioflinger_sink_stats_get (audioflinger)));
+}
+
+/*
+ * Convert and resample data, then write all of it to the device, into the
+ * shared buffer if it's possible. Output frames don't match input ones one
+ * by one, so data is always consumed as a whole.
+ */
+static guint
+gst_audioflinger_sink_write_resampled (GstAudioFlingerSink * audioflinger,
+    gpointer data, guint length, gboolean * failed)
+{
+  gint frames = length / audioflinger->bytes_per_sample;
+  gint16 *input = (gint16 *) data;
+  guint8 *output;
+  guint size;
+  gint out_frames;
+
+  if (audioflinger->convert_format != AUDIOFLINGER_CONVERT_NONE) {
+    size = frames * audioflinger->out_bytes_per_sample;
+    if (size > audioflinger->convert_buf_size) {
+      g_free (audioflinger->convert_buf);
+      audioflinger->convert_buf = g_malloc (size);
+      audioflinger->convert_buf_size = size;
+    }
+    gst_audioflinger_sink_convert (audioflinger, data, 
+        audioflinger->convert_buf, frames);
+    input = (gint16 *) audioflinger->convert_buf;
+  }
+
+  size = audioflinger_resampler_max_out (audioflinger->resampler, frames) *
+      audioflinger->out_bytes_per_sample;
+  if (size > audioflinger->resample_buf_size) {
+    g_free (audioflinger->resample_buf);
+    audioflinger->resample_buf = g_malloc (size);
+    audioflinger->resample_buf_size = size;
+  }
+  out_frames = audioflinger_resampler_process (audioflinger->resampler,
+      input, frames, audioflinger->resample_buf);
+  gst_audioflinger_sink_apply_gain (audioflinger, 
+      (guint8 *) audioflinger->resample_buf, out_frames, FALSE);
+
+  output = (guint8 *) audioflinger->resample_buf;
+  size = out_frames * audioflinger->out_bytes_per_sample;
+  while (size > 0) {
+    gpointer region;
+    gssize n = -1;
+
+    if (audioflinger->direct_write) {
+      n = audioflinger_device_obtain_buffer (
+          audioflinger->audioflinger_device, &region, size, TRUE);
+      if (n > 0) {
+        memcpy (region, output, n);
+        audioflinger_device_release_buffer (
+            audioflinger->audioflinger_device, n);
+      } else if (n < 0) {
+        audioflinger->direct_write = FALSE;
+      }
+    }
+    if (n < 0) {
+      n = audioflinger_device_write (audioflinger->audioflinger_device, 
+          output, size);
+      if (n < 0)
+        *failed = TRUE;
+    }
+    /* the device is stopped, drop the rest */
+    if (n <= 0)
+      break;
+
+    audioflinger->frames_written += n / audioflinger->out_bytes_per_sample;
+    output += n;
+    size -= n;
+  }
+
+  GST_LOG_OBJECT (audioflinger, "resampled %d to %d frames", frames,
+      out_frames);
+  return length;
+}
+
+/*
+ * Frames written but not heard yet: those still in the AudioTrack buffer,
+ * i.e. written minus the playback head position, plus the mixer and
+ * hardware latency after it. AudioTrack::latency() is the sum of the
+ * hardware latency and the whole track buffer, so the buffer is subtracted.
+ */
+static guint
+gst_audioflinger_sink_delay (GstAudioSink * asink)
+{
+  GstAudioFlingerSink *audioflinger;
+  gint64 latency;
+  gint frame_count;
+  gint64 hw_delay;
+  guint32 position;
+  guint32 queued;
+
+  audioflinger = GST_AUDIOFLINGERSINK (asink);
+
+  if (audioflinger->audioflinger_device == NULL || 
+          audioflinger->m_init == FALSE || audioflinger->rate <= 0 ||
+          audioflinger->device_rate <= 0)
+    return 0;
+
+  latency = audioflinger_device_latency (audioflinger->audioflinger_device);
+  frame_count = 
+      audioflinger_device_frameCount (audioflinger->audioflinger_device);
+  if (latency < 0 || frame_count < 0)
+    return 0;
+  /* in frames of the device, converted to the rate of data at the end */
+  hw_delay = latency * audioflinger->device_rate / 1000;
+
+  /* AudioSink of media service doesn't report position, assume its buffer
+   * is full, which is true while write() is blocking */
+  if (audioflinger_device_get_position (audioflinger->audioflinger_device, 
+          &position) != 0)
+    return (guint) (hw_delay * audioflinger->rate / audioflinger->device_rate) +
+        audioflinger->coalesce_len / audioflinger->bytes_per_sample;
+
+  hw_delay = MAX (hw_delay - frame_count, 0);
+  queued = audioflinger->frames_written - position;
+  /* the device position was reset, e.g. by flush */
+  if (queued > (guint32) frame_count)
+    queued = (position > audioflinger->frames_written) ? 0 : frame_count;
+
+  GST_LOG_OBJECT (audioflinger, "written: %u, position: %u, delay: %u + %d",
+      audioflinger->frames_written, position, queued, (gint) hw_delay);
+
+  return (guint) ((queued + hw_delay) * audioflinger->rate / 
+      audioflinger->device_rate) + 
+      audioflinger->coalesce_len / audioflinger->bytes_per_sample;
+}
+
+/*
+ * In callback mode there's no writing thread, the stats counted by the
+ * callback are posted after each buffer is committed to the ring buffer.
+ */
+static GstFlowReturn
+gst_audioflinger_sink_render (GstBaseSink * bsink, GstBuffer * buffer)
+{
+  GstAudioFlingerSink *audioflinger = GST_AUDIOFLINGERSINK (bsink);
+  GstRingBuffer *buf = GST_BASE_AUDIO_SINK (bsink)->ringbuffer;
+  GstFlowReturn ret;
+
+  ret = GST_BASE_SINK_CLASS (parent_class)->render (bsink, buffer);
+
+  if (buf != NULL && 
+      G_TYPE_CHECK_INSTANCE_TYPE (buf, GST_TYPE_AUDIOFLINGER_RING_BUFFER))
+    gst_audioflinger_sink_stats_post (audioflinger);
 
   return ret;
 }
 
-/* static guint */
-/* gst_audioflinger_sink_delay (GstAudioSink * asink) */
-/* { */
-/*   GstAudioFlingerSink *audioflinger; */
-/*   gint delay = 0; */
-/*   gint64 ret; */
+/*
+ * On a flushing seek, what the track holds is dropped rather than played:
+ * FLUSH_START pauses and flushes the device, which also returns a write()
+ * blocked on a full track, and FLUSH_STOP flushes what was written in
+ * between. New data then starts the device again, see write().
+ *
+ * FLUSH_START isn't serialized with data, the write thread may be in
+ * write() meanwhile, so what it uses is only reset at FLUSH_STOP, when the
+ * ring buffer is paused.
+ */
+static gboolean
+gst_audioflinger_sink_event (GstBaseSink * bsink, GstEvent * event)
+{
+  GstAudioFlingerSink *audioflinger = GST_AUDIOFLINGERSINK (bsink);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      GST_DEBUG_OBJECT (audioflinger, "flush start, flush device");
+      GST_OBJECT_LOCK (audioflinger);
+      audioflinger->flushing = TRUE;
+      GST_OBJECT_UNLOCK (audioflinger);
+      gst_audioflinger_sink_flush_device (audioflinger);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      GST_DEBUG_OBJECT (audioflinger, "flush stop");
+      gst_audioflinger_sink_flush_device (audioflinger);
+      gst_audioflinger_sink_reset_written (audioflinger);
+      GST_OBJECT_LOCK (audioflinger);
+      audioflinger->flushing = FALSE;
+      audioflinger->reprime = TRUE;
+      GST_OBJECT_UNLOCK (audioflinger);
+      break;
+    default:
+      break;
+  }
+
+  return GST_BASE_SINK_CLASS (parent_class)->event (bsink, event);
+}
+
+/*
+ * Pause and flush the device. In callback mode, the ring buffer is started
+ * again by the base class, which starts the device, and its lock keeps the
+ * callback out meanwhile.
+ */
+static void
+gst_audioflinger_sink_flush_device (GstAudioFlingerSink * audioflinger)
+{
+  GstRingBuffer *buf = GST_BASE_AUDIO_SINK (audioflinger)->ringbuffer;
+  GstAudioFlingerRingBuffer *abuf = NULL;
+
+  if (audioflinger->audioflinger_device == NULL || 
+      audioflinger->m_init == FALSE)
+    return;
+
+  if (buf != NULL && 
+      G_TYPE_CHECK_INSTANCE_TYPE (buf, GST_TYPE_AUDIOFLINGER_RING_BUFFER))
+    abuf = GST_AUDIOFLINGER_RING_BUFFER (buf);
+  if (abuf)
+    g_mutex_lock (abuf->lock);
+
+  audioflinger_device_pause (audioflinger->audioflinger_device);
+  GST_OBJECT_LOCK (audioflinger);
+  gst_audioflinger_sink_save_played (audioflinger);
+  audioflinger_device_flush (audioflinger->audioflinger_device);
+  GST_OBJECT_UNLOCK (audioflinger);
+
+  if (abuf)
+    g_mutex_unlock (abuf->lock);
+}
+
+/*
+ * Reset what counts or holds data written to the device, after it's
+ * flushed. The write thread shall be out of write(), the callback is kept
+ * out by the ring buffer lock.
+ */
+static void
+gst_audioflinger_sink_reset_written (GstAudioFlingerSink * audioflinger)
+{
+  GstRingBuffer *buf = GST_BASE_AUDIO_SINK (audioflinger)->ringbuffer;
+  GstAudioFlingerRingBuffer *abuf = NULL;
+
+  if (buf != NULL && 
+      G_TYPE_CHECK_INSTANCE_TYPE (buf, GST_TYPE_AUDIOFLINGER_RING_BUFFER))
+    abuf = GST_AUDIOFLINGER_RING_BUFFER (buf);
+  if (abuf)
+    g_mutex_lock (abuf->lock);
+
+  audioflinger->frames_written = 0;
+  audioflinger->coalesce_len = 0;
+  if (audioflinger->resampler)
+    audioflinger_resampler_reset (audioflinger->resampler);
+
+  if (abuf) {
+    abuf->segoffset = 0;
+    g_mutex_unlock (abuf->lock);
+  }
+}
+
+/*
+ * Time of the clock: what the playback head of the track passed, less the
+ * output latency after the mixer, on top of the time played by tracks set
+ * or flushed before. AudioSink of media service doesn't report its position,
+ * the time is then the samples handed to it less their delay, like the clock
+ * of the base class.
+ */
+static GstClockTime
+gst_audioflinger_sink_get_time (GstClock * clock,
+    GstAudioFlingerSink * audioflinger)
+{
+  GstRingBuffer *buf = GST_BASE_AUDIO_SINK (audioflinger)->ringbuffer;
+  GstClockTime result;
+  guint32 latency_frames;
+  guint64 samples;
+  guint delay;
+
+  GST_OBJECT_LOCK (audioflinger);
+  if (gst_audioflinger_sink_update_head (audioflinger, &latency_frames)) {
+    samples = (audioflinger->head_frames > latency_frames) ? 
+        audioflinger->head_frames - latency_frames : 0;
+    result = audioflinger->played_time + 
+        gst_util_uint64_scale_int (samples, GST_SECOND,
+        audioflinger->device_rate);
+    GST_OBJECT_UNLOCK (audioflinger);
+    GST_LOG_OBJECT (audioflinger, "heard %" G_GUINT64_FORMAT ", latency %u, "
+        "time %" GST_TIME_FORMAT, samples, latency_frames,
+        GST_TIME_ARGS (result));
+    return result;
+  }
+  GST_OBJECT_UNLOCK (audioflinger);
+
+  if (buf == NULL || buf->spec.rate == 0)
+    return GST_CLOCK_TIME_NONE;
+  samples = gst_ring_buffer_samples_done (buf);
+  delay = gst_ring_buffer_delay (buf);
+  samples = (samples > delay) ? samples - delay : 0;
+  return gst_util_uint64_scale_int (samples, GST_SECOND, buf->spec.rate);
+}
+
+/*
+ * Extend the playback head of the device to 64 bits, called with the object
+ * lock. Return FALSE if the device doesn't report it.
+ */
+static gboolean
+gst_audioflinger_sink_update_head (GstAudioFlingerSink * audioflinger,
+    guint32 * latency_frames)
+{
+  guint32 position;
 
-/*   audioflinger = GST_AUDIOFLINGERSINK (asink); */
+  if (audioflinger->audioflinger_device == NULL || 
+      audioflinger->m_init == FALSE || audioflinger->device_rate <= 0)
+    return FALSE;
+  if (audioflinger_device_get_playback_head (
+          audioflinger->audioflinger_device, &position, latency_frames) != 0)
+    return FALSE;
+
+  /* it goes back to 0 if AudioFlinger resets the track, e.g. when it's
+   * stopped, otherwise it wraps around */
+  if (position < audioflinger->head_position && 
+      (audioflinger->head_position < G_MAXUINT32 / 2 || 
+          position > G_MAXUINT32 / 2))
+    audioflinger->head_position = 0;
+  audioflinger->head_frames += (guint32) (position - 
+      audioflinger->head_position);
+  audioflinger->head_position = position;
+  return TRUE;
+}
 
-/*   /\* */
-/*    * TODO: */
-/*    * Call audioflinger_device_latency() to get delay */
-/*    *\/ */
-/*   if (audioflinger->audioflinger_device) */
-/*     ret = audioflinger_device_latency (audioflinger->audioflinger_device) * 1000; */
-/*   else */
-/*     ret = delay / audioflinger->bytes_per_sample; */
-/*   GST_DEBUG ("Got %lld", ret); */
+/*
+ * Add what the playback head passed to the time played, before the track is
+ * flushed or replaced and its position starts from 0 again. Called with the
+ * object lock.
+ */
+static void
+gst_audioflinger_sink_save_played (GstAudioFlingerSink * audioflinger)
+{
+  guint32 latency_frames;
 
-/*   return (guint) ret; */
-/* } */
+  if (gst_audioflinger_sink_update_head (audioflinger, &latency_frames))
+    audioflinger->played_time += gst_util_uint64_scale_int (
+        audioflinger->head_frames, GST_SECOND, audioflinger->device_rate);
+  audioflinger->head_frames = 0;
+  audioflinger->head_position = 0;
+}
 
 static void
 gst_audioflinger_sink_set_mute (GstAudioFlingerSink * audioflinger_sink,
@@ -529,9 +2179,10 @@ gst_audioflinger_sink_set_mute (GstAudioFlingerSink * audioflinger_sink,
 {
   GST_DEBUG_OBJECT (audioflinger_sink, "set PROP_MUTE = %d\n", mute);
 
-  if (audioflinger_sink->audioflinger_device)
-    audioflinger_device_mute (audioflinger_sink->audioflinger_device, mute);
+  /* called with the object lock, the track itself isn't muted because it
+   * would cut the sound at once */
   audioflinger_sink->m_mute = mute;
+  gst_audioflinger_sink_update_gain (audioflinger_sink);
 }
 
 static void
@@ -557,6 +2208,14 @@ gst_audioflinger_sink_change_state (GstElement * element,
   GstAudioFlingerSink *audioflinger_sink = GST_AUDIOFLINGERSINK (element);
 
   switch (transition) {
+    case GST_STATE_CHANGE_NULL_TO_READY:
+      /* the base class resets the clock to 0, its time starts again */
+      GST_OBJECT_LOCK (audioflinger_sink);
+      audioflinger_sink->played_time = 0;
+      audioflinger_sink->head_frames = 0;
+      audioflinger_sink->head_position = 0;
+      GST_OBJECT_UNLOCK (audioflinger_sink);
+      break;
     case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
         GST_DEBUG_OBJECT (audioflinger_sink, "PAUSED_TO_PLAYING, start device");
         audioflinger_device_start (audioflinger_sink->audioflinger_device);
@@ -577,11 +2236,33 @@ beach:
   return ret;
 }
 
+static GstRingBuffer *
+gst_audioflinger_sink_create_ringbuffer (GstBaseAudioSink * sink)
+{
+  GstAudioFlingerSink *audioflinger = GST_AUDIOFLINGERSINK (sink);
+  GstRingBuffer *buffer;
+
+  /* AudioSink of media service and the shared mixer can only be written */
+  if (!audioflinger->callback_mode || audioflinger->m_audiosink != NULL ||
+      audioflinger->shared_mixer) {
+    return GST_BASE_AUDIO_SINK_CLASS (parent_class)->create_ringbuffer (sink);
+  }
+
+  GST_DEBUG_OBJECT (sink, "creating callback ringbuffer");
+  buffer = g_object_new (GST_TYPE_AUDIOFLINGER_RING_BUFFER, NULL);
+  gst_object_set_parent (GST_OBJECT (buffer), GST_OBJECT (sink));
+
+  return buffer;
+}
+
 static gboolean
 plugin_init (GstPlugin * plugin)
 {
-  return gst_element_register (plugin, "audioflingersink", GST_RANK_PRIMARY,
-      GST_TYPE_AUDIOFLINGERSINK);
+  if (!gst_element_register (plugin, "audioflingersink", GST_RANK_PRIMARY,
+          GST_TYPE_AUDIOFLINGERSINK))
+    return FALSE;
+  return gst_element_register (plugin, "audioflingertempo", GST_RANK_NONE,
+      GST_TYPE_AUDIOFLINGERTEMPO);
 }
 
 GST_PLUGIN_DEFINE (GST_VERSION_MAJOR, GST_VERSION_MINOR, "audioflingersink",
@@ -23,6 +23,9 @@
 #include <gst/gst.h>
 #include "gstaudiosink.h"
 #include "audioflinger_wrapper.h"
+#include "audioflinger_convert.h"
+#include "audioflinger_gain.h"
+#include "audioflinger_resample.h"
 
 
 G_BEGIN_DECLS
@@ -33,6 +36,36 @@ G_BEGIN_DECLS
 #define GST_IS_AUDIOFLINGERSINK(obj)         (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_AUDIOFLINGERSINK))
 #define GST_IS_AUDIOFLINGERSINK_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_AUDIOFLINGERSINK))
 
+/* buffering profiles, see gst_audioflinger_sink_apply_profile() */
+typedef enum {
+  GST_AUDIOFLINGER_SINK_PROFILE_DEFAULT,
+  GST_AUDIOFLINGER_SINK_PROFILE_LOW_LATENCY,
+  GST_AUDIOFLINGER_SINK_PROFILE_DEEP_BUFFER
+} GstAudioFlingerSinkProfile;
+
+#define GST_TYPE_AUDIOFLINGERSINK_PROFILE (gst_audioflinger_sink_profile_get_type())
+#define GST_TYPE_AUDIOFLINGERSINK_RAMP_SHAPE (gst_audioflinger_sink_ramp_shape_get_type())
+#define GST_TYPE_AUDIOFLINGERSINK_RESAMPLE_QUALITY (gst_audioflinger_sink_resample_quality_get_type())
+
+/* bins of the write time histogram, see write_bin_limits */
+#define GST_AUDIOFLINGER_SINK_WRITE_BINS 10
+
+/*
+ * Telemetry of writes to the device. Only the thread writing to it (or the
+ * AudioTrack callback) updates it, other threads read it without a lock:
+ * seq is odd while it's updated, and a reader retries until it sees the
+ * same even value before and after copying.
+ */
+typedef struct {
+  volatile gint seq;
+  guint64 bytes;
+  guint writes;
+  GstClockTime blocked;
+  guint short_writes;
+  guint failures;
+  guint write_bins[GST_AUDIOFLINGER_SINK_WRITE_BINS];
+} GstAudioFlingerSinkStats;
+
 typedef struct _GstAudioFlingerSink GstAudioFlingerSink;
 typedef struct _GstAudioFlingerSinkClass GstAudioFlingerSinkClass;
 
@@ -42,9 +75,68 @@ struct _GstAudioFlingerSink {
   AudioFlingerDeviceHandle audioflinger_device;
   gboolean   m_init;
   gint   bytes_per_sample;
+  gint   rate;
+  /* input which isn't S16 mono or stereo is converted for the device */
+  AudioFlingerConvertFormat convert_format;
+  gint   channels;
+  gint   out_bytes_per_sample;
+  guint8 *convert_buf;
+  guint  convert_buf_size;
+  /* resampler to the native rate, rate of the device then differs */
+  AudioFlingerResampleQuality resample_quality;
+  AudioFlingerResampler *resampler;
+  gint   device_rate;
+  gint16 *resample_buf;
+  guint  resample_buf_size;
+  /* frames written to device, wraps around like the device position */
+  guint32 frames_written;
+  /* fill the shared buffer of device directly, FALSE if it's unsupported */
+  gboolean direct_write;
+  /* between FLUSH_START and FLUSH_STOP, write() drops data. After a flush,
+   * the device is started again by the first write. Protected by the object
+   * lock */
+  gboolean flushing;
+  gboolean reprime;
+  /* for the clock: time played by tracks set or flushed before, and the
+   * playback head of the current one in 64 bits. Protected by the object
+   * lock, like m_init for the clock */
+  GstClockTime played_time;
+  guint64 head_frames;
+  guint32 head_position;
+  /* small segments are gathered up to coalesce_chunk bytes, or for
+   * coalesce_latency ms, before they are written to the device */
+  guint coalesce_size;
+  guint coalesce_latency;
+  guint coalesce_chunk;
+  guint8 *coalesce_buf;
+  guint coalesce_buf_size;
+  guint coalesce_len;
+  GstClockTime coalesce_start;
+  /* telemetry since the device is set, posted every stats_interval ms */
+  GstAudioFlingerSinkStats stats;
+  guint stats_interval;
+  GstClockTime stats_posted;
+  /* AudioTrack pulls ring buffer segments by callback, no write thread */
+  gboolean callback_mode;
+  /* data is mixed with other sinks into the track of a process-wide mixer,
+   * at its rate */
+  gboolean shared_mixer;
+  /* AudioSystem stream type of the track */
+  gint stream_type;
+  GstAudioFlingerSinkProfile profile;
+  /* buffer-time and latency-time restored by the default profile */
+  gint64 default_buffer_time;
+  gint64 default_latency_time;
+  /* software gain and mute, ramped in written data, protected by the
+   * object lock */
+  AudioFlingerGain gain;
+  gfloat gain_value;
+  guint ramp_time;
+  AudioFlingerRampShape ramp_shape;
   gfloat m_volume;
   gboolean   m_mute;
   gpointer   m_audiosink;
+  /* caps of the output, shared by all instances */
   GstCaps *probed_caps;
 };
 
@@ -53,6 +145,9 @@ struct _GstAudioFlingerSinkClass {
 };
 
 GType gst_audioflinger_sink_get_type(void);
+GType gst_audioflinger_sink_profile_get_type(void);
+GType gst_audioflinger_sink_ramp_shape_get_type(void);
+GType gst_audioflinger_sink_resample_quality_get_type(void);
 
 
 G_END_DECLS
@@ -0,0 +1,568 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * SECTION:element-audioflingertempo
+ *
+ * This element plays audio at the rate of its segment without changing its
+ * pitch. Put in front of audioflingersink, a seek with a rate between
+ * min-rate and max-rate is played by time stretching, and the segment is
+ * passed on at rate 1 with the rate applied, so that position queries and
+ * sync with video still follow the rate. Other rates pass through.
+ *
+ * It takes every format audioflingersink takes, but only signed 16 bit
+ * samples are stretched: the other formats pass through at any rate.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <string.h>
+#include "gstaudioflingertempo.h"
+
+#define DEFAULT_STRIDE 30
+#define DEFAULT_SEARCH 14
+#define DEFAULT_MIN_RATE 0.5
+#define DEFAULT_MAX_RATE 3.0
+#define DEFAULT_CPU_BUDGET 20
+
+/* coarsest step of search before it's given up on the budget */
+#define MAX_SEARCH_STEP 16
+
+/*
+ * PROPERTY_ID
+ */
+enum
+{
+  PROP_NULL,
+  PROP_STRIDE,
+  PROP_SEARCH,
+  PROP_MIN_RATE,
+  PROP_MAX_RATE,
+  PROP_CPU_BUDGET,
+  PROP_SEARCH_STEP,
+};
+
+GST_DEBUG_CATEGORY_STATIC (audioflinger_tempo_debug);
+#define GST_CAT_DEFAULT audioflinger_tempo_debug
+
+/* elementfactory information */
+static const GstElementDetails gst_audioflinger_tempo_details =
+GST_ELEMENT_DETAILS ("Audio tempo (AudioFlinger)",
+    "Filter/Effect/Audio",
+    "Play audio at the segment rate without changing its pitch",
+    "Prajnashi S <prajnashi@gmail.com>");
+
+static void gst_audioflinger_tempo_base_init (gpointer g_class);
+static void gst_audioflinger_tempo_class_init (GstAudioFlingerTempoClass *
+    klass);
+static void gst_audioflinger_tempo_init (GstAudioFlingerTempo * tempo);
+static void gst_audioflinger_tempo_finalize (GObject * object);
+
+static void gst_audioflinger_tempo_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+static void gst_audioflinger_tempo_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+
+static gboolean gst_audioflinger_tempo_set_caps (GstBaseTransform * trans,
+    GstCaps * incaps, GstCaps * outcaps);
+static gboolean gst_audioflinger_tempo_transform_size (GstBaseTransform *
+    trans, GstPadDirection direction, GstCaps * caps, guint size,
+    GstCaps * othercaps, guint * othersize);
+static GstFlowReturn gst_audioflinger_tempo_transform (GstBaseTransform *
+    trans, GstBuffer * inbuf, GstBuffer * outbuf);
+static gboolean gst_audioflinger_tempo_event (GstBaseTransform * trans,
+    GstEvent * event);
+static gboolean gst_audioflinger_tempo_stop (GstBaseTransform * trans);
+static void gst_audioflinger_tempo_update_load (GstAudioFlingerTempo * tempo,
+    GstClockTime elapsed, GstClockTime played);
+
+/* the caps of audioflingersink, signed 16 bit first */
+#define TEMPO_CAPS \
+    "audio/x-raw-int, " \
+    "endianness = (int) BYTE_ORDER, " \
+    "signed = (boolean) TRUE, " \
+    "width = (int) 16, " \
+    "depth = (int) 16, " \
+    "rate = (int) [ 1, MAX ], " \
+    "channels = (int) [ 1, 8 ]; " \
+    "audio/x-raw-int, " \
+    "endianness = (int) BYTE_ORDER, " \
+    "signed = (boolean) FALSE, " \
+    "width = (int) 16, " \
+    "depth = (int) 16, " \
+    "rate = (int) [ 1, MAX ], " \
+    "channels = (int) [ 1, 2 ]; " \
+    "audio/x-raw-int, " \
+    "endianness = (int) BYTE_ORDER, " \
+    "signed = (boolean) TRUE, " \
+    "width = (int) 32, " \
+    "depth = (int) { 24, 32 }, " \
+    "rate = (int) [ 1, MAX ], " \
+    "channels = (int) [ 1, 8 ]; " \
+    "audio/x-raw-int, " \
+    "endianness = (int) BYTE_ORDER, " \
+    "signed = (boolean) TRUE, " \
+    "width = (int) 24, " \
+    "depth = (int) 24, " \
+    "rate = (int) [ 1, MAX ], " \
+    "channels = (int) [ 1, 8 ]; " \
+    "audio/x-raw-float, " \
+    "endianness = (int) BYTE_ORDER, " \
+    "width = (int) 32, " \
+    "rate = (int) [ 1, MAX ], " \
+    "channels = (int) [ 1, 8 ]"
+
+static GstStaticPadTemplate audioflingertempo_sink_factory =
+    GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (TEMPO_CAPS));
+
+static GstStaticPadTemplate audioflingertempo_src_factory =
+    GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (TEMPO_CAPS));
+
+static GstBaseTransformClass *parent_class = NULL;
+
+GType
+gst_audioflinger_tempo_get_type (void)
+{
+  static GType audioflingertempo_type = 0;
+
+  if (!audioflingertempo_type) {
+    static const GTypeInfo audioflingertempo_info = {
+      sizeof (GstAudioFlingerTempoClass),
+      gst_audioflinger_tempo_base_init,
+      NULL,
+      (GClassInitFunc) gst_audioflinger_tempo_class_init,
+      NULL,
+      NULL,
+      sizeof (GstAudioFlingerTempo),
+      0,
+      (GInstanceInitFunc) gst_audioflinger_tempo_init,
+    };
+
+    audioflingertempo_type =
+        g_type_register_static (GST_TYPE_BASE_TRANSFORM,
+        "GstAudioFlingerTempo", &audioflingertempo_info, 0);
+  }
+
+  return audioflingertempo_type;
+}
+
+static void
+gst_audioflinger_tempo_base_init (gpointer g_class)
+{
+  GstElementClass *element_class = GST_ELEMENT_CLASS (g_class);
+
+  gst_element_class_set_details (element_class,
+      &gst_audioflinger_tempo_details);
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&audioflingertempo_sink_factory));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&audioflingertempo_src_factory));
+  GST_DEBUG_CATEGORY_INIT (audioflinger_tempo_debug, "audioflingertempo", 0,
+      "audioflinger tempo trace");
+}
+
+static void
+gst_audioflinger_tempo_class_init (GstAudioFlingerTempoClass * klass)
+{
+  GObjectClass *gobject_class;
+  GstBaseTransformClass *gstbasetransform_class;
+
+  gobject_class = (GObjectClass *) klass;
+  gstbasetransform_class = (GstBaseTransformClass *) klass;
+
+  parent_class = g_type_class_peek_parent (klass);
+
+  gobject_class->finalize = GST_DEBUG_FUNCPTR (gst_audioflinger_tempo_finalize);
+  gobject_class->get_property =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_tempo_get_property);
+  gobject_class->set_property =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_tempo_set_property);
+
+  gstbasetransform_class->set_caps =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_tempo_set_caps);
+  gstbasetransform_class->transform_size =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_tempo_transform_size);
+  gstbasetransform_class->transform =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_tempo_transform);
+  gstbasetransform_class->event =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_tempo_event);
+  gstbasetransform_class->stop =
+      GST_DEBUG_FUNCPTR (gst_audioflinger_tempo_stop);
+
+  g_object_class_install_property (gobject_class, PROP_STRIDE,
+      g_param_spec_uint ("stride", "Stride",
+          "Length of stretched segments in ms, longer ones suit music, "
+          "shorter ones speech", 10, 200, DEFAULT_STRIDE,
+          G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_SEARCH,
+      g_param_spec_uint ("search", "Search",
+          "Range in ms searched for the best splice of segments", 1, 50,
+          DEFAULT_SEARCH, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_MIN_RATE,
+      g_param_spec_double ("min-rate", "Min rate",
+          "Slowest rate played by stretching", 0.25, 1.0, DEFAULT_MIN_RATE,
+          G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_MAX_RATE,
+      g_param_spec_double ("max-rate", "Max rate",
+          "Fastest rate played by stretching", 1.0, 4.0, DEFAULT_MAX_RATE,
+          G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_CPU_BUDGET,
+      g_param_spec_uint ("cpu-budget", "CPU budget",
+          "Percent of the played time stretching may take, the search gets "
+          "coarser above it", 1, 100, DEFAULT_CPU_BUDGET, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_SEARCH_STEP,
+      g_param_spec_uint ("search-step", "Search step",
+          "Step of the coarse search within the CPU budget, 1 is exhaustive",
+          1, G_MAXUINT, 1, G_PARAM_READABLE));
+}
+
+static void
+gst_audioflinger_tempo_init (GstAudioFlingerTempo * tempo)
+{
+  GST_DEBUG_OBJECT (tempo, "enter");
+
+  tempo->stretch = NULL;
+  tempo->rate = 0;
+  tempo->bytes_per_frame = 0;
+  tempo->scale = 1.0;
+  tempo->stretching = FALSE;
+  tempo->segment_start = 0;
+  tempo->next_ts = GST_CLOCK_TIME_NONE;
+  tempo->stride = DEFAULT_STRIDE;
+  tempo->search = DEFAULT_SEARCH;
+  tempo->min_rate = DEFAULT_MIN_RATE;
+  tempo->max_rate = DEFAULT_MAX_RATE;
+  tempo->cpu_budget = DEFAULT_CPU_BUDGET;
+  tempo->load = 0;
+  tempo->over_budget = FALSE;
+
+  /* until a segment is to be stretched */
+  gst_base_transform_set_passthrough (GST_BASE_TRANSFORM (tempo), TRUE);
+}
+
+static void
+gst_audioflinger_tempo_finalize (GObject * object)
+{
+  GstAudioFlingerTempo *tempo = GST_AUDIOFLINGERTEMPO (object);
+
+  audioflinger_stretch_free (tempo->stretch);
+  tempo->stretch = NULL;
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_audioflinger_tempo_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstAudioFlingerTempo *tempo = GST_AUDIOFLINGERTEMPO (object);
+
+  switch (prop_id) {
+    case PROP_STRIDE:
+      g_value_set_uint (value, tempo->stride);
+      break;
+    case PROP_SEARCH:
+      g_value_set_uint (value, tempo->search);
+      break;
+    case PROP_MIN_RATE:
+      g_value_set_double (value, tempo->min_rate);
+      break;
+    case PROP_MAX_RATE:
+      g_value_set_double (value, tempo->max_rate);
+      break;
+    case PROP_CPU_BUDGET:
+      g_value_set_uint (value, tempo->cpu_budget);
+      break;
+    case PROP_SEARCH_STEP:
+      GST_OBJECT_LOCK (tempo);
+      g_value_set_uint (value, tempo->stretch ?
+          audioflinger_stretch_get_step (tempo->stretch) : 1);
+      GST_OBJECT_UNLOCK (tempo);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_audioflinger_tempo_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstAudioFlingerTempo *tempo = GST_AUDIOFLINGERTEMPO (object);
+
+  switch (prop_id) {
+    case PROP_STRIDE:
+      tempo->stride = g_value_get_uint (value);
+      break;
+    case PROP_SEARCH:
+      tempo->search = g_value_get_uint (value);
+      break;
+    case PROP_MIN_RATE:
+      /* takes effect at the next segment */
+      tempo->min_rate = g_value_get_double (value);
+      break;
+    case PROP_MAX_RATE:
+      tempo->max_rate = g_value_get_double (value);
+      break;
+    case PROP_CPU_BUDGET:
+      tempo->cpu_budget = g_value_get_uint (value);
+      GST_DEBUG_OBJECT (tempo, "set cpu budget: %u%%", tempo->cpu_budget);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static gboolean
+gst_audioflinger_tempo_set_caps (GstBaseTransform * trans, GstCaps * incaps,
+    GstCaps * outcaps)
+{
+  GstAudioFlingerTempo *tempo = GST_AUDIOFLINGERTEMPO (trans);
+  GstStructure *structure = gst_caps_get_structure (incaps, 0);
+  AudioFlingerStretch *stretch = NULL;
+  gboolean is_signed = FALSE;
+  gint rate, channels, width = 0;
+
+  if (!gst_structure_get_int (structure, "rate", &rate) ||
+      !gst_structure_get_int (structure, "channels", &channels))
+    return FALSE;
+
+  /* other formats pass through, the sink converts them */
+  gst_structure_get_int (structure, "width", &width);
+  gst_structure_get_boolean (structure, "signed", &is_signed);
+  if (gst_structure_has_name (structure, "audio/x-raw-int") &&
+      width == 16 && is_signed) {
+    stretch = audioflinger_stretch_new (channels, rate, tempo->stride,
+        tempo->search);
+    if (stretch == NULL)
+      GST_WARNING_OBJECT (tempo, "can't stretch %d channels at %d Hz",
+          channels, rate);
+  }
+  if (stretch == NULL) {
+    GST_DEBUG_OBJECT (tempo, "%" GST_PTR_FORMAT " passes through", incaps);
+    GST_OBJECT_LOCK (tempo);
+    audioflinger_stretch_free (tempo->stretch);
+    tempo->stretch = NULL;
+    GST_OBJECT_UNLOCK (tempo);
+    tempo->stretching = FALSE;
+    tempo->scale = 1.0;
+    tempo->bytes_per_frame = 0;
+    gst_base_transform_set_passthrough (trans, TRUE);
+    return TRUE;
+  }
+  audioflinger_stretch_set_tempo (stretch, tempo->scale);
+
+  GST_OBJECT_LOCK (tempo);
+  audioflinger_stretch_free (tempo->stretch);
+  tempo->stretch = stretch;
+  GST_OBJECT_UNLOCK (tempo);
+  tempo->rate = rate;
+  tempo->bytes_per_frame = channels * 2;
+  tempo->next_ts = GST_CLOCK_TIME_NONE;
+  tempo->load = 0;
+
+  GST_DEBUG_OBJECT (tempo, "%d channels at %d Hz, stride %u ms, search %u ms",
+      channels, rate, tempo->stride, tempo->search);
+  return TRUE;
+}
+
+static gboolean
+gst_audioflinger_tempo_transform_size (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, guint size,
+    GstCaps * othercaps, guint * othersize)
+{
+  GstAudioFlingerTempo *tempo = GST_AUDIOFLINGERTEMPO (trans);
+
+  if (direction == GST_PAD_SINK && tempo->stretch &&
+      tempo->bytes_per_frame > 0) {
+    *othersize = audioflinger_stretch_max_out (tempo->stretch,
+        size / tempo->bytes_per_frame) * tempo->bytes_per_frame;
+  }
+  else {
+    *othersize = size;
+  }
+  return TRUE;
+}
+
+static GstFlowReturn
+gst_audioflinger_tempo_transform (GstBaseTransform * trans,
+    GstBuffer * inbuf, GstBuffer * outbuf)
+{
+  GstAudioFlingerTempo *tempo = GST_AUDIOFLINGERTEMPO (trans);
+  GstClockTime start = gst_util_get_timestamp ();
+  GstClockTime timestamp = GST_BUFFER_TIMESTAMP (inbuf);
+  GstClockTime duration;
+  gint frames;
+
+  if (tempo->stretch == NULL)
+    return GST_FLOW_NOT_NEGOTIATED;
+
+  /* output follows the stretched segment, resync it on discontinuities */
+  if (GST_CLOCK_TIME_IS_VALID (timestamp) && 
+      (!GST_CLOCK_TIME_IS_VALID (tempo->next_ts) || 
+       GST_BUFFER_IS_DISCONT (inbuf))) {
+    gint64 offset = (gint64) timestamp - tempo->segment_start;
+
+    tempo->next_ts = tempo->segment_start + 
+        (gint64) (MAX (offset, 0) / tempo->scale);
+  }
+
+  frames = audioflinger_stretch_process (tempo->stretch,
+      (const int16_t *) GST_BUFFER_DATA (inbuf),
+      GST_BUFFER_SIZE (inbuf) / tempo->bytes_per_frame,
+      (int16_t *) GST_BUFFER_DATA (outbuf));
+  GST_BUFFER_SIZE (outbuf) = frames * tempo->bytes_per_frame;
+  if (frames == 0)
+    return GST_BASE_TRANSFORM_FLOW_DROPPED;
+
+  duration = gst_util_uint64_scale_int (frames, GST_SECOND, tempo->rate);
+  GST_BUFFER_TIMESTAMP (outbuf) = tempo->next_ts;
+  GST_BUFFER_DURATION (outbuf) = duration;
+  if (GST_CLOCK_TIME_IS_VALID (tempo->next_ts))
+    tempo->next_ts += duration;
+
+  gst_audioflinger_tempo_update_load (tempo, 
+      gst_util_get_timestamp () - start, duration);
+  return GST_FLOW_OK;
+}
+
+/*
+ * Keep stretching within the cpu budget: the search compares every step-th
+ * offset, so doubling the step about halves its cost. It's halved back when
+ * the load is well below the budget.
+ */
+static void
+gst_audioflinger_tempo_update_load (GstAudioFlingerTempo * tempo,
+    GstClockTime elapsed, GstClockTime played)
+{
+  guint budget = tempo->cpu_budget * 10;
+  guint load;
+  gint step;
+
+  load = (guint) MIN (gst_util_uint64_scale (elapsed, 1000, played), 1000);
+  tempo->load = (tempo->load * 7 + load) / 8;
+
+  GST_OBJECT_LOCK (tempo);
+  step = audioflinger_stretch_get_step (tempo->stretch);
+  if (tempo->load > budget && step < MAX_SEARCH_STEP) {
+    audioflinger_stretch_set_step (tempo->stretch, step * 2);
+    /* let the average follow the new step */
+    tempo->load = budget;
+  }
+  else if (tempo->load < budget / 4 && step > 1) {
+    audioflinger_stretch_set_step (tempo->stretch, step / 2);
+    tempo->load = budget / 2;
+  }
+  step = audioflinger_stretch_get_step (tempo->stretch);
+  GST_OBJECT_UNLOCK (tempo);
+
+  if (tempo->load > budget && step >= MAX_SEARCH_STEP) {
+    if (!tempo->over_budget)
+      GST_WARNING_OBJECT (tempo, "load %u per mille is over budget at the "
+          "coarsest search", tempo->load);
+    tempo->over_budget = TRUE;
+  }
+  else {
+    tempo->over_budget = FALSE;
+  }
+}
+
+/*
+ * A segment at a rate in range is stretched: it's passed on at rate 1, with
+ * the rate applied, its stop scaled like the timestamps of output.
+ */
+static gboolean
+gst_audioflinger_tempo_event (GstBaseTransform * trans, GstEvent * event)
+{
+  GstAudioFlingerTempo *tempo = GST_AUDIOFLINGERTEMPO (trans);
+  gboolean update;
+  gdouble rate, applied_rate;
+  GstFormat format;
+  gint64 start, stop, position;
+
+  /* base class keeps the segment */
+  if (!parent_class->event (trans, event))
+    return FALSE;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_STOP:
+      if (tempo->stretch)
+        audioflinger_stretch_reset (tempo->stretch);
+      tempo->next_ts = GST_CLOCK_TIME_NONE;
+      break;
+    case GST_EVENT_NEWSEGMENT:
+      gst_event_parse_new_segment_full (event, &update, &rate, &applied_rate,
+          &format, &start, &stop, &position);
+      tempo->next_ts = GST_CLOCK_TIME_NONE;
+
+      if (format != GST_FORMAT_TIME || rate == 1.0 || tempo->stretch == NULL ||
+          rate < tempo->min_rate || rate > tempo->max_rate) {
+        if (tempo->stretching)
+          GST_DEBUG_OBJECT (tempo, "rate %f passes through", rate);
+        tempo->stretching = FALSE;
+        tempo->scale = 1.0;
+        gst_base_transform_set_passthrough (trans, TRUE);
+        break;
+      }
+
+      if (!tempo->stretching || rate != tempo->scale)
+        GST_DEBUG_OBJECT (tempo, "stretch rate %f", rate);
+      tempo->stretching = TRUE;
+      tempo->scale = rate;
+      tempo->segment_start = start;
+      if (tempo->stretch)
+        audioflinger_stretch_set_tempo (tempo->stretch, rate);
+      gst_base_transform_set_passthrough (trans, FALSE);
+
+      if (stop != -1)
+        stop = start + (gint64) ((stop - start) / rate);
+      gst_pad_push_event (GST_BASE_TRANSFORM_SRC_PAD (trans),
+          gst_event_new_new_segment_full (update, 1.0, rate * applied_rate,
+              format, start, stop, position));
+      return FALSE;
+    default:
+      break;
+  }
+  return TRUE;
+}
+
+/* the stretcher is kept for the caps, which may not be set again */
+static gboolean
+gst_audioflinger_tempo_stop (GstBaseTransform * trans)
+{
+  GstAudioFlingerTempo *tempo = GST_AUDIOFLINGERTEMPO (trans);
+
+  if (tempo->stretch)
+    audioflinger_stretch_reset (tempo->stretch);
+  tempo->next_ts = GST_CLOCK_TIME_NONE;
+  tempo->stretching = FALSE;
+  tempo->scale = 1.0;
+  gst_base_transform_set_passthrough (trans, TRUE);
+  return TRUE;
+}
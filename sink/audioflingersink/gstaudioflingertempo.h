@@ -0,0 +1,76 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_AUDIOFLINGERTEMPO_H__
+#define __GST_AUDIOFLINGERTEMPO_H__
+
+
+#include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+#include "audioflinger_stretch.h"
+
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_AUDIOFLINGERTEMPO            (gst_audioflinger_tempo_get_type())
+#define GST_AUDIOFLINGERTEMPO(obj)            (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_AUDIOFLINGERTEMPO,GstAudioFlingerTempo))
+#define GST_AUDIOFLINGERTEMPO_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_AUDIOFLINGERTEMPO,GstAudioFlingerTempoClass))
+#define GST_IS_AUDIOFLINGERTEMPO(obj)         (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_AUDIOFLINGERTEMPO))
+#define GST_IS_AUDIOFLINGERTEMPO_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_AUDIOFLINGERTEMPO))
+
+typedef struct _GstAudioFlingerTempo GstAudioFlingerTempo;
+typedef struct _GstAudioFlingerTempoClass GstAudioFlingerTempoClass;
+
+struct _GstAudioFlingerTempo {
+  GstBaseTransform element;
+
+  AudioFlingerStretch *stretch;
+  gint   rate;
+  gint   bytes_per_frame;
+  /* rate of the segment. Between min_rate and max_rate, it's played by
+   * stretching and the segment downstream is at rate 1, otherwise data
+   * passes through. Set in streaming thread */
+  gdouble scale;
+  gboolean stretching;
+  /* output is timestamped from the start of segment at 1 / scale, and
+   * next_ts follows the frames output. NONE after a flush */
+  gint64 segment_start;
+  GstClockTime next_ts;
+  /* parameters of the stretcher, they take effect at the next caps */
+  guint  stride;
+  guint  search;
+  gdouble min_rate;
+  gdouble max_rate;
+  /* stretching may take cpu_budget percent of the duration it outputs.
+   * Above it, the search gets coarser, and finer again well below it.
+   * load is the average in per mille */
+  guint  cpu_budget;
+  guint  load;
+  gboolean over_budget;
+};
+
+struct _GstAudioFlingerTempoClass {
+  GstBaseTransformClass parent_class;
+};
+
+GType gst_audioflinger_tempo_get_type(void);
+
+G_END_DECLS
+
+#endif /* __GST_AUDIOFLINGERTEMPO_H__ */
@@ -0,0 +1,113 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * This is a benchmark application of the resampler. It reports the CPU
+ * time per second of stereo audio to resample it to the output rate, and
+ * of the passthrough path, which copies it to the track as it is.
+ *
+ * usage: audioresamplebench [in_rate [out_rate [seconds]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "audioflinger_resample.h"
+
+/* frames per write, like a 20 ms segment */
+#define CHUNK_FRAMES 1024
+
+static const char *quality_names[] = { "passthrough", "low", "medium", "high" };
+
+static double
+cpu_ms (void)
+{
+  return clock () * 1000.0 / CLOCKS_PER_SEC;
+}
+
+int
+main (int argc, char **argv)
+{
+  int in_rate = (argc > 1) ? atoi (argv[1]) : 44100;
+  int out_rate = (argc > 2) ? atoi (argv[2]) : 48000;
+  int seconds = (argc > 3) ? atoi (argv[3]) : 20;
+  int frames = in_rate * seconds;
+  int16_t *input;
+  int16_t *output;
+  int quality;
+  int i;
+
+  if (in_rate <= 0 || out_rate <= 0 || seconds <= 0) {
+    printf ("usage: %s [in_rate [out_rate [seconds]]]\n", argv[0]);
+    return 1;
+  }
+
+  input = malloc (frames * 2 * sizeof (int16_t));
+  output = malloc ((CHUNK_FRAMES * (out_rate / in_rate + 2) + 64) * 2 *
+      sizeof (int16_t));
+  if (input == NULL || output == NULL)
+    return 1;
+  /* a 1 kHz tone on the left, 5 kHz on the right */
+  for (i = 0; i < frames; i++) {
+    input[2 * i] = (int16_t) (16000 * sin (2 * M_PI * 1000 * i / in_rate));
+    input[2 * i + 1] = (int16_t) (16000 * sin (2 * M_PI * 5000 * i / in_rate));
+  }
+
+  printf ("%d Hz -> %d Hz, %d s of stereo\n", in_rate, out_rate, seconds);
+  for (quality = AUDIOFLINGER_RESAMPLE_NONE;
+      quality <= AUDIOFLINGER_RESAMPLE_HIGH; quality++) {
+    AudioFlingerResampler *resampler = NULL;
+    long long out_frames = 0;
+    double start;
+    int done;
+
+    if (quality != AUDIOFLINGER_RESAMPLE_NONE) {
+      resampler = audioflinger_resampler_new (2, in_rate, out_rate,
+          (AudioFlingerResampleQuality) quality);
+      if (resampler == NULL) {
+        printf ("%-12s not supported for these rates\n",
+            quality_names[quality]);
+        continue;
+      }
+    }
+
+    start = cpu_ms ();
+    for (done = 0; done < frames; done += CHUNK_FRAMES) {
+      int n = (frames - done < CHUNK_FRAMES) ? frames - done : CHUNK_FRAMES;
+
+      if (resampler)
+        out_frames += audioflinger_resampler_process (resampler,
+            input + 2 * done, n, output);
+      else {
+        memcpy (output, input + 2 * done, n * 2 * sizeof (int16_t));
+        out_frames += n;
+      }
+    }
+    printf ("%-12s %8.3f ms CPU per second of audio, %lld frames\n",
+        quality_names[quality], (cpu_ms () - start) / seconds, out_frames);
+
+    audioflinger_resampler_free (resampler);
+  }
+
+  free (input);
+  free (output);
+  return 0;
+}
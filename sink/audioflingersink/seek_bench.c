@@ -0,0 +1,173 @@
+/* GStreamer
+ * Copyright (C) <2009> Prajnashi S <prajnashi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * This is a benchmark application of seeking on the device. It measures the
+ * time from a seek until the playback head reaches the first frame written
+ * after it, when the track drains what it holds (as the sink did before it
+ * handled flushes), and when it's paused, flushed and started again with new
+ * data (as the sink does on FLUSH_START and FLUSH_STOP). The output latency
+ * after the mixer adds to both alike.
+ *
+ * Data is written a segment at a time, as fast as the track takes it, like
+ * a decoder which runs faster than real time after a seek.
+ *
+ * usage: audioseekbench [rate [segment_ms [buffer_ms [seeks]]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include "audioflinger_wrapper.h"
+
+#define STREAM_TYPE 3
+#define CHANNELS 2
+
+static double
+now_ms (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* write frames of segment, return the frames the device took */
+static uint32_t
+write_segment (AudioFlingerDeviceHandle device, int16_t * segment,
+    int frames)
+{
+  ssize_t written;
+
+  written = audioflinger_device_write (device, segment,
+      frames * CHANNELS * sizeof (int16_t));
+  if (written <= 0)
+    return 0;
+  return (uint32_t) (written / (CHANNELS * sizeof (int16_t)));
+}
+
+/* play for a while, so that the track is full when seeking */
+static uint32_t
+play (AudioFlingerDeviceHandle device, int16_t * segment, int frames,
+    int segments)
+{
+  uint32_t written = 0;
+  int i;
+
+  for (i = 0; i < segments; i++)
+    written += write_segment (device, segment, frames);
+  return written;
+}
+
+/* the track keeps what it holds, new data queues behind it */
+static double
+seek_drain (AudioFlingerDeviceHandle device, int16_t * segment, int frames,
+    uint32_t written)
+{
+  double start = now_ms ();
+  uint32_t mark = written;
+  uint32_t position = 0;
+
+  while (audioflinger_device_get_position (device, &position) == 0 &&
+      (int32_t) (position - mark) < 0)
+    written += write_segment (device, segment, frames);
+  return now_ms () - start;
+}
+
+/* the track is paused, flushed, and started again after the first segment */
+static double
+seek_flush (AudioFlingerDeviceHandle device, int16_t * segment, int frames)
+{
+  double start = now_ms ();
+  uint32_t position = 0;
+
+  audioflinger_device_pause (device);
+  audioflinger_device_flush (device);
+  write_segment (device, segment, frames);
+  audioflinger_device_start (device);
+  while (audioflinger_device_get_position (device, &position) == 0 &&
+      position == 0)
+    write_segment (device, segment, frames);
+  return now_ms () - start;
+}
+
+int
+main (int argc, char **argv)
+{
+  int rate = (argc > 1) ? atoi (argv[1]) : 44100;
+  int segment_ms = (argc > 2) ? atoi (argv[2]) : 20;
+  int buffer_ms = (argc > 3) ? atoi (argv[3]) : 500;
+  int seeks = (argc > 4) ? atoi (argv[4]) : 5;
+  int frames, buffer_frames, segments;
+  AudioFlingerDeviceHandle device;
+  int16_t *segment;
+  double drain = 0.0, flush = 0.0;
+  int i;
+
+  if (rate <= 0 || segment_ms <= 0 || buffer_ms < segment_ms || seeks <= 0) {
+    printf ("usage: %s [rate [segment_ms [buffer_ms [seeks]]]]\n", argv[0]);
+    return 1;
+  }
+  frames = rate * segment_ms / 1000;
+  buffer_frames = rate * buffer_ms / 1000;
+  /* a second of playing between seeks */
+  segments = 1000 / segment_ms + 1;
+
+  segment = calloc (frames * CHANNELS, sizeof (int16_t));
+  device = audioflinger_device_create ();
+  if (segment == NULL || device == NULL ||
+      audioflinger_device_set (device, STREAM_TYPE, CHANNELS, rate,
+          buffer_frames) != 0) {
+    printf ("can't set the device\n");
+    return 1;
+  }
+
+  printf ("%d Hz, %d ms segments, %d ms track buffer, %d frames, "
+      "latency %d ms\n", rate, segment_ms, buffer_ms,
+      audioflinger_device_frameCount (device),
+      (int) audioflinger_device_latency (device));
+
+  audioflinger_device_start (device);
+  for (i = 0; i < seeks; i++) {
+    uint32_t written;
+
+    /* the position restarts from 0 after a flush */
+    audioflinger_device_pause (device);
+    audioflinger_device_flush (device);
+    audioflinger_device_start (device);
+    written = play (device, segment, frames, segments);
+    drain += seek_drain (device, segment, frames, written);
+
+    play (device, segment, frames, segments);
+    flush += seek_flush (device, segment, frames);
+  }
+
+  printf ("drain       %8.1f ms from seek to new data at the playback head\n",
+      drain / seeks);
+  printf ("flush       %8.1f ms from seek to new data at the playback head\n",
+      flush / seeks);
+
+  audioflinger_device_stop (device);
+  audioflinger_device_release (device);
+  free (segment);
+  return 0;
+}
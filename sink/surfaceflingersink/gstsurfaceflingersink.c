@@ -39,12 +39,30 @@ GST_ELEMENT_DETAILS ("android's surface flinger sink",
     "A linux framebuffer videosink",
     "Prajnashi S <prajnashi@gmail.com>");
 
+#define DEFAULT_BUFFER_COUNT 2
+#define DEFAULT_MAX_RENDER_RATE 0
+#define DEFAULT_ZERO_COPY TRUE
+#define DEFAULT_SIGNAL_POSTS FALSE
+
+enum
+{
+  SIGNAL_FRAME_POSTED,
+  LAST_SIGNAL
+};
+
 enum
 {
   ARG_0,
   PROP_SURFACE,
+  PROP_BUFFER_COUNT,
+  PROP_MAX_RENDER_RATE,
+  PROP_ZERO_COPY,
+  PROP_COPIED_FRAMES,
+  PROP_SIGNAL_POSTS,
 };
 
+static guint gst_surfaceflinger_sink_signals[LAST_SIGNAL] = { 0 };
+
 static void gst_surfaceflinger_sink_base_init (gpointer g_class);
 static void gst_surfaceflinger_sink_class_init (GstSurfaceFlingerSinkClass * klass);
 static void gst_surfaceflinger_sink_get_times (GstBaseSink * basesink,
@@ -52,8 +70,15 @@ static void gst_surfaceflinger_sink_get_times (GstBaseSink * basesink,
 
 static gboolean gst_surfaceflinger_sink_setcaps (GstBaseSink * bsink, GstCaps * caps);
 
+static GstFlowReturn gst_surfaceflinger_sink_preroll (GstBaseSink * bsink,
+    GstBuffer * buff);
 static GstFlowReturn gst_surfaceflinger_sink_render (GstBaseSink * bsink,
     GstBuffer * buff);
+static GstFlowReturn gst_surfaceflinger_sink_buffer_alloc (GstBaseSink * bsink,
+    guint64 offset, guint size, GstCaps * caps, GstBuffer ** buf);
+static void gst_surfaceflinger_sink_post (GstSurfaceFlingerSink * surfacesink,
+    GstBuffer * buf);
+static void gst_surfaceflinger_sink_reset_slots (GstSurfaceFlingerSink * surfacesink);
 static gboolean gst_surfaceflinger_sink_start (GstBaseSink * bsink);
 static gboolean gst_surfaceflinger_sink_stop (GstBaseSink * bsink);
 
@@ -70,6 +95,78 @@ static GstCaps *gst_surfaceflinger_sink_getcaps (GstBaseSink * bsink);
 
 static GstVideoSinkClass *parent_class = NULL;
 
+/*
+ * A frame buffer of the registered heap, given to decoders by buffer_alloc.
+ * It keeps the heap mapped, and its slot is free again once it's finalized
+ * and another frame is shown.
+ */
+typedef struct
+{
+    GstBuffer buffer;
+    GstSurfaceFlingerSink *surfacesink;
+    gpointer heap;
+    gint index;
+    guint generation;
+} GstSurfaceFlingerBuffer;
+
+#define GST_TYPE_SURFACEFLINGER_BUFFER (gst_surfaceflinger_buffer_get_type())
+#define GST_IS_SURFACEFLINGER_BUFFER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_SURFACEFLINGER_BUFFER))
+
+static GstMiniObjectClass *buffer_parent_class = NULL;
+
+static void
+gst_surfaceflinger_buffer_finalize (GstSurfaceFlingerBuffer * buffer)
+{
+    GstSurfaceFlingerSink *surfacesink = buffer->surfacesink;
+
+    /* slots of a previous heap aren't tracked any more */
+    GST_OBJECT_LOCK (surfacesink);
+    if (buffer->generation == surfacesink->generation)
+        surfacesink->slots_busy &= ~(1 << buffer->index);
+    GST_OBJECT_UNLOCK (surfacesink);
+
+    videoflinger_device_unref_heap (buffer->heap);
+    gst_object_unref (surfacesink);
+
+    buffer_parent_class->finalize (GST_MINI_OBJECT (buffer));
+}
+
+static void
+gst_surfaceflinger_buffer_class_init (gpointer g_class, gpointer class_data)
+{
+    GstMiniObjectClass *mini_object_class = GST_MINI_OBJECT_CLASS (g_class);
+
+    buffer_parent_class = g_type_class_peek_parent (g_class);
+    mini_object_class->finalize = 
+        (GstMiniObjectFinalizeFunction) gst_surfaceflinger_buffer_finalize;
+}
+
+static GType
+gst_surfaceflinger_buffer_get_type (void)
+{
+    static GType buffer_type = 0;
+
+    if (!buffer_type) {
+        static const GTypeInfo buffer_info = {
+            sizeof (GstBufferClass),
+            NULL,
+            NULL,
+            gst_surfaceflinger_buffer_class_init,
+            NULL,
+            NULL,
+            sizeof (GstSurfaceFlingerBuffer),
+            0,
+            NULL,
+            NULL
+        };
+
+        buffer_type = g_type_register_static (GST_TYPE_BUFFER, 
+            "GstSurfaceFlingerBuffer", &buffer_info, 0);
+    }
+    return buffer_type;
+}
+
 /* TODO: support more pixel form in the future */
 #define GST_SURFACE_TEMPLATE_CAPS GST_VIDEO_CAPS_RGB_16
 
@@ -154,31 +251,231 @@ gst_surfaceflinger_sink_setcaps (GstBaseSink * bsink, GstCaps * vscapslist)
     GST_DEBUG_OBJECT (surfacesink, "register framebuffers: width=%d,  height=%d,  pixel_format=%d",  
         surfacesink->width, surfacesink->height, surfacesink->pixel_format);
 
-    /* register frame buffer */
+    /* frame buffers given to decoders aren't returned to the new heap */
+    gst_surfaceflinger_sink_reset_slots (surfacesink);
+
+    /* register frame buffer. Zero copy takes one more: while one frame is
+     * shown and the next one is posted, the decoder fills a third one. At
+     * the maximum count it can't, and fewer frame buffers go to decoders */
     videoflinger_device_register_framebuffers(
         surfacesink->videodev, surfacesink->width, 
-        surfacesink->height, surfacesink->pixel_format);
+        surfacesink->height, surfacesink->pixel_format,
+        surfacesink->buffer_count + (surfacesink->zero_copy ? 1 : 0));
 
     GST_DEBUG_OBJECT (surfacesink, "gst_surfaceflinger_sink_setcaps return true");
     return TRUE;
 }
 
 
+static GstFlowReturn
+gst_surfaceflinger_sink_preroll (GstBaseSink * bsink, GstBuffer * buf)
+{
+    GstSurfaceFlingerSink *surfacesink;
+
+    surfacesink = GST_SURFACEFLINGERSINK (bsink);
+
+    /* a prerolled frame is always shown, it may be the target of seek */
+    surfacesink->last_render_time = gst_util_get_timestamp ();
+    gst_surfaceflinger_sink_post (surfacesink, buf);
+    gst_buffer_replace (&surfacesink->prerolled, buf);
+
+    return GST_FLOW_OK;
+}
+
 static GstFlowReturn
 gst_surfaceflinger_sink_render (GstBaseSink * bsink, GstBuffer * buf)
 {
     GstSurfaceFlingerSink *surfacesink;
 
     surfacesink = GST_SURFACEFLINGERSINK (bsink);
-    GST_DEBUG_OBJECT(surfacesink, "post buffer=%p, size=%d", GST_BUFFER_DATA (buf), GST_BUFFER_SIZE (buf));
-    
+
+    /* the first buffer after preroll is shown already */
+    if (buf == surfacesink->prerolled)
+    {
+        gst_buffer_replace (&surfacesink->prerolled, NULL);
+        GST_LOG_OBJECT (surfacesink, "buffer=%p is posted by preroll", buf);
+        return GST_FLOW_OK;
+    }
+    gst_buffer_replace (&surfacesink->prerolled, NULL);
+
+    /* in trick mode frames arrive faster than real time, drop those which
+     * come within the minimum interval of max-render-rate */
+    if (surfacesink->max_render_rate > 0)
+    {
+        GstClockTime now = gst_util_get_timestamp ();
+
+        if (GST_CLOCK_TIME_IS_VALID (surfacesink->last_render_time) &&
+            now < surfacesink->last_render_time + 
+                GST_SECOND / surfacesink->max_render_rate)
+        {
+            surfacesink->dropped++;
+            GST_LOG_OBJECT (surfacesink, "drop buffer=%p, %" G_GUINT64_FORMAT
+                " dropped", buf, surfacesink->dropped);
+            return GST_FLOW_OK;
+        }
+        surfacesink->last_render_time = now;
+    }
+
     /* post frame buffer */
-    videoflinger_device_post(surfacesink->videodev, GST_BUFFER_DATA (buf), GST_BUFFER_SIZE (buf));
+    gst_surfaceflinger_sink_post (surfacesink, buf);
 
     GST_DEBUG_OBJECT (surfacesink, "gst_surfaceflinger_sink_render return GST_FLOW_OK");
     return GST_FLOW_OK;
 }
 
+/* a frame buffer which is neither owned by a GstBuffer nor shown, -1 if
+ * there's none. The object lock shall be held */
+static gint
+gst_surfaceflinger_sink_free_slot (GstSurfaceFlingerSink * surfacesink)
+{
+    gint count = videoflinger_device_framebuffer_count (surfacesink->videodev);
+    gint i;
+
+    /* round robin from the one shown */
+    for (i = 1; i <= count; i++)
+    {
+        gint index = (surfacesink->displayed + i) % count;
+
+        if (index != surfacesink->displayed && 
+            !(surfacesink->slots_busy & (1 << index)))
+            return index;
+    }
+    return -1;
+}
+
+static void
+gst_surfaceflinger_sink_reset_slots (GstSurfaceFlingerSink * surfacesink)
+{
+    GST_OBJECT_LOCK (surfacesink);
+    surfacesink->generation++;
+    surfacesink->slots_busy = 0;
+    surfacesink->displayed = -1;
+    GST_OBJECT_UNLOCK (surfacesink);
+}
+
+/*
+ * Give a free frame buffer of the registered heap to the decoder, so that
+ * it's posted without a copy. Buffers of other caps, and buffers asked for
+ * when every frame buffer is busy, are left to basesink and copied. The last
+ * free frame buffer is never given: it's kept for those copies, which would
+ * be dropped while decoders or queues hold all the others.
+ */
+static GstFlowReturn
+gst_surfaceflinger_sink_buffer_alloc (GstBaseSink * bsink, guint64 offset,
+    guint size, GstCaps * caps, GstBuffer ** buf)
+{
+    GstSurfaceFlingerSink *surfacesink;
+    GstSurfaceFlingerBuffer *buffer;
+    GstStructure *structure;
+    gint width = 0, height = 0;
+    gint index;
+    guint generation;
+
+    surfacesink = GST_SURFACEFLINGERSINK (bsink);
+
+    *buf = NULL;
+    if (!surfacesink->zero_copy || caps == NULL)
+        return GST_FLOW_OK;
+
+    /* rows of frame buffers are as wide as the frame, which shall be even */
+    structure = gst_caps_get_structure (caps, 0);
+    if (!gst_structure_get_int (structure, "width", &width) ||
+        !gst_structure_get_int (structure, "height", &height) ||
+        width != surfacesink->width || height != surfacesink->height ||
+        (width & 1) != 0 || (gint) size > 
+            videoflinger_device_framebuffer_size (surfacesink->videodev))
+        return GST_FLOW_OK;
+
+    GST_OBJECT_LOCK (surfacesink);
+    index = gst_surfaceflinger_sink_free_slot (surfacesink);
+    if (index >= 0)
+    {
+        surfacesink->slots_busy |= (1 << index);
+        if (gst_surfaceflinger_sink_free_slot (surfacesink) < 0)
+        {
+            surfacesink->slots_busy &= ~(1 << index);
+            index = -1;
+        }
+    }
+    generation = surfacesink->generation;
+    GST_OBJECT_UNLOCK (surfacesink);
+    if (index < 0)
+    {
+        GST_LOG_OBJECT (surfacesink, "no free frame buffer, it will be copied");
+        return GST_FLOW_OK;
+    }
+
+    buffer = (GstSurfaceFlingerBuffer *) 
+        gst_mini_object_new (GST_TYPE_SURFACEFLINGER_BUFFER);
+    buffer->surfacesink = gst_object_ref (surfacesink);
+    buffer->heap = videoflinger_device_ref_heap (surfacesink->videodev);
+    buffer->index = index;
+    buffer->generation = generation;
+    GST_BUFFER_DATA (buffer) = 
+        videoflinger_device_get_framebuffer (surfacesink->videodev, index);
+    GST_BUFFER_SIZE (buffer) = size;
+    GST_BUFFER_OFFSET (buffer) = offset;
+    gst_buffer_set_caps (GST_BUFFER (buffer), caps);
+
+    GST_LOG_OBJECT (surfacesink, "alloc frame buffer %d, size=%d", index, size);
+    *buf = GST_BUFFER (buffer);
+    return GST_FLOW_OK;
+}
+
+/*
+ * Show a frame: a frame buffer of the heap is posted by its offset, other
+ * buffers are copied into a free frame buffer first.
+ */
+static void
+gst_surfaceflinger_sink_post (GstSurfaceFlingerSink * surfacesink, 
+    GstBuffer * buf)
+{
+    GstSurfaceFlingerBuffer *buffer = (GstSurfaceFlingerBuffer *) buf;
+    gboolean copy = TRUE;
+    gint index;
+
+    GST_OBJECT_LOCK (surfacesink);
+    if (GST_IS_SURFACEFLINGER_BUFFER (buf) && 
+        buffer->surfacesink == surfacesink &&
+        buffer->generation == surfacesink->generation)
+    {
+        index = buffer->index;
+        copy = FALSE;
+    }
+    else
+    {
+        index = gst_surfaceflinger_sink_free_slot (surfacesink);
+    }
+    if (index >= 0)
+        surfacesink->displayed = index;
+    GST_OBJECT_UNLOCK (surfacesink);
+
+    if (index < 0)
+    {
+        GST_WARNING_OBJECT (surfacesink, "no free frame buffer, drop buffer=%p", buf);
+        return;
+    }
+
+    if (copy)
+    {
+        gint size = MIN ((gint) GST_BUFFER_SIZE (buf), 
+            videoflinger_device_framebuffer_size (surfacesink->videodev));
+
+        memcpy (videoflinger_device_get_framebuffer (surfacesink->videodev, index),
+            GST_BUFFER_DATA (buf), size);
+        surfacesink->copied++;
+    }
+
+    GST_DEBUG_OBJECT(surfacesink, "post buffer=%p, size=%d, frame buffer %d%s", 
+        GST_BUFFER_DATA (buf), GST_BUFFER_SIZE (buf), index, 
+        copy ? ", copied" : "");
+    videoflinger_device_post_framebuffer(surfacesink->videodev, index);
+
+    if (surfacesink->signal_posts)
+        g_signal_emit (surfacesink, 
+            gst_surfaceflinger_sink_signals[SIGNAL_FRAME_POSTED], 0);
+}
+
 static gboolean
 gst_surfaceflinger_sink_start (GstBaseSink * bsink)
 {
@@ -201,6 +498,10 @@ gst_surfaceflinger_sink_start (GstBaseSink * bsink)
         GST_ERROR_OBJECT (surfacesink, "Failed to create video device.");
         return FALSE;
     }    
+    surfacesink->last_render_time = GST_CLOCK_TIME_NONE;
+    surfacesink->dropped = 0;
+    surfacesink->copied = 0;
+    gst_surfaceflinger_sink_reset_slots (surfacesink);
   
     GST_DEBUG_OBJECT (surfacesink, "gst_surfaceflinger_sink_start return TRUE");
     return TRUE;
@@ -218,7 +519,12 @@ gst_surfaceflinger_sink_stop (GstBaseSink * bsink)
         videoflinger_device_release ( surfacesink->videodev);
         surfacesink->videodev = NULL;
     }
+    gst_buffer_replace (&surfacesink->prerolled, NULL);
+    /* frame buffers still out keep the heap mapped until they're freed */
+    gst_surfaceflinger_sink_reset_slots (surfacesink);
 
+    GST_DEBUG_OBJECT (surfacesink, "%" G_GUINT64_FORMAT " frames copied",
+        surfacesink->copied);
     return TRUE;
 }
 
@@ -237,6 +543,26 @@ gst_surfaceflinger_sink_set_property (GObject * object, guint prop_id,
         GST_DEBUG_OBJECT (surfacesink, "set property: ISureface = %p",  surfacesink->isurface);
         break;
 
+    case PROP_BUFFER_COUNT:
+        surfacesink->buffer_count = g_value_get_int(value);
+        GST_DEBUG_OBJECT (surfacesink, "set property: buffer-count = %d",  surfacesink->buffer_count);
+        break;
+
+    case PROP_MAX_RENDER_RATE:
+        surfacesink->max_render_rate = g_value_get_int(value);
+        surfacesink->last_render_time = GST_CLOCK_TIME_NONE;
+        GST_DEBUG_OBJECT (surfacesink, "set property: max-render-rate = %d",  surfacesink->max_render_rate);
+        break;
+
+    case PROP_ZERO_COPY:
+        surfacesink->zero_copy = g_value_get_boolean(value);
+        GST_DEBUG_OBJECT (surfacesink, "set property: zero-copy = %d",  surfacesink->zero_copy);
+        break;
+
+    case PROP_SIGNAL_POSTS:
+        surfacesink->signal_posts = g_value_get_boolean(value);
+        break;
+
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -259,6 +585,26 @@ gst_surfaceflinger_sink_get_property (GObject * object, guint prop_id, GValue *
         GST_DEBUG_OBJECT (surfacesink, "get property: ISurface = %p.",  surfacesink->isurface);
         break;
 
+    case PROP_BUFFER_COUNT:
+        g_value_set_int (value, surfacesink->buffer_count);
+        break;
+
+    case PROP_MAX_RENDER_RATE:
+        g_value_set_int (value, surfacesink->max_render_rate);
+        break;
+
+    case PROP_ZERO_COPY:
+        g_value_set_boolean (value, surfacesink->zero_copy);
+        break;
+
+    case PROP_COPIED_FRAMES:
+        g_value_set_uint64 (value, surfacesink->copied);
+        break;
+
+    case PROP_SIGNAL_POSTS:
+        g_value_set_boolean (value, surfacesink->signal_posts);
+        break;
+
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -324,11 +670,48 @@ gst_surfaceflinger_sink_class_init (GstSurfaceFlingerSinkClass * klass)
         g_param_spec_pointer("surface", "Surface",
         "The pointer of ISurface interface", G_PARAM_READWRITE));
 
+    g_object_class_install_property (gobject_class, PROP_BUFFER_COUNT,
+        g_param_spec_int("buffer-count", "Buffer count",
+        "The number of frame buffers registered to surface flinger",
+        2, VIDEO_FLINGER_MAX_FRAME_BUFFERS, DEFAULT_BUFFER_COUNT,
+        G_PARAM_READWRITE));
+
+    g_object_class_install_property (gobject_class, PROP_MAX_RENDER_RATE,
+        g_param_spec_int("max-render-rate", "Max render rate",
+        "The maximum number of frames posted per second, others are "
+        "dropped (0 = unlimited)",
+        0, G_MAXINT, DEFAULT_MAX_RENDER_RATE, G_PARAM_READWRITE));
+
+    g_object_class_install_property (gobject_class, PROP_ZERO_COPY,
+        g_param_spec_boolean("zero-copy", "Zero copy",
+        "Let decoders write into the frame buffers registered to surface "
+        "flinger, instead of copying every frame. It takes one more frame "
+        "buffer from the next caps", DEFAULT_ZERO_COPY, G_PARAM_READWRITE));
+
+    g_object_class_install_property (gobject_class, PROP_COPIED_FRAMES,
+        g_param_spec_uint64("copied-frames", "Copied frames",
+        "The number of frames copied into frame buffers since start, "
+        "because they came in buffers of another allocator",
+        0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+    g_object_class_install_property (gobject_class, PROP_SIGNAL_POSTS,
+        g_param_spec_boolean("signal-posts", "Signal posts",
+        "Emit frame-posted when a frame is posted to surface flinger",
+        DEFAULT_SIGNAL_POSTS, G_PARAM_READWRITE));
+
+    /* emitted in streaming thread right after a frame is posted, if
+     * signal-posts is set */
+    gst_surfaceflinger_sink_signals[SIGNAL_FRAME_POSTED] =
+        g_signal_new ("frame-posted", G_TYPE_FROM_CLASS (klass),
+        G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_marshal_VOID__VOID,
+        G_TYPE_NONE, 0);
+
     gstvs_class->set_caps = GST_DEBUG_FUNCPTR (gst_surfaceflinger_sink_setcaps);
     gstvs_class->get_caps = GST_DEBUG_FUNCPTR (gst_surfaceflinger_sink_getcaps);
     gstvs_class->get_times = GST_DEBUG_FUNCPTR (gst_surfaceflinger_sink_get_times);
-    gstvs_class->preroll = GST_DEBUG_FUNCPTR (gst_surfaceflinger_sink_render);
+    gstvs_class->preroll = GST_DEBUG_FUNCPTR (gst_surfaceflinger_sink_preroll);
     gstvs_class->render = GST_DEBUG_FUNCPTR (gst_surfaceflinger_sink_render);
+    gstvs_class->buffer_alloc = GST_DEBUG_FUNCPTR (gst_surfaceflinger_sink_buffer_alloc);
     gstvs_class->start = GST_DEBUG_FUNCPTR (gst_surfaceflinger_sink_start);
     gstvs_class->stop = GST_DEBUG_FUNCPTR (gst_surfaceflinger_sink_stop);
 }
@@ -344,6 +727,17 @@ gst_surfaceflinger_sink_init (GstSurfaceFlingerSink * surfacesink)
     surfacesink->width = 320;
     surfacesink->height = 240;
     surfacesink->pixel_format = -1;
+    surfacesink->buffer_count = DEFAULT_BUFFER_COUNT;
+    surfacesink->max_render_rate = DEFAULT_MAX_RENDER_RATE;
+    surfacesink->last_render_time = GST_CLOCK_TIME_NONE;
+    surfacesink->dropped = 0;
+    surfacesink->prerolled = NULL;
+    surfacesink->signal_posts = DEFAULT_SIGNAL_POSTS;
+    surfacesink->zero_copy = DEFAULT_ZERO_COPY;
+    surfacesink->slots_busy = 0;
+    surfacesink->displayed = -1;
+    surfacesink->generation = 0;
+    surfacesink->copied = 0;
 }
 
 static void
@@ -48,6 +48,25 @@ struct _GstSurfaceFlingerSink {
   VideoFlingerDeviceHandle videodev;
   int width, height;
   int fps_n, fps_d;
+  int buffer_count;
+  /* render rate limit, frames not posted to keep under it are dropped */
+  int max_render_rate;
+  GstClockTime last_render_time;
+  guint64 dropped;
+  /* the buffer shown by preroll, render doesn't post it again */
+  GstBuffer *prerolled;
+  /* emit frame-posted after each post */
+  gboolean signal_posts;
+  /* decoders write into frame buffers of the registered heap, given by
+   * buffer_alloc. Frame buffers owned by GstBuffers are set in slots_busy,
+   * the one shown is displayed (-1 if none), and generation changes when
+   * the heap is registered again. Protected by the object lock */
+  gboolean zero_copy;
+  guint32 slots_busy;
+  gint displayed;
+  guint generation;
+  /* frames copied into the heap, from buffers it didn't give */
+  guint64 copied;
 };
 
 struct _GstSurfaceFlingerSinkClass {
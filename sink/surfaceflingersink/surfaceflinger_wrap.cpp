@@ -38,13 +38,11 @@ typedef struct
     uint32_t width;
     uint32_t height;
     PixelFormat format;
-    int frame_offset[2];
+    int frame_offset[VIDEO_FLINGER_MAX_FRAME_BUFFERS];
+    int buf_count;
     int buf_index;
 } VideoFlingerDevice;
 
-/* max frame buffers */
-#define  MAX_FRAME_BUFFERS     2
-
 static int videoflinger_device_create_new_surface(VideoFlingerDevice* videodev);
 
 /* 
@@ -84,8 +82,9 @@ VideoFlingerDeviceHandle videoflinger_device_create(void* isurface)
     videodev->height = 0;
     videodev->hor_stride = 0;
     videodev->ver_stride = 0;
+    videodev->buf_count = 0;
     videodev->buf_index = 0;
-    for ( int i = 0; i<MAX_FRAME_BUFFERS; i++)
+    for ( int i = 0; i<VIDEO_FLINGER_MAX_FRAME_BUFFERS; i++)
     {
         videodev->frame_offset[i] = 0;
     }
@@ -193,7 +192,7 @@ int videoflinger_device_release(VideoFlingerDeviceHandle handle)
 }
 
 int videoflinger_device_register_framebuffers(VideoFlingerDeviceHandle handle, 
-    int w, int h, VIDEO_FLINGER_PIXEL_FORMAT format)
+    int w, int h, VIDEO_FLINGER_PIXEL_FORMAT format, int count)
 {
     int surface_format = 0;
 
@@ -213,6 +212,13 @@ int videoflinger_device_register_framebuffers(VideoFlingerDeviceHandle handle,
         return -1;
     }
     surface_format = PIXEL_FORMAT_RGB_565;
+
+    /* at least double buffer is needed, or we will overwrite the frame
+     * which is displaying */
+    if (count < 2)
+        count = 2;
+    if (count > VIDEO_FLINGER_MAX_FRAME_BUFFERS)
+        count = VIDEO_FLINGER_MAX_FRAME_BUFFERS;
    
     VideoFlingerDevice *videodev = (VideoFlingerDevice*)handle;
     /* unregister previous buffers */
@@ -234,19 +240,20 @@ int videoflinger_device_register_framebuffers(VideoFlingerDeviceHandle handle,
         videoflinger_device_create_new_surface(videodev);
     }
 
-    /* use double buffer in post */
+    /* use count buffers in post */
     int frameSize = videodev->width * videodev->height * 2;
     GST_PLAYER_INFO( 
-        "format=%d, width=%d, height=%d, hor_stride=%d, ver_stride=%d, frameSize=%d",
+        "format=%d, width=%d, height=%d, hor_stride=%d, ver_stride=%d, frameSize=%d, count=%d",
         videodev->format,
         videodev->width,
         videodev->height,
         videodev->hor_stride,
         videodev->ver_stride,
-        frameSize);
+        frameSize,
+        count);
 
     /* create frame buffer heap base */
-    videodev->frame_heap = new MemoryHeapBase(frameSize * MAX_FRAME_BUFFERS);
+    videodev->frame_heap = new MemoryHeapBase(frameSize * count);
     if (videodev->frame_heap->heapID() < 0) 
     {
         GST_PLAYER_ERROR("Error creating frame buffer heap!");
@@ -269,10 +276,11 @@ int videoflinger_device_register_framebuffers(VideoFlingerDeviceHandle handle,
         return -1;
     }
 
-    for ( int i = 0; i<MAX_FRAME_BUFFERS; i++)
+    for ( int i = 0; i<count; i++)
     {
         videodev->frame_offset[i] = i*frameSize;
     }
+    videodev->buf_count = count;
     videodev->buf_index = 0;
     GST_PLAYER_INFO("Leave");
 
@@ -302,10 +310,11 @@ void videoflinger_device_unregister_framebuffers(VideoFlingerDeviceHandle handle
         videodev->frame_heap.clear();
 
         /* reset offset */
-        for (int i = 0; i<MAX_FRAME_BUFFERS; i++)
+        for (int i = 0; i<VIDEO_FLINGER_MAX_FRAME_BUFFERS; i++)
         {
             videodev->frame_offset[i] = 0;
         }
+        videodev->buf_count = 0;
             
         videodev->format = -1;
         videodev->width = 0;
@@ -329,7 +338,13 @@ void videoflinger_device_post(VideoFlingerDeviceHandle handle, void * buf, int b
 
     VideoFlingerDevice* videodev = (VideoFlingerDevice*)handle;
     
-    if (++videodev->buf_index == MAX_FRAME_BUFFERS) 
+    if (videodev->buf_count == 0)
+    {
+        GST_PLAYER_ERROR("Frame buffers are not registered");
+        return;
+    }
+
+    if (++videodev->buf_index == videodev->buf_count) 
         videodev->buf_index = 0;
    
     memcpy (static_cast<unsigned char *>(videodev->frame_heap->base()) + videodev->frame_offset[videodev->buf_index],  buf, bufsize);
@@ -339,3 +354,85 @@ void videoflinger_device_post(VideoFlingerDeviceHandle handle, void * buf, int b
 
     GST_PLAYER_INFO("Leave");
 }
+
+int videoflinger_device_framebuffer_count(VideoFlingerDeviceHandle handle)
+{
+    if (handle == NULL)
+    {
+        return 0;
+    }
+    return ((VideoFlingerDevice*)handle)->buf_count;
+}
+
+int videoflinger_device_framebuffer_size(VideoFlingerDeviceHandle handle)
+{
+    if (handle == NULL)
+    {
+        return 0;
+    }
+
+    VideoFlingerDevice* videodev = (VideoFlingerDevice*)handle;
+    if (videodev->buf_count == 0)
+    {
+        return 0;
+    }
+    return videodev->hor_stride * videodev->ver_stride * 2;
+}
+
+void * videoflinger_device_get_framebuffer(VideoFlingerDeviceHandle handle, int index)
+{
+    if (handle == NULL)
+    {
+        return NULL;
+    }
+
+    VideoFlingerDevice* videodev = (VideoFlingerDevice*)handle;
+    if (index < 0 || index >= videodev->buf_count)
+    {
+        return NULL;
+    }
+    return static_cast<unsigned char *>(videodev->frame_heap->base()) + 
+        videodev->frame_offset[index];
+}
+
+void videoflinger_device_post_framebuffer(VideoFlingerDeviceHandle handle, int index)
+{
+    if (handle == NULL)
+    {
+        return;
+    }
+
+    VideoFlingerDevice* videodev = (VideoFlingerDevice*)handle;
+    if (index < 0 || index >= videodev->buf_count)
+    {
+        GST_PLAYER_ERROR("Frame buffer %d is not registered", index);
+        return;
+    }
+
+    /* the copying post goes on after the frame buffer posted here */
+    videodev->buf_index = index;
+
+    GST_PLAYER_INFO ("Post buffer[%d].\n", index);
+    videodev->isurface->postBuffer(videodev->frame_offset[index]);
+}
+
+void * videoflinger_device_ref_heap(VideoFlingerDeviceHandle handle)
+{
+    if (handle == NULL)
+    {
+        return NULL;
+    }
+
+    VideoFlingerDevice* videodev = (VideoFlingerDevice*)handle;
+    if (videodev->frame_heap.get() == NULL)
+    {
+        return NULL;
+    }
+    return new sp<MemoryHeapBase>(videodev->frame_heap);
+}
+
+void videoflinger_device_unref_heap(void * heap)
+{
+    /* the heap is unmapped with its last reference */
+    delete static_cast<sp<MemoryHeapBase> *>(heap);
+}
@@ -38,6 +38,9 @@ extern "C" {
 
 typedef void* VideoFlingerDeviceHandle;
 
+/* max frame buffers registered to surface flinger */
+#define VIDEO_FLINGER_MAX_FRAME_BUFFERS     8
+
 typedef enum
 {
     VIDEO_FLINGER_RGB_565 = 1,
@@ -46,10 +49,26 @@ typedef enum
 
 VideoFlingerDeviceHandle videoflinger_device_create(void * isurface);
 int videoflinger_device_release(VideoFlingerDeviceHandle handle);
-int videoflinger_device_register_framebuffers(VideoFlingerDeviceHandle handle, int w, int h, VIDEO_FLINGER_PIXEL_FORMAT format);
+int videoflinger_device_register_framebuffers(VideoFlingerDeviceHandle handle, int w, int h, VIDEO_FLINGER_PIXEL_FORMAT format, int count);
 void videoflinger_device_unregister_framebuffers(VideoFlingerDeviceHandle handle);
+/* copy buf into the next frame buffer, round robin, and post it */
 void videoflinger_device_post(VideoFlingerDeviceHandle handle, void * buf, int bufsize);
 
+/* frame buffers in the registered heap: their number, 0 if none is
+ * registered, the size of each one, and the address of frame buffer index */
+int videoflinger_device_framebuffer_count(VideoFlingerDeviceHandle handle);
+int videoflinger_device_framebuffer_size(VideoFlingerDeviceHandle handle);
+void * videoflinger_device_get_framebuffer(VideoFlingerDeviceHandle handle, int index);
+
+/* post frame buffer index as it is, only its offset is sent */
+void videoflinger_device_post_framebuffer(VideoFlingerDeviceHandle handle, int index);
+
+/* a reference of the registered heap, it stays mapped until the reference
+ * is released, even if frame buffers are unregistered. NULL if none is
+ * registered */
+void * videoflinger_device_ref_heap(VideoFlingerDeviceHandle handle);
+void videoflinger_device_unref_heap(void * heap);
+
 #ifdef __cplusplus
 }
 #endif
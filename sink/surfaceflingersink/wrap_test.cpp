@@ -45,7 +45,7 @@ int main(int argc, char** argv)
     videodev = videoflinger_device_create(NULL);
     
     // register buffer
-    videoflinger_device_register_framebuffers(videodev, WIDTH, HEIGHT, VIDEO_FLINGER_RGB_565);
+    videoflinger_device_register_framebuffers(videodev, WIDTH, HEIGHT, VIDEO_FLINGER_RGB_565, 2);
     
     for (int step=0; step<MAX_STEP; step++)
     {